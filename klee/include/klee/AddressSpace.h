@@ -14,6 +14,7 @@
 
 #include "klee/Expr.h"
 #include "klee/Internal/ADT/ImmutableMap.h"
+#include "klee/Internal/ADT/ImmutablePageTable.h"
 
 #include "klee/BitfieldSimplifier.h"
 
@@ -35,14 +36,48 @@ namespace klee {
   };
   
   typedef ImmutableMap<const MemoryObject*, ObjectHolder, MemoryObjectLT> MemoryMap;
+
+  /// Index of the fixed-size objects that tile an address range.
+  struct ObjectPageTable {
+    uint64_t address;
+    uint64_t size;
+    unsigned objectBits;
+    ImmutablePageTable<ObjectPair> entries;
+
+    ObjectPageTable(uint64_t _address, uint64_t _size, unsigned _objectBits) :
+      address(_address), size(_size), objectBits(_objectBits),
+      entries(64 - __builtin_clzll(((_size - 1) >> _objectBits) | 1)) {}
+
+    bool contains(const MemoryObject *mo) const;
+  };
+
+  typedef std::vector<ObjectPageTable> ObjectPageTables;
   
   class AddressSpace {
   private:
     /// Epoch counter used to control ownership of objects.
     mutable unsigned cowKey;
 
+    /// Constant-time lookup tables for the objects of registered ranges.
+    /// Every object in them is also in objects.
+    ObjectPageTables pageTables;
+
     /// Unsupported, use copy constructor
     AddressSpace &operator=(const AddressSpace&); 
+
+    ObjectPageTable *findPageTable(uint64_t address) {
+      for (unsigned i = 0; i < pageTables.size(); ++i) {
+        if (address - pageTables[i].address < pageTables[i].size)
+          return &pageTables[i];
+      }
+      return NULL;
+    }
+
+    const ObjectPageTable *findPageTable(uint64_t address) const {
+      return const_cast<AddressSpace*>(this)->findPageTable(address);
+    }
+
+    void updatePageTable(const MemoryObject *mo, const ObjectState *os);
     
   public:
     /// The MemoryObject -> ObjectState map that constitutes the
@@ -70,7 +105,8 @@ namespace klee {
   public:
     AddressSpace(ExecutionState* _state) : cowKey(1), state(_state) {}
     AddressSpace(const AddressSpace &b) :
-            cowKey(++b.cowKey), objects(b.objects), state(NULL) { }
+            cowKey(++b.cowKey), pageTables(b.pageTables), objects(b.objects),
+            state(NULL) { }
     ~AddressSpace() {}
 
     /// Resolve address to an ObjectPair in result.
@@ -108,6 +144,12 @@ namespace klee {
 
     /***/
 
+    /// Index the objects of size 2^objectBits that tile the range
+    /// [address, address + size) for constant-time lookups. Objects of
+    /// other sizes in the range are looked up in the map as usual.
+    void registerPageTable(uint64_t address, uint64_t size,
+                           unsigned objectBits);
+
     /// Add a binding to the address space.
     void bindObject(const MemoryObject *mo, ObjectState *os);
 
@@ -120,6 +162,22 @@ namespace klee {
     /// Lookup a binding from a MemoryObject address.
     ObjectPair findObject(uint64_t address) const;
 
+    /// The page tables of the address space. Copies are cheap and can be
+    /// passed to findChangedPageTableObjects() later on.
+    const ObjectPageTables &getPageTables() const { return pageTables; }
+
+    /// Appends to result the objects of the registered page tables that
+    /// are bound to a different ObjectState in since. Objects that did not
+    /// change are skipped without being visited. The page tables must come
+    /// from the same initial state.
+    void findChangedPageTableObjects(const ObjectPageTables &since,
+                                     std::vector<const MemoryObject*> &result) const;
+
+    void findChangedPageTableObjects(const AddressSpace &b,
+                                     std::vector<const MemoryObject*> &result) const {
+      findChangedPageTableObjects(b.pageTables, result);
+    }
+
     /// \brief Obtain an ObjectState suitable for writing.
     ///
     /// This returns a writeable object state, creating a new copy of
@@ -132,6 +190,11 @@ namespace klee {
     /// \return A writeable ObjectState (\a os or a copy).
     ObjectState *getWriteable(const MemoryObject *mo, const ObjectState *os);
 
+    /// Binds mo to os, an object state of another address space with the
+    /// same contents as the current one. Both address spaces then share os
+    /// copy-on-write.
+    void shareObject(const MemoryObject *mo, const ObjectState *os);
+
     bool isOwnedByUs(const ObjectState *os) const;
 
     /// Copy the concrete values of all managed ObjectStates into the
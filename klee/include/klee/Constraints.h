@@ -11,8 +11,11 @@
 #define KLEE_CONSTRAINTS_H
 
 #include "klee/Expr.h"
+#include "klee/Internal/ADT/ImmutableMap.h"
 #include <llvm/Support/raw_ostream.h>
 
+#include <vector>
+
 // FIXME: Currently we use ConstraintManager for two things: to pass
 // sets of constraints around, and to optimize constraints. We should
 // move the first usage into a separate data structure
@@ -20,6 +23,72 @@
 namespace klee {
 
 class ExprVisitor;
+
+/// Partition of a set of constraints into independent groups, i.e., groups
+/// that read disjoint array elements. It is a union-find over the elements
+/// (array bytes at constant offsets, and whole arrays for symbolic offsets)
+/// that is updated as constraints are added, so that finding the
+/// constraints relevant to a query does not need to look at the others.
+/// The union-find is kept in immutable maps, so that copying a partition
+/// (e.g., when a state forks) is cheap and both copies share their nodes.
+class ConstraintPartition {
+public:
+  unsigned refCount;
+
+private:
+  /// Indices of the constraints of a group. The tails of the lists are
+  /// shared between groups and between copies of the partition.
+  struct MemberList {
+    unsigned refCount;
+    unsigned index;
+    ref<MemberList> next;
+
+    MemberList(unsigned _index, const ref<MemberList> &_next)
+      : refCount(0), index(_index), next(_next) {}
+    ~MemberList();
+  };
+
+  struct Node {
+    int parent;
+    unsigned rank;
+    /// Valid for the roots
+    unsigned memberCount;
+    ref<MemberList> members;
+  };
+
+  typedef std::pair<const Array*, unsigned> ArrayByte;
+
+  ImmutableMap<int, Node> nodes;
+  /// Nodes of the arrays that are read at a symbolic offset. All the byte
+  /// nodes of such an array are merged into it.
+  ImmutableMap<const Array*, int> wholeArrays;
+  ImmutableMap<ArrayByte, int> bytes;
+  int nodeCount;
+  unsigned constraintCount;
+
+  const Node &getNode(int node) const;
+  void setNode(int node, const Node &n);
+  int newNode();
+  int find(int node) const;
+  int unite(int a, int b);
+  void getNodes(const ref<Expr> &e, std::vector<int> &nodes);
+  void getRoots(const ref<Expr> &e, std::vector<int> &roots) const;
+
+public:
+  ConstraintPartition() : refCount(0), nodeCount(0), constraintCount(0) {}
+  ConstraintPartition(const ConstraintPartition &b)
+    : refCount(0), nodes(b.nodes), wholeArrays(b.wholeArrays),
+      bytes(b.bytes), nodeCount(b.nodeCount),
+      constraintCount(b.constraintCount) {}
+
+  /// Adds the next constraint of the set
+  void add(const ref<Expr> &e);
+
+  /// Returns the indices of the constraints that may share array elements
+  /// with e, directly or through other constraints, in increasing order.
+  void getIndependentConstraints(const ref<Expr> &e,
+                                 std::vector<unsigned> &result) const;
+};
   
 class ConstraintManager {
 public:
@@ -34,7 +103,8 @@ public:
   ConstraintManager(const std::vector< ref<Expr> > &_constraints) :
     constraints(_constraints) {}
 
-  ConstraintManager(const ConstraintManager &cs) : constraints(cs.constraints) {}
+  ConstraintManager(const ConstraintManager &cs)
+    : constraints(cs.constraints), partition(cs.partition) {}
 
   typedef std::vector< ref<Expr> >::const_iterator constraint_iterator;
 
@@ -45,6 +115,13 @@ public:
   ref<Expr> simplifyExpr(ref<Expr> e) const;
 
   void addConstraint(ref<Expr> e);
+
+  /// Appends to result the constraints that may share array elements with
+  /// e, in the order in which they were added. The partition is maintained
+  /// as constraints are added, and shares its unchanged parts with the
+  /// copies of this manager.
+  void getIndependentConstraints(ref<Expr> e,
+                                 std::vector< ref<Expr> > &result) const;
   
   bool empty() const {
     return constraints.empty();
@@ -76,10 +153,14 @@ public:
 private:
   std::vector< ref<Expr> > constraints;
 
+  /// Built on the first call to getIndependentConstraints()
+  mutable ref<ConstraintPartition> partition;
+
   // returns true iff the constraints were modified
   bool rewriteConstraints(ExprVisitor &visitor);
 
   void addConstraintInternal(ref<Expr> e);
+  void pushConstraint(ref<Expr> e);
 };
 
 }
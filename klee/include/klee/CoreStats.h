@@ -27,6 +27,10 @@ namespace stats {
   extern Statistic forkTime;
   extern Statistic solverTime;
 
+  /// The number of solver queries answered, fully or in part, from the
+  /// concrete inputs of concolic states.
+  extern Statistic concolicQueries;
+
   /// The number of process forks.
   extern Statistic forks;
 
@@ -169,10 +169,21 @@ public:
 
 protected:  
   unsigned hashValue;
+
+  /// Returns the canonical expression structurally equal to e, making e
+  /// the canonical one if there is none yet. The hash of e must already be
+  /// computed.
+  static ref<Expr> intern(const ref<Expr> &e);
+
+private:
+  /// Set while this expression is registered in the interning table
+  bool interned;
+
+  void unintern();
   
 public:
-  Expr() : refCount(0) { Expr::count++; }
-  virtual ~Expr() { Expr::count--; } 
+  Expr() : refCount(0), interned(false) { Expr::count++; }
+  virtual ~Expr() { if (interned) unintern(); Expr::count--; } 
 
   virtual Kind getKind() const = 0;
   virtual Width getWidth() const = 0;
@@ -382,7 +393,7 @@ public:
   static ref<ConstantExpr> alloc(const llvm::APInt &v) {
     ref<ConstantExpr> r(new ConstantExpr(v));
     r->computeHash();
-    return r;
+    return cast<ConstantExpr>(intern(r).get());
   }
 
   static ref<ConstantExpr> alloc(uint64_t v, Width w) {
@@ -523,7 +534,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &src) {
     ref<Expr> r(new NotOptimizedExpr(src));
     r->computeHash();
-    return r;
+    return intern(r);
   }
   
   static ref<Expr> create(ref<Expr> src);
@@ -669,7 +680,7 @@ public:
   static ref<Expr> alloc(const UpdateList &updates, const ref<Expr> &index) {
     ref<Expr> r(new ReadExpr(updates, index));
     r->computeHash();
-    return r;
+    return intern(r);
   }
   
   static ref<Expr> create(const UpdateList &updates, ref<Expr> i);
@@ -714,7 +725,7 @@ public:
                          const ref<Expr> &f) {
     ref<Expr> r(new SelectExpr(c, t, f));
     r->computeHash();
-    return r;
+    return intern(r);
   }
   
   static ref<Expr> create(ref<Expr> c, ref<Expr> t, ref<Expr> f);
@@ -771,7 +782,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {
     ref<Expr> c(new ConcatExpr(l, r));
     c->computeHash();
-    return c;
+    return intern(c);
   }
   
   static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);
@@ -830,7 +841,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &e, unsigned o, Width w) {
     ref<Expr> r(new ExtractExpr(e, o, w));
     r->computeHash();
-    return r;
+    return intern(r);
   }
   
   /// Creates an ExtractExpr with the given bit offset and width
@@ -881,7 +892,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &e) {
     ref<Expr> r(new NotExpr(e));
     r->computeHash();
-    return r;
+    return intern(r);
   }
   
   static ref<Expr> create(const ref<Expr> &e);
@@ -958,7 +969,7 @@ public:                                                          \
     static ref<Expr> alloc(const ref<Expr> &e, Width w) {        \
       ref<Expr> r(new _class_kind ## Expr(e, w));                \
       r->computeHash();                                          \
-      return r;                                                  \
+      return intern(r);                                          \
     }                                                            \
     static ref<Expr> create(const ref<Expr> &e, Width w);        \
     Kind getKind() const { return _class_kind; }                 \
@@ -990,7 +1001,7 @@ public:                                                              \
     static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) { \
       ref<Expr> res(new _class_kind ## Expr (l, r));                 \
       res->computeHash();                                            \
-      return res;                                                    \
+      return intern(res);                                            \
     }                                                                \
     static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r); \
     Width getWidth() const { return left->getWidth(); }              \
@@ -1034,7 +1045,7 @@ public:                                                              \
     static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) { \
       ref<Expr> res(new _class_kind ## Expr (l, r));                 \
       res->computeHash();                                            \
-      return res;                                                    \
+      return intern(res);                                            \
     }                                                                \
     static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r); \
     Kind getKind() const { return _class_kind; }                     \
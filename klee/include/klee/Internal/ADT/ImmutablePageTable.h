@@ -0,0 +1,194 @@
+//===-- ImmutablePageTable.h ------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __UTIL_IMMUTABLEPAGETABLE_H__
+#define __UTIL_IMMUTABLEPAGETABLE_H__
+
+#include <cassert>
+#include <stdint.h>
+
+namespace klee {
+  /// A persistent radix tree mapping dense integer indices to values.
+  ///
+  /// Copies share all their nodes. Updates copy the nodes on the path to
+  /// the modified entry unless the copy is their only user, so copying a
+  /// table is O(1) and updates cost at most one node per level.
+  template<class T, unsigned LEVEL_BITS = 6>
+  class ImmutablePageTable {
+  private:
+    enum { Fanout = 1 << LEVEL_BITS };
+
+    struct Node {
+      unsigned refCount;
+      Node() : refCount(0) {}
+    };
+
+    struct Inner : Node {
+      Node *children[Fanout];
+
+      Inner() {
+        for (unsigned i = 0; i < Fanout; ++i)
+          children[i] = 0;
+      }
+
+      Inner(const Inner &b) : Node() {
+        for (unsigned i = 0; i < Fanout; ++i) {
+          children[i] = b.children[i];
+          if (children[i])
+            ++children[i]->refCount;
+        }
+      }
+    };
+
+    struct Leaf : Node {
+      T values[Fanout];
+
+      Leaf() {
+        for (unsigned i = 0; i < Fanout; ++i)
+          values[i] = T();
+      }
+
+      Leaf(const Leaf &b) : Node() {
+        for (unsigned i = 0; i < Fanout; ++i)
+          values[i] = b.values[i];
+      }
+    };
+
+    Node *root;
+
+    /// Number of inner levels above the leaves
+    unsigned levels;
+
+    static void release(Node *n, unsigned level) {
+      if (!n || --n->refCount)
+        return;
+
+      if (level) {
+        Inner *inner = static_cast<Inner*>(n);
+        for (unsigned i = 0; i < Fanout; ++i)
+          release(inner->children[i], level - 1);
+        delete inner;
+      } else {
+        delete static_cast<Leaf*>(n);
+      }
+    }
+
+    /// Returns the node in slot, allocating or copying it so that the
+    /// caller may modify it in place.
+    static Node *getExclusive(Node **slot, unsigned level) {
+      Node *n = *slot;
+      if (n && n->refCount == 1)
+        return n;
+
+      Node *copy;
+      if (level) {
+        copy = n ? new Inner(*static_cast<Inner*>(n)) : new Inner();
+      } else {
+        copy = n ? new Leaf(*static_cast<Leaf*>(n)) : new Leaf();
+      }
+
+      copy->refCount = 1;
+      release(n, level);
+      *slot = copy;
+      return copy;
+    }
+
+    static unsigned index(uint64_t key, unsigned level) {
+      return (key >> (level * LEVEL_BITS)) & (Fanout - 1);
+    }
+
+    template<class F>
+    static void compare(const Node *a, const Node *b, unsigned level,
+                        uint64_t prefix, F &f) {
+      // Shared nodes hold the same entries
+      if (a == b)
+        return;
+
+      for (unsigned i = 0; i < Fanout; ++i) {
+        uint64_t key = (prefix << LEVEL_BITS) | i;
+        if (level) {
+          compare(a ? static_cast<const Inner*>(a)->children[i] : 0,
+                  b ? static_cast<const Inner*>(b)->children[i] : 0,
+                  level - 1, key, f);
+        } else {
+          T va = a ? static_cast<const Leaf*>(a)->values[i] : T();
+          T vb = b ? static_cast<const Leaf*>(b)->values[i] : T();
+          if (!(va == vb))
+            f(key, va, vb);
+        }
+      }
+    }
+
+    bool isValidKey(uint64_t key) const {
+      unsigned bits = (levels + 1) * LEVEL_BITS;
+      return bits >= 64 || !(key >> bits);
+    }
+
+  public:
+    ImmutablePageTable() : root(0), levels(0) {}
+
+    /// Creates an empty table for keys smaller than 2^keyBits
+    explicit ImmutablePageTable(unsigned keyBits) : root(0),
+      levels(keyBits > LEVEL_BITS ? (keyBits - 1) / LEVEL_BITS : 0) {}
+
+    ImmutablePageTable(const ImmutablePageTable &b) :
+      root(b.root), levels(b.levels) {
+      if (root)
+        ++root->refCount;
+    }
+
+    ~ImmutablePageTable() {
+      release(root, levels);
+    }
+
+    ImmutablePageTable &operator=(const ImmutablePageTable &b) {
+      if (b.root)
+        ++b.root->refCount;
+      release(root, levels);
+      root = b.root;
+      levels = b.levels;
+      return *this;
+    }
+
+    /// Returns the value of key, or T() if it was never set
+    T lookup(uint64_t key) const {
+      assert(isValidKey(key));
+
+      const Node *n = root;
+      for (unsigned level = levels; n && level; --level)
+        n = static_cast<const Inner*>(n)->children[index(key, level)];
+
+      return n ? static_cast<const Leaf*>(n)->values[index(key, 0)] : T();
+    }
+
+    void set(uint64_t key, const T &value) {
+      assert(isValidKey(key));
+
+      Node **slot = &root;
+      for (unsigned level = levels; level; --level) {
+        Inner *inner = static_cast<Inner*>(getExclusive(slot, level));
+        slot = &inner->children[index(key, level)];
+      }
+
+      Leaf *leaf = static_cast<Leaf*>(getExclusive(slot, 0));
+      leaf->values[index(key, 0)] = value;
+    }
+
+    /// Calls f(key, value, otherValue) for each key whose value differs in
+    /// b. Only the nodes that are not shared with b are visited. Both
+    /// tables must have the same key range.
+    template<class F>
+    void compare(const ImmutablePageTable &b, F &f) const {
+      assert(levels == b.levels && "tables with different key ranges");
+      compare(root, b.root, levels, 0, f);
+    }
+  };
+}
+
+#endif
@@ -11,10 +11,14 @@
 #define KLEE_OPT_LOGGINGSOLVER_H
 
 #include "klee/Expr.h"
+#include "klee/util/ExprHashMap.h"
 
+#include <cstdio>
+#include <map>
 #include <vector>
 
 namespace klee {
+  class ExprBuilder;
   struct Query;
 
   class QueryLogEntry {
@@ -57,6 +61,72 @@ namespace klee {
       }
     }
   };
+
+  /// Writes queries to a binary query log (.qlog).
+  ///
+  /// Expressions, update nodes and arrays are written once and then
+  /// referred to by index, so the subexpressions that successive queries
+  /// share only take space the first time they appear. The tables are
+  /// reset when they grow too large, so that the writer does not keep all
+  /// the logged expressions alive.
+  class QueryLogWriter {
+    FILE *f;
+    std::vector<unsigned char> buffer;
+
+    ExprHashMap<unsigned> exprIds;
+    std::map<const UpdateNode*, unsigned> updateIds;
+    std::map<const Array*, unsigned> arrayIds;
+    /// Keeps the update nodes in the table alive
+    std::vector<UpdateList> updateLists;
+    unsigned nextExprId, nextUpdateId, nextArrayId;
+
+    void writeNumber(uint64_t value);
+    void writeBytes(const void *data, unsigned size);
+    unsigned writeArray(const Array *array);
+    unsigned writeUpdates(const UpdateList &updates);
+    unsigned writeExpr(const ref<Expr> &e);
+    void reset();
+
+  public:
+    explicit QueryLogWriter(const std::string &path);
+    ~QueryLogWriter();
+
+    bool isOpen() const { return f != 0; }
+
+    void write(const QueryLogEntry &entry, const QueryLogResult &result);
+  };
+
+  /// Reads the queries of a binary query log.
+  ///
+  /// The arrays of the queries belong to the reader, which must outlive the
+  /// expressions it returns.
+  class QueryLogReader {
+    const unsigned char *pos, *end;
+    ExprBuilder *builder;
+    bool error;
+
+    std::vector< ref<Expr> > exprs;
+    std::vector<UpdateList> updateLists;
+    std::vector<const Array*> arrays;
+    std::vector<const Array*> ownedArrays;
+
+    bool readNumber(uint64_t &value);
+    bool readBytes(void *data, unsigned size);
+    bool readExprId(ref<Expr> &e);
+    bool readArray();
+    bool readUpdate();
+    bool readExpr();
+
+  public:
+    QueryLogReader(const char *begin, const char *end, ExprBuilder *builder);
+    ~QueryLogReader();
+
+    /// Reads the next query. Returns false at the end of the log or if the
+    /// log is malformed, see hasError().
+    bool nextQuery(QueryLogEntry &entry, QueryLogResult &result);
+
+    bool hasError() const { return error; }
+  };
   
 }
 
@@ -0,0 +1,58 @@
+//===-- SwapFile.h ----------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_SWAPFILE_H
+#define KLEE_SWAPFILE_H
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace klee {
+
+  /// Unlinked file that receives buffers which are not needed in memory
+  /// for a while (e.g., the memory of idle states). Slots of released
+  /// buffers are reused. Processes forked after a buffer was written can
+  /// read it as well; each process closes a file once none of its buffers
+  /// are left in it.
+  class SwapFile {
+  public:
+    /// Location of a swapped out buffer
+    struct Slot {
+      int fd;
+      off_t offset;
+      unsigned size;
+
+      Slot() : fd(-1), offset(0), size(0) {}
+
+      bool isUsed() const { return fd >= 0; }
+    };
+
+    /// Sets the prefix of the swap file names (e.g., an output directory
+    /// followed by a file name prefix)
+    static void setPathPrefix(const std::string &prefix);
+
+    /// Writes size bytes of buf to a free slot. Returns false if the swap
+    /// file cannot be created or written.
+    static bool write(const uint8_t *buf, unsigned size, Slot &slot);
+
+    /// Reads size bytes back from the slot, which stays in use
+    static bool read(const Slot &slot, uint8_t *buf, unsigned size);
+
+    /// Frees the slot for later writes
+    static void release(Slot &slot);
+
+    /// Stops writing to the current file, e.g., after a fork. The slots
+    /// that are in use remain readable.
+    static void reset();
+  };
+
+}
+
+#endif
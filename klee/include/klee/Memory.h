@@ -15,6 +15,7 @@
 
 #include "llvm/ADT/StringExtras.h"
 #include "klee/util/BitArray.h"
+#include "klee/Internal/Support/SwapFile.h"
 
 #include <vector>
 #include <string>
@@ -167,7 +168,11 @@ private:
   const MemoryObject *object;
 
   //XXX: made it public for fast access
-  uint8_t *concreteStore;
+  // mutable because it is read back on access when it is swapped out
+  mutable uint8_t *concreteStore;
+
+  // location of concreteStore while it is swapped out, null otherwise
+  mutable SwapFile::Slot *swapSlot;
 
   // XXX cleanup name of flushMask (its backwards or something)
   // mutable because may need flushed during read of const
@@ -178,6 +183,9 @@ private:
   // mutable because we may need flush during read of const
   mutable UpdateList updates;
 
+  // length of the update list after its last compaction
+  mutable unsigned compactedUpdatesSize;
+
 public:
   unsigned size;
 
@@ -214,6 +222,7 @@ public:
     if(object->isSharedConcrete) {
       *v = ((uint8_t*) object->address)[offset]; return true;
     } else if(isByteConcrete(offset)) {
+      loadConcreteStore();
       *v = concreteStore[offset]; return true;
     } else {
       return false;
@@ -232,23 +241,31 @@ public:
   bool isAllConcrete() const;
 
   inline bool isConcrete(unsigned offset, Expr::Width width) const {
-    if (!concreteMask)
-        return true;
-
-    unsigned size = Expr::getMinBytesForWidth(width);
-    for(unsigned i = 0; i < size; ++i) {
-      if(!isByteConcrete(offset + i))
-        return false;
-    }
-    return true;
+    return !concreteMask || concreteMask->isRangeAllOnes(offset,
+                                  Expr::getMinBytesForWidth(width));
   }
 
   const uint8_t *getConcreteStore(bool allowSymbolic = false) const;
   uint8_t *getConcreteStore(bool allowSymolic = false);
 
+  /// Moves the concrete store to the swap file until the next access to
+  /// the object. Returns the number of bytes released, or 0 if the store
+  /// could not be swapped out. The caller must make sure that no pointer
+  /// to the store is kept (e.g., in a TLB).
+  unsigned swapOut();
+
+  bool isSwappedOut() const { return swapSlot != 0; }
+
 private:
   const UpdateList &getUpdates() const;
 
+  void swapIn() const;
+
+  inline void loadConcreteStore() const {
+    if (swapSlot)
+      swapIn();
+  }
+
   void makeConcrete();
 
   void makeSymbolic();
@@ -262,6 +279,8 @@ private:
   void flushRangeForRead(unsigned rangeBase, unsigned rangeSize) const;
   void flushRangeForWrite(unsigned rangeBase, unsigned rangeSize);
 
+  void compactUpdates() const;
+
   inline bool isByteConcrete(unsigned offset) const {
     return !concreteMask || concreteMask->get(offset);
   }
@@ -24,6 +24,9 @@ namespace klee {
     
     ObjectHolder &operator=(const ObjectHolder &b);
 
+    /// True if this holder is the only reference to the object
+    bool isUnique() const;
+
     operator class ObjectState *() { return os; }
     operator class ObjectState *() const { return (ObjectState*) os; }
   };
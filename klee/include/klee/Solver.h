@@ -213,9 +213,19 @@ namespace klee {
   /// after writing them to the given path in .pc format.
   Solver *createPCLoggingSolver(Solver *s, std::string path);
 
+  /// createQueryLoggingSolver - Create a solver which will forward all queries
+  /// after writing them, with their results and solving times, to the given
+  /// path as a binary query log (see QueryLogWriter).
+  Solver *createQueryLoggingSolver(Solver *s, std::string path);
+
   /// createDummySolver - Create a dummy solver implementation which always
   /// fails.
   Solver *createDummySolver();
+
+  /// saveSolverCache - Write the results of the caching solvers to the given
+  /// path if --save-solver-cache is set, so that a later run can reuse them
+  /// with --load-solver-cache.
+  bool saveSolverCache(const std::string &path);
 }
 
 #endif
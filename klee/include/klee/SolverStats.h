@@ -25,6 +25,8 @@ namespace stats {
   extern Statistic queryConstructs;
   extern Statistic queryCounterexamples;
   extern Statistic queryTime;
+  extern Statistic sharedQueryCacheHits;
+  extern Statistic sharedQueryCacheMisses;
 
 }
 }
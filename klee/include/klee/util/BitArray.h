@@ -10,6 +10,10 @@
 #ifndef KLEE_UTIL_BITARRAY_H
 #define KLEE_UTIL_BITARRAY_H
 
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+
 namespace klee {
 
   // XXX would be nice not to have
@@ -24,6 +28,10 @@ private:
 protected:
   static uint32_t length(unsigned size) { return (size+31)/32; }
 
+  static uint32_t lowMask(unsigned count) {
+    return (uint32_t) (((uint64_t) 1 << count) - 1);
+  }
+
 public:
   BitArray(unsigned size, bool value = false) : bits(new uint32_t[length(size)]) {
     memset(bits, value?0xFF:0, sizeof(*bits)*length(size));
@@ -33,25 +41,106 @@ public:
   }
   ~BitArray() { delete[] bits; }
 
-  inline bool get(unsigned idx) { return (bool) ((bits[idx/32]>>(idx&0x1F))&1); }
+  inline bool get(unsigned idx) const { return (bool) ((bits[idx/32]>>(idx&0x1F))&1); }
   inline void set(unsigned idx) { bits[idx/32] |= 1<<(idx&0x1F); }
   inline void unset(unsigned idx) { bits[idx/32] &= ~(1<<(idx&0x1F)); }
   inline void set(unsigned idx, bool value) { if (value) set(idx); else unset(idx); }
 
-  bool isAllZeros(unsigned size) {
-    for(unsigned i = 0; i < size/32; ++i)
-      if(bits[i] != 0)
+  /// Returns the count <= 32 bits starting at idx in the low bits.
+  inline uint32_t getBits(unsigned idx, unsigned count) const {
+    if (!count)
+      return 0;
+    unsigned word = idx/32, shift = idx&0x1F;
+    uint64_t w = bits[word];
+    if (shift + count > 32)
+      w |= (uint64_t) bits[word+1] << 32;
+    return (uint32_t) (w >> shift) & lowMask(count);
+  }
+
+  /// Checks count bits starting at idx, one masked compare per 32 bits.
+  bool isRangeAllOnes(unsigned idx, unsigned count) const {
+    for (; count > 32; idx += 32, count -= 32)
+      if (getBits(idx, 32) != 0xffffffff)
         return false;
-    uint32_t mask = (1 << (size&0x1F)) - 1;
-    return (bits[size/32] & mask) == 0;
+    return getBits(idx, count) == lowMask(count);
   }
 
-  bool isAllOnes(unsigned size) {
-    for(unsigned i = 0; i < size/32; ++i)
-      if(bits[i] != 0xffffffff)
+  bool isRangeAllZeros(unsigned idx, unsigned count) const {
+    for (; count > 32; idx += 32, count -= 32)
+      if (getBits(idx, 32) != 0)
+        return false;
+    return getBits(idx, count) == 0;
+  }
+
+  void setRange(unsigned idx, unsigned count) {
+    for (; count; ) {
+      unsigned shift = idx&0x1F, n = std::min(count, 32 - shift);
+      bits[idx/32] |= lowMask(n) << shift;
+      idx += n; count -= n;
+    }
+  }
+
+  void unsetRange(unsigned idx, unsigned count) {
+    for (; count; ) {
+      unsigned shift = idx&0x1F, n = std::min(count, 32 - shift);
+      bits[idx/32] &= ~(lowMask(n) << shift);
+      idx += n; count -= n;
+    }
+  }
+
+  /// Returns the index of the first set bit in [begin, end), or end.
+  unsigned findFirstSet(unsigned begin, unsigned end) const {
+    for (unsigned i = begin; i < end; i = (i/32 + 1) * 32) {
+      uint32_t w = bits[i/32] & (0xffffffff << (i&0x1F));
+      if (w) {
+        unsigned r = (i & ~0x1F) + __builtin_ctz(w);
+        return r < end ? r : end;
+      }
+    }
+    return end;
+  }
+
+  /// Number of set bits among the first size bits
+  unsigned count(unsigned size) const {
+    unsigned r = 0;
+    for (unsigned i = 0; i < size/32; ++i)
+      r += __builtin_popcount(bits[i]);
+    if (size&0x1F)
+      r += __builtin_popcount(bits[size/32] & lowMask(size&0x1F));
+    return r;
+  }
+
+  // The words are combined in blocks without early exits so that the
+  // compiler can vectorize the inner loops.
+  bool isAllZeros(unsigned size) const {
+    unsigned words = size/32, i = 0;
+    for (; i + 8 <= words; i += 8) {
+      uint32_t acc = 0;
+      for (unsigned j = 0; j < 8; ++j)
+        acc |= bits[i+j];
+      if (acc)
+        return false;
+    }
+    for (; i < words; ++i)
+      if (bits[i] != 0)
+        return false;
+    return !(size&0x1F) || (bits[words] & lowMask(size&0x1F)) == 0;
+  }
+
+  bool isAllOnes(unsigned size) const {
+    unsigned words = size/32, i = 0;
+    for (; i + 8 <= words; i += 8) {
+      uint32_t acc = 0xffffffff;
+      for (unsigned j = 0; j < 8; ++j)
+        acc &= bits[i+j];
+      if (acc != 0xffffffff)
+        return false;
+    }
+    for (; i < words; ++i)
+      if (bits[i] != 0xffffffff)
         return false;
-    uint32_t mask = (1 << (size&0x1F)) - 1;
-    return (bits[size/32] & mask) == mask;
+    uint32_t mask = lowMask(size&0x1F);
+    return !(size&0x1F) || (bits[words] & mask) == mask;
   }
 };
 
@@ -11,11 +11,13 @@
 #define KLEE_EXPRUTIL_H
 
 #include <vector>
+#include <stdint.h>
 
 namespace klee {
   class Array;
   class Expr;
   class ReadExpr;
+  class UpdateList;
   template<typename T> class ref;
 
   /// Find all ReadExprs used in the expression DAG. If visitUpdates
@@ -38,6 +40,28 @@ namespace klee {
                            InputIterator end,
                            std::vector<const Array*> &results);
 
+  /// Return the given update list without the updates that are overwritten
+  /// by a later update to the same index. If the oldest updates write
+  /// constants to constant indices of a constant array, they are folded
+  /// into a new constant array if that array takes less memory than their
+  /// update nodes. Otherwise, the compacted list shares the
+  /// nodes below the oldest removed update. Returns the list itself if
+  /// there is nothing to remove.
+  UpdateList compactUpdateList(const UpdateList &updates);
+
+  /// Compute a 128-bit structural hash of the given expression range that
+  /// does not depend on the names of the symbolic arrays. The expressions
+  /// are ordered by their structure, ignoring the arrays, and the arrays
+  /// are numbered in the order in which they are first reached. They are
+  /// appended to arrays in that order. Two ranges with the same hash are
+  /// the same formula up to a renaming of their arrays, barring hash
+  /// collisions.
+  template<typename InputIterator>
+  void hashExprsUpToRenaming(InputIterator begin,
+                             InputIterator end,
+                             uint64_t &hash1, uint64_t &hash2,
+                             std::vector<const Array*> &arrays);
+
 }
 
 #endif
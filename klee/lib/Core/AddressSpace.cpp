@@ -20,6 +20,32 @@ using namespace klee;
 
 ///
 
+bool ObjectPageTable::contains(const MemoryObject *mo) const {
+  uint64_t offset = mo->address - address;
+  return offset < size && mo->size == (1ULL << objectBits) &&
+         !(offset & (mo->size - 1));
+}
+
+void AddressSpace::registerPageTable(uint64_t address, uint64_t size,
+                                     unsigned objectBits) {
+  assert(!findPageTable(address) && "Overlapping page tables");
+  pageTables.push_back(ObjectPageTable(address, size, objectBits));
+
+  for (MemoryMap::iterator it = objects.begin(), ie = objects.end();
+       it != ie; ++it) {
+    updatePageTable(it->first, it->second);
+  }
+}
+
+void AddressSpace::updatePageTable(const MemoryObject *mo,
+                                   const ObjectState *os) {
+  ObjectPageTable *pt = findPageTable(mo->address);
+  if (pt && pt->contains(mo)) {
+    pt->entries.set((mo->address - pt->address) >> pt->objectBits,
+                    os ? ObjectPair(mo, os) : ObjectPair(NULL, NULL));
+  }
+}
+
 void AddressSpace::bindObject(const MemoryObject *mo, ObjectState *os) {
   assert(state);
   const ObjectState *oldOS = findObject(mo);
@@ -29,6 +55,7 @@ void AddressSpace::bindObject(const MemoryObject *mo, ObjectState *os) {
   assert(os->copyOnWriteOwner==0 && "object already has owner");
   os->copyOnWriteOwner = cowKey;
   objects = objects.replace(std::make_pair(mo, os));
+  updatePageTable(mo, os);
 }
 
 void AddressSpace::unbindObject(const MemoryObject *mo) {
@@ -37,15 +64,54 @@ void AddressSpace::unbindObject(const MemoryObject *mo) {
   if(os) state->addressSpaceChange(mo, os, NULL);
 
   objects = objects.remove(mo);
+  updatePageTable(mo, NULL);
+}
+
+namespace {
+  struct ChangedObjects {
+    std::vector<const MemoryObject*> &result;
+
+    ChangedObjects(std::vector<const MemoryObject*> &_result) :
+      result(_result) {}
+
+    void operator()(uint64_t key, const ObjectPair &a, const ObjectPair &b) {
+      // The other entry may be stale, only report our own objects
+      if (a.first)
+        result.push_back(a.first);
+    }
+  };
+}
+
+void AddressSpace::findChangedPageTableObjects(const ObjectPageTables &since,
+                                               std::vector<const MemoryObject*> &result) const {
+  assert(pageTables.size() == since.size());
+  ChangedObjects changed(result);
+  for (unsigned i = 0; i < pageTables.size(); ++i) {
+    assert(pageTables[i].address == since[i].address);
+    pageTables[i].entries.compare(since[i].entries, changed);
+  }
 }
 
 const ObjectState *AddressSpace::findObject(const MemoryObject *mo) const {
+  const ObjectPageTable *pt = findPageTable(mo->address);
+  if (pt && pt->contains(mo)) {
+    return pt->entries.lookup((mo->address - pt->address) >> pt->objectBits)
+                      .second;
+  }
+
   const MemoryMap::value_type *res = objects.lookup(mo);
   
   return res ? res->second : 0;
 }
 
 ObjectPair AddressSpace::findObject(uint64_t address) const {
+  const ObjectPageTable *pt = findPageTable(address);
+  if (pt) {
+    ObjectPair op = pt->entries.lookup((address - pt->address) >> pt->objectBits);
+    if (op.first && op.first->address == address)
+      return op;
+  }
+
   MemoryObject hack(address);
   const MemoryMap::value_type *res = objects.lookup(&hack);
   return res ? ObjectPair(*res) : ObjectPair(NULL, NULL);
@@ -65,10 +131,28 @@ ObjectState *AddressSpace::getWriteable(const MemoryObject *mo,
     state->addressSpaceChange(mo, os, n);
 
     objects = objects.replace(std::make_pair(mo, n));
+    updatePageTable(mo, n);
     return n;    
   }
 }
 
+void AddressSpace::shareObject(const MemoryObject *mo, const ObjectState *os) {
+  const ObjectState *oldOS = findObject(mo);
+  assert(oldOS && os->getObject() == mo);
+  if (oldOS == os)
+    return;
+
+  // The owner must not modify os in place anymore
+  ObjectState *n = const_cast<ObjectState*>(os);
+  n->copyOnWriteOwner = 0;
+
+  assert(state);
+  state->addressSpaceChange(mo, oldOS, n);
+
+  objects = objects.replace(std::make_pair(mo, n));
+  updatePageTable(mo, n);
+}
+
 bool AddressSpace::isOwnedByUs(const ObjectState *os) const
 {
     return cowKey==os->copyOnWriteOwner;
@@ -79,6 +163,15 @@ bool AddressSpace::isOwnedByUs(const ObjectState *os) const
 bool AddressSpace::resolveOne(const ref<ConstantExpr> &addr, 
                               ObjectPair &result) {
   uint64_t address = addr->getZExtValue();
+
+  if (const ObjectPageTable *pt = findPageTable(address)) {
+    ObjectPair op = pt->entries.lookup((address - pt->address) >> pt->objectBits);
+    if (op.first) {
+      result = op;
+      return true;
+    }
+  }
+
   MemoryObject hack(address);
 
   if (const MemoryMap::value_type *res = objects.lookup_previous(&hack)) {
@@ -389,7 +482,7 @@ void AddressSpace::copyOutConcretes() {
     uint8_t *address = (uint8_t*) (uintptr_t) mo->address;
 
     if (!os->readOnly)
-      memcpy(address, os->concreteStore, mo->size);
+      memcpy(address, os->getConcreteStore(true), mo->size);
   }
 }
 
@@ -404,11 +497,11 @@ bool AddressSpace::copyInConcretes() {
     uint8_t *address = (uint8_t*) (uintptr_t) mo->address;
 
     if (os->readOnly) {
-      if (memcmp(address, os->concreteStore, mo->size)!=0)
+      if (memcmp(address, os->getConcreteStore(true), mo->size)!=0)
         return false;
     } else {
       ObjectState *wos = getWriteable(mo, os);
-      memcpy(wos->concreteStore, address, mo->size);
+      memcpy(wos->getConcreteStore(true), address, mo->size);
     }
   }
 
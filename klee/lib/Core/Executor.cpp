@@ -160,8 +160,15 @@ namespace {
 
   cl::opt<bool>
   UseQueryLog("use-query-log",
+              cl::desc("Log all queries to queries.qlog in the binary format "
+                       "read by kleaver --replay-log"),
               cl::init(false));
 
+  cl::opt<bool>
+  UseSTPQueryLog("use-stp-query-log",
+                 cl::desc("Log the queries that reach STP to stp-queries.qlog"),
+                 cl::init(false));
+
   cl::opt<bool>
   UseQueryPCLog("use-query-pc-log",
                 cl::init(false));
@@ -298,9 +305,13 @@ Solver *constructSolverChain(STPSolver *stpSolver,
                              std::string stpQueryPCLogPath) {
   Solver *solver = stpSolver;
 
+  if (UseSTPQueryLog)
+    solver = createQueryLoggingSolver(solver,
+                                      stpQueryLogPath);
+
   if (UseSTPQueryPCLog)
     solver = createPCLoggingSolver(solver, 
-                                   stpQueryLogPath);
+                                   stpQueryPCLogPath);
 
   if (UseFastCexSolver)
     solver = createFastCexSolver(solver);
@@ -320,6 +331,10 @@ Solver *constructSolverChain(STPSolver *stpSolver,
   if (UseQueryPCLog)
     solver = createPCLoggingSolver(solver, 
                                    queryPCLogPath);
+
+  if (UseQueryLog)
+    solver = createQueryLoggingSolver(solver,
+                                      queryLogPath);
   
   return solver;
 }
@@ -418,6 +433,8 @@ Executor::~Executor() {
     delete specialFunctionHandler;
   if (statsTracker)
     delete statsTracker;
+  if (!saveSolverCache(interpreterHandler->getOutputFilename("solver-cache.dat")))
+    klee_warning("could not save the solver cache");
   delete solver;
   delete kmodule;
 }
@@ -15,6 +15,7 @@
 #include "klee/Expr.h"
 #include "klee/Solver.h"
 #include "klee/util/BitArray.h"
+#include "klee/util/ExprUtil.h"
 
 #include "klee/ObjectHolder.h"
 
@@ -26,6 +27,7 @@
 
 #include <iostream>
 #include <cassert>
+#include <set>
 #include <sstream>
 
 using namespace llvm;
@@ -35,6 +37,12 @@ namespace {
   cl::opt<bool>
   UseConstantArrays("use-constant-arrays",
                     cl::init(true));
+
+  cl::opt<unsigned>
+  UpdateListCompactionThreshold("update-list-compaction-threshold",
+                    cl::desc("Remove overwritten updates from update lists "
+                             "longer than this (0=off)"),
+                    cl::init(256));
 }
 
 /***/
@@ -58,6 +66,10 @@ ObjectHolder &ObjectHolder::operator=(const ObjectHolder &b) {
   return *this;
 }
 
+bool ObjectHolder::isUnique() const {
+  return os && os->refCount == 1;
+}
+
 /***/
 
 int MemoryObject::counter = 0;
@@ -95,9 +107,11 @@ ObjectState::ObjectState(const MemoryObject *mo)
     refCount(0),
     object(mo),
     concreteStore(new uint8_t[mo->size]),
+    swapSlot(0),
     flushMask(0),
     knownSymbolics(0),
     updates(0, 0),
+    compactedUpdatesSize(0),
     size(mo->size),
     readOnly(false)
      {
@@ -116,9 +130,11 @@ ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
     refCount(0),
     object(mo),
     concreteStore(new uint8_t[mo->size]),
+    swapSlot(0),
     flushMask(0),
     knownSymbolics(0),
     updates(array, 0),
+    compactedUpdatesSize(0),
     size(mo->size),
     readOnly(false)
  {
@@ -131,9 +147,11 @@ ObjectState::ObjectState(const ObjectState &os)
     refCount(0),
     object(os.object),
     concreteStore(new uint8_t[os.size]),
+    swapSlot(0),
     flushMask(os.flushMask ? new BitArray(*os.flushMask, os.size) : 0),
     knownSymbolics(0),
     updates(os.updates),
+    compactedUpdatesSize(os.compactedUpdatesSize),
     size(os.size),
     readOnly(false)
      {
@@ -145,16 +163,53 @@ ObjectState::ObjectState(const ObjectState &os)
       knownSymbolics[i] = os.knownSymbolics[i];
   }
 
-  memcpy(concreteStore, os.concreteStore, size*sizeof(*concreteStore));
+  // Read a swapped out store directly into the copy
+  if (os.swapSlot) {
+    if (!SwapFile::read(*os.swapSlot, concreteStore, size))
+      klee_error("cannot read object state from the swap file");
+  } else {
+    memcpy(concreteStore, os.concreteStore, size*sizeof(*concreteStore));
+  }
 }
 
 ObjectState::~ObjectState() {
   if (concreteMask) delete concreteMask;
   if (flushMask) delete flushMask;
   if (knownSymbolics) delete[] knownSymbolics;
+  if (swapSlot) {
+    SwapFile::release(*swapSlot);
+    delete swapSlot;
+  }
   delete[] concreteStore;
 }
 
+unsigned ObjectState::swapOut() {
+  if (swapSlot || object->isSharedConcrete || !size)
+    return 0;
+
+  SwapFile::Slot *slot = new SwapFile::Slot();
+  if (!SwapFile::write(concreteStore, size, *slot)) {
+    delete slot;
+    return 0;
+  }
+
+  delete[] concreteStore;
+  concreteStore = 0;
+  swapSlot = slot;
+  return size;
+}
+
+void ObjectState::swapIn() const {
+  assert(swapSlot && !concreteStore);
+  concreteStore = new uint8_t[size];
+  if (!SwapFile::read(*swapSlot, concreteStore, size))
+    klee_error("cannot read object state from the swap file");
+
+  SwapFile::release(*swapSlot);
+  delete swapSlot;
+  swapSlot = 0;
+}
+
 /***/
 
 const UpdateList &ObjectState::getUpdates() const {
@@ -213,6 +268,20 @@ const UpdateList &ObjectState::getUpdates() const {
   return updates;
 }
 
+/// Removes the updates that are overwritten by a later update to the same
+/// index, see compactUpdateList.
+void ObjectState::compactUpdates() const {
+  // Wait for the list to double to keep the cost amortized
+  unsigned NumWrites = updates.getSize();
+  if (!UpdateListCompactionThreshold ||
+      NumWrites <= UpdateListCompactionThreshold ||
+      NumWrites < 2 * compactedUpdatesSize)
+    return;
+
+  updates = compactUpdateList(updates);
+  compactedUpdatesSize = updates.getSize();
+}
+
 void ObjectState::makeConcrete() {
   if (concreteMask) delete concreteMask;
   if (flushMask) delete flushMask;
@@ -236,11 +305,13 @@ void ObjectState::makeSymbolic() {
 
 void ObjectState::initializeToZero() {
   makeConcrete();
+  loadConcreteStore();
   memset(concreteStore, 0, size);
 }
 
 void ObjectState::initializeToRandom() {  
   makeConcrete();
+  loadConcreteStore();
   for (unsigned i=0; i<size; i++) {
     // randomly selected by 256 sided die
     concreteStore[i] = 0xAB;
@@ -265,51 +336,61 @@ void ObjectState::fastRangeCheckOffset(ref<Expr> offset,
 void ObjectState::flushRangeForRead(unsigned rangeBase, 
                                     unsigned rangeSize) const {
   if (!flushMask) flushMask = new BitArray(size, true);
- 
-  for (unsigned offset=rangeBase; offset<rangeBase+rangeSize; offset++) {
-    if (!isByteFlushed(offset)) {
-      if (isByteConcrete(offset)) {
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       ConstantExpr::create(concreteStore[offset], Expr::Int8));
-      } else {
-        assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
-      }
+  loadConcreteStore();
 
-      flushMask->unset(offset);
+  // Only visit the bytes that are not flushed yet
+  unsigned rangeEnd = rangeBase + rangeSize;
+  for (unsigned offset = flushMask->findFirstSet(rangeBase, rangeEnd);
+       offset < rangeEnd;
+       offset = flushMask->findFirstSet(offset + 1, rangeEnd)) {
+    if (isByteConcrete(offset)) {
+      updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                     ConstantExpr::create(concreteStore[offset], Expr::Int8));
+    } else {
+      assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
+      updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                     knownSymbolics[offset]);
     }
-  } 
+  }
+
+  flushMask->unsetRange(rangeBase, rangeSize);
+  compactUpdates();
 }
 
 void ObjectState::flushRangeForWrite(unsigned rangeBase, 
                                      unsigned rangeSize) {
   if (!flushMask) flushMask = new BitArray(size, true);
+  loadConcreteStore();
 
-  for (unsigned offset=rangeBase; offset<rangeBase+rangeSize; offset++) {
-    if (!isByteFlushed(offset)) {
-      if (isByteConcrete(offset)) {
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       ConstantExpr::create(concreteStore[offset], Expr::Int8));
-        markByteSymbolic(offset);
-      } else {
-        assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
-        setKnownSymbolic(offset, 0);
-      }
-
-      flushMask->unset(offset);
+  unsigned rangeEnd = rangeBase + rangeSize;
+  for (unsigned offset = flushMask->findFirstSet(rangeBase, rangeEnd);
+       offset < rangeEnd;
+       offset = flushMask->findFirstSet(offset + 1, rangeEnd)) {
+    if (isByteConcrete(offset)) {
+      updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                     ConstantExpr::create(concreteStore[offset], Expr::Int8));
     } else {
-      // flushed bytes that are written over still need
-      // to be marked out
-      if (isByteConcrete(offset)) {
-        markByteSymbolic(offset);
-      } else if (isByteKnownSymbolic(offset)) {
-        setKnownSymbolic(offset, 0);
-      }
+      assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
+      updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                     knownSymbolics[offset]);
     }
-  } 
+  }
+
+  if (!rangeSize)
+    return;
+
+  // All the bytes of the range, flushed or not, are now only
+  // available through the update list
+  flushMask->unsetRange(rangeBase, rangeSize);
+
+  if (!concreteMask)
+    concreteMask = new BitArray(size, true);
+  concreteMask->unsetRange(rangeBase, rangeSize);
+
+  if (knownSymbolics) {
+    for (unsigned offset = rangeBase; offset < rangeEnd; ++offset)
+      knownSymbolics[offset] = ref<Expr>();
+  }
 }
 
 bool ObjectState::isAllConcrete() const {
@@ -323,6 +404,7 @@ const uint8_t *ObjectState::getConcreteStore(bool allowSymbolic) const
     if (!allowSymbolic && !isAllConcrete()) {
         return NULL;
     }
+    loadConcreteStore();
     return concreteStore;
 }
 
@@ -331,6 +413,7 @@ uint8_t *ObjectState::getConcreteStore(bool allowSymbolic)
     if (!allowSymbolic && !isAllConcrete()) {
         return NULL;
     }
+    loadConcreteStore();
     return concreteStore;
 }
 
@@ -367,6 +450,7 @@ inline void ObjectState::setKnownSymbolic(unsigned offset,
 ref<Expr> ObjectState::read8(unsigned offset) const {
   if (!object->isSharedConcrete) {
     if (isByteConcrete(offset)) {
+      loadConcreteStore();
       return ConstantExpr::create(concreteStore[offset], Expr::Int8);
     } else if (isByteKnownSymbolic(offset)) {
       return knownSymbolics[offset];
@@ -403,6 +487,7 @@ ref<Expr> ObjectState::read8(ref<Expr> offset) const {
 void ObjectState::write8(unsigned offset, uint8_t value) {
   //assert(read_only == false && "writing to read-only object!");
   if(!object->isSharedConcrete) {
+    loadConcreteStore();
     concreteStore[offset] = value;
     setKnownSymbolic(offset, 0);
 
@@ -444,6 +529,7 @@ void ObjectState::write8(ref<Expr> offset, ref<Expr> value) {
   }
   
   updates.extend(ZExtExpr::create(offset, Expr::Int32), value);
+  compactUpdates();
 }
 
 /***/
@@ -15,12 +15,82 @@
 #include "klee/Statistics.h"
 
 #include "klee/CoreStats.h"
+#include "klee/util/ExprEvaluator.h"
 
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Process.h"
 
 using namespace klee;
 using namespace llvm;
 
+namespace {
+  cl::opt<bool>
+  ConcolicFastPath("concolic-fast-path",
+                   cl::desc("Answer queries from the concrete inputs of concolic "
+                            "states before calling the solver (default=on)"),
+                   cl::init(true));
+
+  /// Evaluates an expression under the concrete inputs of a state. Reads
+  /// from arrays without a concrete value are left symbolic, so the result
+  /// is only a constant when the inputs determine it.
+  class ConcolicEvaluator : public ExprEvaluator {
+    const Assignment &concolics;
+
+  protected:
+    ref<Expr> getInitialValue(const Array &array, unsigned index) {
+      Assignment::bindings_ty::const_iterator it =
+        concolics.bindings.find(&array);
+      if (it == concolics.bindings.end() || index >= it->second.size())
+        return ReadExpr::create(UpdateList(&array, 0),
+                                ConstantExpr::alloc(index, Expr::Int32));
+      return ConstantExpr::alloc(it->second[index], Expr::Int8);
+    }
+
+  public:
+    ConcolicEvaluator(const Assignment &_concolics) : concolics(_concolics) {}
+  };
+
+  /// The concrete inputs of a non-speculative state satisfy its path
+  /// constraints, so the value they give to an expression is always a
+  /// feasible one. Returns null if there are no such inputs or if they do
+  /// not determine the value.
+  ref<ConstantExpr> getConcolicValue(const ExecutionState &state,
+                                     ref<Expr> expr) {
+    if (!ConcolicFastPath || state.speculative ||
+        state.concolics.bindings.empty())
+      return ref<ConstantExpr>();
+
+    ConcolicEvaluator evaluator(state.concolics);
+    ref<Expr> value = evaluator.visit(expr);
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(value))
+      return CE;
+    return ref<ConstantExpr>();
+  }
+
+  /// Copies the concrete inputs of the state for all the given arrays.
+  /// Returns false if some array has no concrete value.
+  bool getConcolicValues(const ExecutionState &state,
+                         const std::vector<const Array*> &objects,
+                         std::vector< std::vector<unsigned char> > &result) {
+    if (!ConcolicFastPath || state.speculative)
+      return false;
+
+    std::vector< std::vector<unsigned char> > values;
+    values.reserve(objects.size());
+    for (unsigned i = 0; i < objects.size(); ++i) {
+      Assignment::bindings_ty::const_iterator it =
+        state.concolics.bindings.find(objects[i]);
+      if (it == state.concolics.bindings.end() ||
+          it->second.size() != objects[i]->size)
+        return false;
+      values.push_back(it->second);
+    }
+
+    result.swap(values);
+    return true;
+  }
+}
+
 /***/
 
 bool TimingSolver::evaluate(const ExecutionState& state, ref<Expr> expr,
@@ -32,13 +102,30 @@ bool TimingSolver::evaluate(const ExecutionState& state, ref<Expr> expr,
     return true;
   }
 
+  ref<ConstantExpr> concrete = getConcolicValue(state, expr);
+
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
   if (simplifyExprs)
     expr = state.constraints.simplifyExpr(expr);
 
-  bool success = solver->evaluate(Query(state.constraints, expr), result);
+  bool success;
+  if (!concrete.isNull()) {
+    // The side taken by the concrete inputs is feasible, only the other
+    // side needs the solver.
+    ++stats::concolicQueries;
+    bool isValid;
+    if (concrete->isTrue()) {
+      success = solver->mustBeTrue(Query(state.constraints, expr), isValid);
+      result = isValid ? Solver::True : Solver::Unknown;
+    } else {
+      success = solver->mustBeFalse(Query(state.constraints, expr), isValid);
+      result = isValid ? Solver::False : Solver::Unknown;
+    }
+  } else {
+    success = solver->evaluate(Query(state.constraints, expr), result);
+  }
 
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
@@ -56,6 +143,14 @@ bool TimingSolver::mustBeTrue(const ExecutionState& state, ref<Expr> expr,
     return true;
   }
 
+  // The concrete inputs are a counterexample, no need for the solver.
+  ref<ConstantExpr> concrete = getConcolicValue(state, expr);
+  if (!concrete.isNull() && concrete->isFalse()) {
+    ++stats::concolicQueries;
+    result = false;
+    return true;
+  }
+
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
@@ -103,7 +198,13 @@ bool TimingSolver::getValue(const ExecutionState& state, ref<Expr> expr,
     result = CE;
     return true;
   }
-  
+
+  result = getConcolicValue(state, expr);
+  if (!result.isNull()) {
+    ++stats::concolicQueries;
+    return true;
+  }
+
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
@@ -129,6 +230,12 @@ TimingSolver::getInitialValues(const ExecutionState& state,
   if (objects.empty())
     return true;
 
+  // The concrete inputs already satisfy the path constraints
+  if (getConcolicValues(state, objects, result)) {
+    ++stats::concolicQueries;
+    return true;
+  }
+
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
@@ -10,8 +10,10 @@
 #include "klee/Constraints.h"
 
 #include "klee/util/ExprPPrinter.h"
+#include "klee/util/ExprUtil.h"
 #include "klee/util/ExprVisitor.h"
 
+#include <algorithm>
 #include <iostream>
 #include <map>
 
@@ -61,10 +63,213 @@ public:
   }
 };
 
+ConstraintPartition::MemberList::~MemberList() {
+  // Free the unshared part of the list without a deep recursion
+  while (!next.isNull() && next->refCount == 1) {
+    ref<MemberList> rest = next->next;
+    next->next = ref<MemberList>();
+    next = rest;
+  }
+}
+
+const ConstraintPartition::Node &ConstraintPartition::getNode(int node) const {
+  const std::pair<int, Node> *n = nodes.lookup(node);
+  assert(n && "invalid node");
+  return n->second;
+}
+
+void ConstraintPartition::setNode(int node, const Node &n) {
+  nodes = nodes.replace(std::make_pair(node, n));
+}
+
+int ConstraintPartition::newNode() {
+  Node n;
+  n.parent = nodeCount;
+  n.rank = 0;
+  n.memberCount = 0;
+  setNode(nodeCount, n);
+  return nodeCount++;
+}
+
+/// Paths are not compressed, which would copy the nodes along them. The
+/// union by rank keeps them logarithmic.
+int ConstraintPartition::find(int node) const {
+  for (;;) {
+    int parent = getNode(node).parent;
+    if (parent == node)
+      return node;
+    node = parent;
+  }
+}
+
+int ConstraintPartition::unite(int a, int b) {
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return a;
+
+  Node na = getNode(a), nb = getNode(b);
+  if (na.rank < nb.rank) {
+    std::swap(a, b);
+    std::swap(na, nb);
+  }
+  if (na.rank == nb.rank)
+    ++na.rank;
+
+  // Copy the shorter list in front of the other one, so that a
+  // constraint is copied O(log n) times
+  ref<MemberList> shorter = nb.members, longer = na.members;
+  if (na.memberCount < nb.memberCount)
+    std::swap(shorter, longer);
+  for (MemberList *m = shorter.get(); m; m = m->next.get())
+    longer = new MemberList(m->index, longer);
+
+  na.members = longer;
+  na.memberCount += nb.memberCount;
+  nb.parent = a;
+  nb.memberCount = 0;
+  nb.members = ref<MemberList>();
+  setNode(a, na);
+  setNode(b, nb);
+  return a;
+}
+
+/// Returns the nodes of the elements read by e, creating the missing ones.
+/// Reads of constant arrays without updates do not alias anything.
+void ConstraintPartition::getNodes(const ref<Expr> &e,
+                                   std::vector<int> &nodes) {
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    ReadExpr *re = reads[i].get();
+    const Array *array = re->updates.root;
+    if (array->isConstantArray() && !re->updates.head)
+      continue;
+
+    if (const std::pair<const Array*, int> *whole = wholeArrays.lookup(array)) {
+      nodes.push_back(whole->second);
+    } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+      ArrayByte byte(array, (unsigned) CE->getZExtValue(32));
+      if (const std::pair<ArrayByte, int> *n = bytes.lookup(byte)) {
+        nodes.push_back(n->second);
+      } else {
+        int node = newNode();
+        bytes = bytes.insert(std::make_pair(byte, node));
+        nodes.push_back(node);
+      }
+    } else {
+      // A read at a symbolic offset may alias any byte of the array. The
+      // byte nodes are not looked up anymore once the array has a node.
+      int node = newNode();
+      for (ImmutableMap<ArrayByte, int>::iterator
+             it = bytes.lower_bound(ArrayByte(array, 0)), ie = bytes.end();
+           it != ie && it->first.first == array; ++it)
+        node = unite(node, it->second);
+      wholeArrays = wholeArrays.insert(std::make_pair(array, node));
+      nodes.push_back(node);
+    }
+  }
+}
+
+/// Returns the roots of the groups that contain an element read by e,
+/// without adding any node.
+void ConstraintPartition::getRoots(const ref<Expr> &e,
+                                   std::vector<int> &roots) const {
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    ReadExpr *re = reads[i].get();
+    const Array *array = re->updates.root;
+    if (array->isConstantArray() && !re->updates.head)
+      continue;
+
+    if (const std::pair<const Array*, int> *whole = wholeArrays.lookup(array)) {
+      roots.push_back(find(whole->second));
+    } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+      const std::pair<ArrayByte, int> *n =
+        bytes.lookup(ArrayByte(array, (unsigned) CE->getZExtValue(32)));
+      if (n)
+        roots.push_back(find(n->second));
+    } else {
+      for (ImmutableMap<ArrayByte, int>::iterator
+             it = bytes.lower_bound(ArrayByte(array, 0)), ie = bytes.end();
+           it != ie && it->first.first == array; ++it)
+        roots.push_back(find(it->second));
+    }
+  }
+}
+
+void ConstraintPartition::add(const ref<Expr> &e) {
+  unsigned index = constraintCount++;
+
+  std::vector<int> nodes;
+  getNodes(e, nodes);
+  if (nodes.empty())
+    return;
+
+  int root = nodes[0];
+  for (unsigned i = 1; i < nodes.size(); ++i)
+    root = unite(root, nodes[i]);
+
+  root = find(root);
+  Node n = getNode(root);
+  n.members = new MemberList(index, n.members);
+  ++n.memberCount;
+  setNode(root, n);
+}
+
+void ConstraintPartition::getIndependentConstraints(const ref<Expr> &e,
+                                                    std::vector<unsigned> &result) const {
+  std::vector<int> roots;
+  getRoots(e, roots);
+  std::sort(roots.begin(), roots.end());
+  roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+
+  for (unsigned i = 0; i < roots.size(); ++i) {
+    for (MemberList *m = getNode(roots[i]).members.get(); m; m = m->next.get())
+      result.push_back(m->index);
+  }
+  std::sort(result.begin(), result.end());
+}
+
+///
+
+void ConstraintManager::getIndependentConstraints(ref<Expr> e,
+                                                  std::vector< ref<Expr> > &result) const {
+  if (partition.isNull()) {
+    partition = new ConstraintPartition();
+    for (constraints_ty::const_iterator it = constraints.begin(),
+           ie = constraints.end(); it != ie; ++it)
+      partition->add(*it);
+  }
+
+  std::vector<unsigned> indices;
+  partition->getIndependentConstraints(e, indices);
+  for (unsigned i = 0; i < indices.size(); ++i)
+    result.push_back(constraints[indices[i]]);
+}
+
+void ConstraintManager::pushConstraint(ref<Expr> e) {
+  constraints.push_back(e);
+  if (partition.isNull())
+    return;
+
+  // The partition may be shared with copies of this manager. Copying it
+  // only copies the roots of its maps.
+  if (partition->refCount > 1)
+    partition = new ConstraintPartition(*partition.get());
+  partition->add(e);
+}
+
 bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor) {
   ConstraintManager::constraints_ty old;
   bool changed = false;
 
+  // The rewritten constraints may be added in a different order, so the
+  // partition is rebuilt unless nothing changed.
+  ref<ConstraintPartition> oldPartition = partition;
+  partition = ref<ConstraintPartition>();
+
   constraints.swap(old);
   for (ConstraintManager::constraints_ty::iterator 
          it = old.begin(), ie = old.end(); it != ie; ++it) {
@@ -79,6 +284,9 @@ bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor) {
     }
   }
 
+  if (!changed)
+    partition = oldPartition;
+
   return changed;
 }
 
@@ -140,12 +348,12 @@ void ConstraintManager::addConstraintInternal(ref<Expr> e) {
       ExprReplaceVisitor visitor(be->right, be->left);
       rewriteConstraints(visitor);
     }
-    constraints.push_back(e);
+    pushConstraint(e);
     break;
   }
     
   default:
-    constraints.push_back(e);
+    pushConstraint(e);
     break;
   }
 }
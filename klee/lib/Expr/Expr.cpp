@@ -20,6 +20,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <tr1/unordered_map>
 
 using namespace klee;
 using namespace llvm;
@@ -29,12 +30,59 @@ namespace {
   ConstArrayOpt("const-array-opt",
      cl::init(true),
 	 cl::desc("Enable various optimizations involving all-constant arrays."));
+
+  cl::opt<bool>
+  InternExpressions("intern-expressions",
+     cl::init(true),
+     cl::desc("Share a single node between structurally equal expressions (default=on)"));
 }
 
 /***/
 
 unsigned Expr::count = 0;
 
+typedef std::tr1::unordered_multimap<unsigned, Expr*> ExprInternTable;
+
+/// The table only holds weak references: expressions remove themselves
+/// when their last reference goes away. It is never destroyed, so that
+/// expressions outliving static destructors can still do so.
+static ExprInternTable &getInternTable() {
+  static ExprInternTable *table = new ExprInternTable();
+  return *table;
+}
+
+ref<Expr> Expr::intern(const ref<Expr> &e) {
+  if (!InternExpressions)
+    return e;
+
+  // The kids of e are canonical already, so compare() stops at their
+  // pointers and the lookup does not walk the whole tree.
+  ExprInternTable &table = getInternTable();
+  std::pair<ExprInternTable::iterator, ExprInternTable::iterator> range =
+      table.equal_range(e->hashValue);
+  for (ExprInternTable::iterator it = range.first; it != range.second; ++it) {
+    if (it->second->compare(*e) == 0)
+      return it->second;
+  }
+
+  table.insert(std::make_pair(e->hashValue, e.get()));
+  e->interned = true;
+  return e;
+}
+
+void Expr::unintern() {
+  ExprInternTable &table = getInternTable();
+  std::pair<ExprInternTable::iterator, ExprInternTable::iterator> range =
+      table.equal_range(hashValue);
+  for (ExprInternTable::iterator it = range.first; it != range.second; ++it) {
+    if (it->second == this) {
+      table.erase(it);
+      break;
+    }
+  }
+  interned = false;
+}
+
 ref<Expr> Expr::createTempRead(const Array *array, Expr::Width w) {
   UpdateList ul(array, 0);
 
@@ -189,7 +237,7 @@ unsigned ReadExpr::computeHash() {
 }
 
 unsigned NotExpr::computeHash() {
-  unsigned hashValue = expr->hash() * Expr::MAGIC_HASH_CONSTANT * Expr::Not;
+  hashValue = expr->hash() * Expr::MAGIC_HASH_CONSTANT * Expr::Not;
   return hashValue;
 }
 
@@ -14,6 +14,10 @@
 
 #include "klee/util/ExprVisitor.h"
 
+#include "llvm/ADT/StringExtras.h"
+
+#include <algorithm>
+#include <map>
 #include <set>
 
 using namespace klee;
@@ -120,8 +124,252 @@ void klee::findSymbolicObjects(ref<Expr> e,
   findSymbolicObjects(&e, &e+1, results);
 }
 
+namespace {
+
+/// Constant roots created by compactUpdateList, by the hash of their
+/// contents. Arrays are never freed, so the states that fold the same
+/// updates (e.g., after a fork) share one root instead of each leaking
+/// their own.
+std::multimap<unsigned, const Array*> CompactedRoots;
+
+const Array *getCompactedRoot(const std::vector< ref<ConstantExpr> > &Contents) {
+  unsigned Hash = Contents.size();
+  for (unsigned i = 0; i != Contents.size(); ++i)
+    Hash = Hash * 31 + Contents[i]->hash();
+
+  typedef std::multimap<unsigned, const Array*>::iterator iterator;
+  std::pair<iterator, iterator> Range = CompactedRoots.equal_range(Hash);
+  for (iterator it = Range.first; it != Range.second; ++it) {
+    if (it->second->constantValues == Contents)
+      return it->second;
+  }
+
+  static unsigned id = 0;
+  const Array *Root = new Array("compact_arr" + llvm::utostr(++id),
+                                Contents.size(), &Contents[0],
+                                &Contents[0] + Contents.size());
+  CompactedRoots.insert(std::make_pair(Hash, Root));
+  return Root;
+}
+
+}
+
+UpdateList klee::compactUpdateList(const UpdateList &updates) {
+  // Newest update first
+  unsigned NumWrites = updates.getSize();
+  std::vector<const UpdateNode*> Nodes;
+  Nodes.reserve(NumWrites);
+  for (const UpdateNode *un = updates.head; un; un = un->next)
+    Nodes.push_back(un);
+
+  std::vector<bool> Dead(NumWrites, false);
+  std::set<uint64_t> ConstantIndices;
+  std::set< ref<Expr> > SymbolicIndices;
+  unsigned Oldest = NumWrites;
+  for (unsigned i = 0; i != NumWrites; ++i) {
+    bool Shadowed;
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(Nodes[i]->index))
+      Shadowed = !ConstantIndices.insert(CE->getZExtValue()).second;
+    else
+      Shadowed = !SymbolicIndices.insert(Nodes[i]->index).second;
+    if (Shadowed) {
+      Dead[i] = true;
+      Oldest = i;
+    }
+  }
+
+  // Concrete updates at the bottom of the list can go to a new root. The
+  // root is never freed, so only create one when it takes less memory than
+  // the update nodes it replaces.
+  unsigned Bottom = NumWrites;
+  const Array *Root = updates.root;
+  if (Root && Root->isConstantArray()) {
+    while (Bottom != 0 &&
+           isa<ConstantExpr>(Nodes[Bottom - 1]->index) &&
+           isa<ConstantExpr>(Nodes[Bottom - 1]->value))
+      --Bottom;
+
+    uint64_t Folded = NumWrites - Bottom;
+    if (Folded * sizeof(UpdateNode) >=
+        Root->size * sizeof(ref<ConstantExpr>)) {
+      std::vector< ref<ConstantExpr> > Contents(Root->constantValues);
+      for (unsigned i = NumWrites; i != Bottom; --i) {
+        const UpdateNode *un = Nodes[i - 1];
+        uint64_t Index = cast<ConstantExpr>(un->index)->getZExtValue();
+        assert(Index < Contents.size() && "Update out of bounds");
+        Contents[Index] = cast<ConstantExpr>(un->value);
+      }
+      Root = getCompactedRoot(Contents);
+    }
+  }
+
+  bool Rebased = Root != updates.root;
+  if (!Rebased && Oldest == NumWrites)
+    return updates;
+
+  // Keep the list below the oldest removed update and replay the others
+  unsigned Replay = Rebased ? Bottom : Oldest;
+  UpdateList Compacted(Root, Rebased ? 0 : Nodes[Oldest]->next);
+  for (unsigned i = Replay; i != 0; --i) {
+    if (!Dead[i - 1])
+      Compacted.extend(Nodes[i - 1]->index, Nodes[i - 1]->value);
+  }
+
+  return Compacted;
+}
+
+namespace {
+
+/// Hashes expressions structurally, numbering the symbolic arrays in the
+/// order in which they are reached instead of using their names. Without
+/// numbering, symbolic arrays are only hashed by their size.
+class RenamingHasher {
+public:
+  typedef std::pair<uint64_t, uint64_t> Hash;
+
+private:
+  std::vector<const Array*> *arrays;
+  std::map<const Array*, unsigned> arrayIds;
+  ExprHashMap<Hash> exprHashes;
+  std::map<std::pair<const Array*, const UpdateNode*>, Hash> updateHashes;
+
+  static Hash seed(uint64_t v) {
+    Hash h(14695981039346656037ULL, 0);
+    mix(h, v);
+    return h;
+  }
+
+  Hash hashArray(const Array *array) {
+    Hash h = seed(array->size);
+    if (array->isSymbolicArray()) {
+      if (!arrays)
+        return h;
+      std::map<const Array*, unsigned>::iterator it = arrayIds.find(array);
+      if (it == arrayIds.end()) {
+        it = arrayIds.insert(std::make_pair(array, arrays->size())).first;
+        arrays->push_back(array);
+      }
+      mix(h, it->second);
+    } else {
+      for (unsigned i = 0; i < array->size; ++i)
+        mix(h, hashExpr(array->constantValues[i]));
+    }
+    return h;
+  }
+
+  Hash hashUpdates(const UpdateList &updates) {
+    // Hash the nodes from the oldest one, stopping at the first one that
+    // is already known. Lists often share their older nodes.
+    std::vector<const UpdateNode*> nodes;
+    Hash h;
+    const UpdateNode *un = updates.head;
+    for (;; un = un->next) {
+      if (!un) {
+        h = hashArray(updates.root);
+        break;
+      }
+
+      std::map<std::pair<const Array*, const UpdateNode*>, Hash>::iterator it =
+        updateHashes.find(std::make_pair(updates.root, un));
+      if (it != updateHashes.end()) {
+        h = it->second;
+        break;
+      }
+      nodes.push_back(un);
+    }
+
+    while (!nodes.empty()) {
+      un = nodes.back();
+      nodes.pop_back();
+      mix(h, hashExpr(un->index));
+      mix(h, hashExpr(un->value));
+      updateHashes[std::make_pair(updates.root, un)] = h;
+    }
+    return h;
+  }
+
+public:
+  /// Numbers the symbolic arrays into _arrays, unless it is null
+  RenamingHasher(std::vector<const Array*> *_arrays) : arrays(_arrays) {}
+
+  static void mix(Hash &h, uint64_t v) {
+    h.first = (h.first ^ v) * 1099511628211ULL;
+    h.second = (h.second + v) * 0x9E3779B97F4A7C15ULL;
+    h.second ^= h.second >> 29;
+  }
+
+  static void mix(Hash &h, const Hash &v) {
+    mix(h, v.first);
+    mix(h, v.second);
+  }
+
+  Hash hashExpr(const ref<Expr> &e) {
+    ExprHashMap<Hash>::iterator it = exprHashes.find(e);
+    if (it != exprHashes.end())
+      return it->second;
+
+    Hash h = seed(e->getKind());
+    mix(h, e->getWidth());
+
+    if (ConstantExpr *ce = dyn_cast<ConstantExpr>(e)) {
+      const llvm::APInt &value = ce->getAPValue();
+      for (unsigned i = 0; i < value.getNumWords(); ++i)
+        mix(h, value.getRawData()[i]);
+    } else if (ReadExpr *re = dyn_cast<ReadExpr>(e)) {
+      mix(h, hashUpdates(re->updates));
+      mix(h, hashExpr(re->index));
+    } else {
+      if (ExtractExpr *ee = dyn_cast<ExtractExpr>(e))
+        mix(h, ee->offset);
+      for (unsigned i = 0; i < e->getNumKids(); ++i)
+        mix(h, hashExpr(e->getKid(i)));
+    }
+
+    exprHashes.insert(std::make_pair(e, h));
+    return h;
+  }
+};
+
+typedef std::pair<RenamingHasher::Hash, ref<Expr> > ShapedExpr;
+
+struct ShapeLT {
+  bool operator()(const ShapedExpr &a, const ShapedExpr &b) const {
+    return a.first < b.first;
+  }
+};
+
+}
+
+template<typename InputIterator>
+void klee::hashExprsUpToRenaming(InputIterator begin,
+                                 InputIterator end,
+                                 uint64_t &hash1, uint64_t &hash2,
+                                 std::vector<const Array*> &arrays) {
+  // The order of the range may depend on the names of the arrays (e.g.,
+  // sets ordered by Expr::compare), so number the arrays in an order
+  // that does not. Expressions with the same shape keep their relative
+  // order, which may still make renamed queries miss.
+  RenamingHasher shapeHasher(0);
+  std::vector<ShapedExpr> sorted;
+  for (; begin != end; ++begin)
+    sorted.push_back(std::make_pair(shapeHasher.hashExpr(*begin), *begin));
+  std::stable_sort(sorted.begin(), sorted.end(), ShapeLT());
+
+  RenamingHasher hasher(&arrays);
+  RenamingHasher::Hash h(14695981039346656037ULL, 0);
+  for (unsigned i = 0; i < sorted.size(); ++i)
+    RenamingHasher::mix(h, hasher.hashExpr(sorted[i].second));
+
+  hash1 = h.first;
+  hash2 = h.second;
+}
+
 typedef std::vector< ref<Expr> >::iterator A;
 template void klee::findSymbolicObjects<A>(A, A, std::vector<const Array*> &);
+template void klee::hashExprsUpToRenaming<A>(A, A, uint64_t &, uint64_t &,
+                                             std::vector<const Array*> &);
 
 typedef std::set< ref<Expr> >::iterator B;
 template void klee::findSymbolicObjects<B>(B, B, std::vector<const Array*> &);
+template void klee::hashExprsUpToRenaming<B>(B, B, uint64_t &, uint64_t &,
+                                             std::vector<const Array*> &);
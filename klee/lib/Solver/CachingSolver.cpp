@@ -10,27 +10,180 @@
 
 #include "klee/Solver.h"
 
+#include "PersistentSolverCache.h"
+
+#include "klee/Common.h"
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
 #include "klee/IncompleteSolver.h"
 #include "klee/SolverImpl.h"
 
 #include "klee/SolverStats.h"
+#include "klee/util/ExprUtil.h"
+
+#include "llvm/Support/CommandLine.h"
 
 #include <tr1/unordered_map>
+#include <stdint.h>
+
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
 
 using namespace klee;
+using namespace llvm;
+
+namespace {
+  cl::opt<bool>
+  UseSharedQueryCache("use-shared-query-cache",
+                      cl::desc("Share the query cache between all the processes "
+                               "forked after the solver is created"),
+                      cl::init(false));
+
+  cl::opt<unsigned>
+  SharedQueryCacheSize("shared-query-cache-size",
+                       cl::desc("Size of the shared query cache in MB (default=64)"),
+                       cl::init(64));
+
+  /// A fixed-size hash table in shared memory. Processes forked after it is
+  /// created all see the same table, even if they create new solvers.
+  ///
+  /// Queries are identified by the two 64-bit hashes of
+  /// hashExprsUpToRenaming(), which are the same in all processes, and the
+  /// result is stored in the low bits of the second one. Entries
+  /// are updated without locking: a reader that races with a writer sees a
+  /// key mismatch, i.e., a miss.
+  class SharedQueryCache {
+  private:
+    struct Entry {
+      volatile uint64_t key1;
+      volatile uint64_t key2;
+    };
+
+    enum {
+      ProbeLength = 4,
+      ResultMask = 7
+    };
+
+    Entry *entries;
+    uint64_t entryCount;
+
+    SharedQueryCache(Entry *_entries, uint64_t _entryCount)
+      : entries(_entries), entryCount(_entryCount) {}
+
+    static uint64_t encode(uint64_t key2,
+                           IncompleteSolver::PartialValidity result) {
+      return (key2 & ~(uint64_t) ResultMask) | (uint64_t) (result + 4);
+    }
+
+    /// 0 marks empty entries
+    static uint64_t nonZero(uint64_t key1) {
+      return key1 ? key1 : 1;
+    }
+
+  public:
+    /// Returns the table of this run, creating it on the first call
+    static SharedQueryCache *get();
+
+    bool lookup(uint64_t key1, uint64_t key2,
+                IncompleteSolver::PartialValidity &result) const;
+    void insert(uint64_t key1, uint64_t key2,
+                IncompleteSolver::PartialValidity result);
+  };
+}
+
+SharedQueryCache *SharedQueryCache::get() {
+  static SharedQueryCache *cache = 0;
+  static bool initialized = false;
+  if (initialized)
+    return cache;
+  initialized = true;
+
+#ifndef __MINGW32__
+  uint64_t size = (uint64_t) SharedQueryCacheSize << 20;
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    klee_warning("could not allocate the shared query cache");
+    return 0;
+  }
+
+  cache = new SharedQueryCache((Entry*) mem, size / sizeof(Entry));
+#endif
+  return cache;
+}
+
+bool SharedQueryCache::lookup(uint64_t key1, uint64_t key2,
+                              IncompleteSolver::PartialValidity &result) const {
+  key1 = nonZero(key1);
+  for (unsigned i = 0; i < ProbeLength; ++i) {
+    const Entry &e = entries[(key1 + i) % entryCount];
+
+    uint64_t k1 = e.key1;
+    __sync_synchronize();
+    uint64_t k2 = e.key2;
+    __sync_synchronize();
+
+    if (k1 != key1 || e.key1 != k1)
+      continue;
+    if ((k2 & ~(uint64_t) ResultMask) != (key2 & ~(uint64_t) ResultMask))
+      continue;
+
+    result = (IncompleteSolver::PartialValidity) ((int) (k2 & ResultMask) - 4);
+    return true;
+  }
+
+  return false;
+}
+
+void SharedQueryCache::insert(uint64_t key1, uint64_t key2,
+                              IncompleteSolver::PartialValidity result) {
+  // Update the entry of the query if there is one, otherwise take the
+  // first free entry, otherwise evict the first one.
+  key1 = nonZero(key1);
+  Entry *target = 0;
+  for (unsigned i = 0; i < ProbeLength; ++i) {
+    Entry &e = entries[(key1 + i) % entryCount];
+    if (e.key1 == key1) {
+      target = &e;
+      break;
+    }
+    if (!target && !e.key1)
+      target = &e;
+  }
+
+  if (!target)
+    target = &entries[key1 % entryCount];
+
+  target->key1 = 0;
+  __sync_synchronize();
+  target->key2 = encode(key2, result);
+  __sync_synchronize();
+  target->key1 = key1;
+}
 
 class CachingSolver : public SolverImpl {
 private:
   ref<Expr> canonicalizeQuery(ref<Expr> originalQuery,
                               bool &negationUsed);
 
+  /// Key of a query in the shared and persistent caches, which does not
+  /// depend on the names of the arrays. It is computed on demand, at most
+  /// once for the lookup of a query and the insertion that follows a miss.
+  struct ExternalKey {
+    bool computed;
+    PersistentSolverCache::Key key;
+
+    ExternalKey() : computed(false) {}
+  };
+
   void cacheInsert(const Query& query,
-                   IncompleteSolver::PartialValidity result);
+                   IncompleteSolver::PartialValidity result,
+                   ExternalKey &externalKey);
 
   bool cacheLookup(const Query& query,
-                   IncompleteSolver::PartialValidity &result);
+                   IncompleteSolver::PartialValidity &result,
+                   ExternalKey &externalKey);
   
   struct CacheEntry {
     CacheEntry(const ConstraintManager &c, ref<Expr> q)
@@ -66,8 +219,17 @@ private:
   Solver *solver;
   cache_map cache;
 
+  SharedQueryCache *sharedCache;
+  PersistentSolverCache *persistentCache;
+
+  const PersistentSolverCache::Key &getExternalKey(const CacheEntry &ce,
+                                                   ExternalKey &externalKey);
+
 public:
-  CachingSolver(Solver *s) : solver(s) {}
+  CachingSolver(Solver *s)
+    : solver(s),
+      sharedCache(UseSharedQueryCache ? SharedQueryCache::get() : 0),
+      persistentCache(PersistentSolverCache::get()) {}
   ~CachingSolver() { cache.clear(); delete solver; }
 
   bool computeValidity(const Query&, Solver::Validity &result);
@@ -104,7 +266,8 @@ ref<Expr> CachingSolver::canonicalizeQuery(ref<Expr> originalQuery,
 /** @returns true on a cache hit, false of a cache miss.  Reference
     value result only valid on a cache hit. */
 bool CachingSolver::cacheLookup(const Query& query,
-                                IncompleteSolver::PartialValidity &result) {
+                                IncompleteSolver::PartialValidity &result,
+                                ExternalKey &externalKey) {
   bool negationUsed;
   ref<Expr> canonicalQuery = canonicalizeQuery(query.expr, negationUsed);
 
@@ -117,13 +280,42 @@ bool CachingSolver::cacheLookup(const Query& query,
               it->second);
     return true;
   }
+
+  if (sharedCache) {
+    const PersistentSolverCache::Key &key = getExternalKey(ce, externalKey);
+    IncompleteSolver::PartialValidity cachedResult;
+
+    if (sharedCache->lookup(key.first, key.second, cachedResult)) {
+      ++stats::sharedQueryCacheHits;
+      cache.insert(std::make_pair(ce, cachedResult));
+      result = (negationUsed ?
+                IncompleteSolver::negatePartialValidity(cachedResult) :
+                cachedResult);
+      return true;
+    }
+
+    ++stats::sharedQueryCacheMisses;
+  }
+
+  if (persistentCache) {
+    IncompleteSolver::PartialValidity cachedResult;
+    if (persistentCache->lookupValidity(getExternalKey(ce, externalKey),
+                                        cachedResult)) {
+      cache.insert(std::make_pair(ce, cachedResult));
+      result = (negationUsed ?
+                IncompleteSolver::negatePartialValidity(cachedResult) :
+                cachedResult);
+      return true;
+    }
+  }
   
   return false;
 }
 
 /// Inserts the given query, result pair into the cache.
 void CachingSolver::cacheInsert(const Query& query,
-                                IncompleteSolver::PartialValidity result) {
+                                IncompleteSolver::PartialValidity result,
+                                ExternalKey &externalKey) {
   bool negationUsed;
   ref<Expr> canonicalQuery = canonicalizeQuery(query.expr, negationUsed);
 
@@ -132,12 +324,37 @@ void CachingSolver::cacheInsert(const Query& query,
     (negationUsed ? IncompleteSolver::negatePartialValidity(result) : result);
   
   cache.insert(std::make_pair(ce, cachedResult));
+
+  if (sharedCache) {
+    const PersistentSolverCache::Key &key = getExternalKey(ce, externalKey);
+    sharedCache->insert(key.first, key.second, cachedResult);
+  }
+
+  if (persistentCache)
+    persistentCache->insertValidity(getExternalKey(ce, externalKey),
+                                    cachedResult);
+}
+
+const PersistentSolverCache::Key &
+CachingSolver::getExternalKey(const CacheEntry &ce, ExternalKey &externalKey) {
+  if (!externalKey.computed) {
+    std::vector< ref<Expr> > exprs(ce.constraints.begin(),
+                                   ce.constraints.end());
+    exprs.push_back(ce.query);
+
+    std::vector<const Array*> arrays;
+    hashExprsUpToRenaming(exprs.begin(), exprs.end(), externalKey.key.first,
+                          externalKey.key.second, arrays);
+    externalKey.computed = true;
+  }
+  return externalKey.key;
 }
 
 bool CachingSolver::computeValidity(const Query& query,
                                     Solver::Validity &result) {
   IncompleteSolver::PartialValidity cachedResult;
-  bool tmp, cacheHit = cacheLookup(query, cachedResult);
+  ExternalKey externalKey;
+  bool tmp, cacheHit = cacheLookup(query, cachedResult, externalKey);
   
   if (cacheHit) {
     ++stats::queryCacheHits;
@@ -156,11 +373,11 @@ bool CachingSolver::computeValidity(const Query& query,
       if (!solver->impl->computeTruth(query, tmp))
         return false;
       if (tmp) {
-        cacheInsert(query, IncompleteSolver::MustBeTrue);
+        cacheInsert(query, IncompleteSolver::MustBeTrue, externalKey);
         result = Solver::True;
         return true;
       } else {
-        cacheInsert(query, IncompleteSolver::TrueOrFalse);
+        cacheInsert(query, IncompleteSolver::TrueOrFalse, externalKey);
         result = Solver::Unknown;
         return true;
       }
@@ -169,11 +386,11 @@ bool CachingSolver::computeValidity(const Query& query,
       if (!solver->impl->computeTruth(query.negateExpr(), tmp))
         return false;
       if (tmp) {
-        cacheInsert(query, IncompleteSolver::MustBeFalse);
+        cacheInsert(query, IncompleteSolver::MustBeFalse, externalKey);
         result = Solver::False;
         return true;
       } else {
-        cacheInsert(query, IncompleteSolver::TrueOrFalse);
+        cacheInsert(query, IncompleteSolver::TrueOrFalse, externalKey);
         result = Solver::Unknown;
         return true;
       }
@@ -196,14 +413,15 @@ bool CachingSolver::computeValidity(const Query& query,
     cachedResult = IncompleteSolver::TrueOrFalse; break;
   }
   
-  cacheInsert(query, cachedResult);
+  cacheInsert(query, cachedResult, externalKey);
   return true;
 }
 
 bool CachingSolver::computeTruth(const Query& query,
                                  bool &isValid) {
   IncompleteSolver::PartialValidity cachedResult;
-  bool cacheHit = cacheLookup(query, cachedResult);
+  ExternalKey externalKey;
+  bool cacheHit = cacheLookup(query, cachedResult, externalKey);
 
   // a cached result of MayBeTrue forces us to check whether
   // a False assignment exists.
@@ -230,7 +448,7 @@ bool CachingSolver::computeTruth(const Query& query,
     cachedResult = IncompleteSolver::MayBeFalse;
   }
   
-  cacheInsert(query, cachedResult);
+  cacheInsert(query, cachedResult, externalKey);
   return true;
 }
 
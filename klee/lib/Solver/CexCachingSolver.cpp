@@ -9,6 +9,8 @@
 
 #include "klee/Solver.h"
 
+#include "PersistentSolverCache.h"
+
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
 #include "klee/SolverImpl.h"
@@ -201,6 +203,37 @@ bool CexCachingSolver::getAssignment(const Query& query, Assignment *&result) {
   std::vector<const Array*> objects;
   findSymbolicObjects(key.begin(), key.end(), objects);
 
+  // Try the results saved by previous runs. Satisfying assignments are
+  // checked before use, so that a hash collision cannot produce a wrong
+  // counterexample. Unsatisfiable results cannot be checked without the
+  // solver and rely on the 128-bit key alone.
+  PersistentSolverCache *persistent = PersistentSolverCache::get();
+  PersistentSolverCache::Key persistentKey;
+  std::vector<const Array*> hashedArrays;
+  if (persistent) {
+    hashExprsUpToRenaming(key.begin(), key.end(), persistentKey.first,
+                          persistentKey.second, hashedArrays);
+
+    Assignment *binding = 0;
+    if (persistent->lookupCex(persistentKey, hashedArrays, binding) &&
+        (!binding || binding->satisfies(key.begin(), key.end()))) {
+      if (binding) {
+        std::pair<assignmentsTable_ty::iterator, bool>
+          res = assignmentsTable.insert(binding);
+        if (!res.second) {
+          delete binding;
+          binding = *res.first;
+        }
+      }
+
+      result = binding;
+      cache.insert(key, binding);
+      return true;
+    } else if (binding) {
+      delete binding;
+    }
+  }
+
   std::vector< std::vector<unsigned char> > values;
   bool hasSolution;
   if (!solver->impl->computeInitialValues(query, objects, values, 
@@ -228,6 +261,8 @@ bool CexCachingSolver::getAssignment(const Query& query, Assignment *&result) {
   
   result = binding;
   cache.insert(key, binding);
+  if (persistent)
+    persistent->insertCex(persistentKey, hashedArrays, binding);
 
   return true;
 }
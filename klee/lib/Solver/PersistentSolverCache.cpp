@@ -0,0 +1,387 @@
+//===-- PersistentSolverCache.cpp -----------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PersistentSolverCache.h"
+
+#include "klee/Common.h"
+#include "klee/Expr.h"
+#include "klee/Solver.h"
+#include "klee/util/Assignment.h"
+
+#include "llvm/Support/CommandLine.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace klee;
+using namespace llvm;
+
+namespace {
+  cl::opt<std::string>
+  LoadSolverCache("load-solver-cache",
+                  cl::desc("Start with the solver results saved by a previous run "
+                           "with --save-solver-cache"),
+                  cl::init(""));
+
+  cl::opt<bool>
+  SaveSolverCache("save-solver-cache",
+                  cl::desc("Save the results of the caching solvers to "
+                           "solver-cache.dat in the output directory"),
+                  cl::init(false));
+
+  cl::opt<unsigned>
+  SolverCacheMaxSize("solver-cache-max-size",
+                     cl::desc("Maximum size of the saved solver cache in MB. The "
+                              "results used least recently are dropped first (default=64)"),
+                     cl::init(64));
+
+  const char Magic[8] = { 'K', 'S', 'C', 'A', 'C', 'H', 'E', '1' };
+
+  enum EntryKind {
+    ValidityEntry = 0,
+    CexEntry = 1
+  };
+
+  template<class T>
+  bool readValue(FILE *f, T &value) {
+    return fread(&value, sizeof(value), 1, f) == 1;
+  }
+
+  template<class T>
+  bool writeValue(FILE *f, const T &value) {
+    return fwrite(&value, sizeof(value), 1, f) == 1;
+  }
+}
+
+uint64_t PersistentSolverCache::Entry::getSize() const {
+  // Kind, key and generation
+  uint64_t size = 1 + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+  if (!isCex)
+    return size + 1;
+
+  size += 1 + sizeof(uint32_t);
+  for (unsigned i = 0; i < values.size(); ++i)
+    size += sizeof(uint32_t) + values[i].size();
+  return size;
+}
+
+namespace {
+  typedef std::pair<uint32_t, uint64_t> Age;
+
+  struct NewerFirst {
+    template<class T>
+    bool operator()(const std::pair<Age, T> &a,
+                    const std::pair<Age, T> &b) const {
+      return a.first > b.first;
+    }
+  };
+}
+
+PersistentSolverCache *PersistentSolverCache::get() {
+  static PersistentSolverCache *cache = 0;
+  static bool initialized = false;
+  if (initialized)
+    return cache;
+  initialized = true;
+
+  if (LoadSolverCache.empty() && !SaveSolverCache)
+    return 0;
+
+  cache = new PersistentSolverCache();
+  if (!LoadSolverCache.empty() && !cache->load(LoadSolverCache))
+    klee_warning("could not load the solver cache from %s",
+                 LoadSolverCache.c_str());
+  return cache;
+}
+
+bool PersistentSolverCache::load(const std::string &path) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+
+  char magic[sizeof(Magic)];
+  uint32_t fileGeneration;
+  if (fread(magic, sizeof(magic), 1, f) != 1 ||
+      memcmp(magic, Magic, sizeof(Magic)) ||
+      !readValue(f, fileGeneration)) {
+    fclose(f);
+    return false;
+  }
+
+  // Sizes read from the file must fit in the rest of it
+  long start = ftell(f), end = -1;
+  if (start >= 0 && !fseek(f, 0, SEEK_END)) {
+    end = ftell(f);
+    if (fseek(f, start, SEEK_SET))
+      end = -1;
+  }
+  if (end < 0) {
+    fclose(f);
+    return false;
+  }
+
+  bool success = true;
+  for (;;) {
+    uint8_t kind;
+    if (!readValue(f, kind))
+      break;
+
+    Key key;
+    Entry entry;
+    if (!readValue(f, key.first) || !readValue(f, key.second) ||
+        !readValue(f, entry.generation)) {
+      success = false;
+      break;
+    }
+
+    entry.lastUse = 0;
+    entry.isCex = kind == CexEntry;
+    if (!entry.isCex) {
+      int8_t validity;
+      if (kind != ValidityEntry || !readValue(f, validity) ||
+          validity < IncompleteSolver::MayBeFalse ||
+          validity > IncompleteSolver::None) {
+        success = false;
+        break;
+      }
+      entry.validity = (IncompleteSolver::PartialValidity) validity;
+      entry.hasSolution = false;
+      validityEntries[key] = entry;
+      continue;
+    }
+
+    uint8_t hasSolution;
+    uint32_t arrayCount;
+    if (!readValue(f, hasSolution) || !readValue(f, arrayCount) ||
+        arrayCount > (end - ftell(f)) / sizeof(uint32_t)) {
+      success = false;
+      break;
+    }
+
+    entry.validity = IncompleteSolver::None;
+    entry.hasSolution = hasSolution;
+    entry.values.resize(arrayCount);
+    for (unsigned i = 0; success && i < arrayCount; ++i) {
+      uint32_t size;
+      if (!readValue(f, size) || size > end - ftell(f)) {
+        success = false;
+        break;
+      }
+      entry.values[i].resize(size);
+      if (size && fread(&entry.values[i][0], size, 1, f) != 1)
+        success = false;
+    }
+    if (!success)
+      break;
+
+    cexEntries[key] = entry;
+  }
+
+  fclose(f);
+
+  for (entries_ty::const_iterator it = validityEntries.begin(),
+         ie = validityEntries.end(); it != ie; ++it)
+    totalSize += it->second.getSize();
+  for (entries_ty::const_iterator it = cexEntries.begin(),
+         ie = cexEntries.end(); it != ie; ++it)
+    totalSize += it->second.getSize();
+  evict();
+
+  // Entries used in this run are newer than all the loaded ones
+  generation = fileGeneration + 1;
+  return success;
+}
+
+void PersistentSolverCache::touch(Entry &entry, bool isNew) {
+  if (!isNew)
+    totalSize -= entry.getSize();
+  entry.generation = generation;
+  entry.lastUse = ++useCount;
+}
+
+void PersistentSolverCache::evict() {
+  uint64_t maxSize = (uint64_t) SolverCacheMaxSize << 20;
+  if (totalSize <= maxSize)
+    return;
+
+  // Go well below the limit, so that the entries are not sorted again on
+  // every insertion
+  typedef std::pair<Age, entries_ty::iterator> SortedEntry;
+  std::vector<SortedEntry> sorted;
+  for (entries_ty::iterator it = validityEntries.begin(),
+         ie = validityEntries.end(); it != ie; ++it)
+    sorted.push_back(std::make_pair(Age(it->second.generation,
+                                        it->second.lastUse), it));
+  for (entries_ty::iterator it = cexEntries.begin(),
+         ie = cexEntries.end(); it != ie; ++it)
+    sorted.push_back(std::make_pair(Age(it->second.generation,
+                                        it->second.lastUse), it));
+  std::sort(sorted.begin(), sorted.end(), NewerFirst());
+
+  while (!sorted.empty() && totalSize > maxSize / 4 * 3) {
+    entries_ty::iterator it = sorted.back().second;
+    sorted.pop_back();
+    totalSize -= it->second.getSize();
+    if (it->second.isCex)
+      cexEntries.erase(it);
+    else
+      validityEntries.erase(it);
+  }
+}
+
+bool PersistentSolverCache::lookupValidity(const Key &key,
+                                           IncompleteSolver::PartialValidity &result) {
+  entries_ty::iterator it = validityEntries.find(key);
+  if (it == validityEntries.end())
+    return false;
+
+  it->second.generation = generation;
+  it->second.lastUse = ++useCount;
+  result = it->second.validity;
+  return true;
+}
+
+void PersistentSolverCache::insertValidity(const Key &key,
+                                           IncompleteSolver::PartialValidity result) {
+  std::pair<entries_ty::iterator, bool> res =
+    validityEntries.insert(std::make_pair(key, Entry()));
+  Entry &entry = res.first->second;
+  touch(entry, res.second);
+  entry.isCex = false;
+  entry.validity = result;
+  entry.hasSolution = false;
+  entry.values.clear();
+
+  totalSize += entry.getSize();
+  evict();
+}
+
+bool PersistentSolverCache::lookupCex(const Key &key,
+                                      const std::vector<const Array*> &arrays,
+                                      Assignment *&result) {
+  entries_ty::iterator it = cexEntries.find(key);
+  if (it == cexEntries.end())
+    return false;
+
+  const Entry &entry = it->second;
+  if (!entry.hasSolution) {
+    result = 0;
+  } else {
+    if (entry.values.size() != arrays.size())
+      return false;
+    for (unsigned i = 0; i < arrays.size(); ++i) {
+      if (entry.values[i].size() != arrays[i]->size)
+        return false;
+    }
+
+    result = new Assignment();
+    for (unsigned i = 0; i < arrays.size(); ++i)
+      result->bindings.insert(std::make_pair(arrays[i], entry.values[i]));
+  }
+
+  it->second.generation = generation;
+  it->second.lastUse = ++useCount;
+  return true;
+}
+
+void PersistentSolverCache::insertCex(const Key &key,
+                                      const std::vector<const Array*> &arrays,
+                                      const Assignment *result) {
+  std::pair<entries_ty::iterator, bool> res =
+    cexEntries.insert(std::make_pair(key, Entry()));
+  Entry &entry = res.first->second;
+  touch(entry, res.second);
+  entry.isCex = true;
+  entry.validity = IncompleteSolver::None;
+  entry.hasSolution = result != 0;
+  entry.values.clear();
+
+  if (result) {
+    entry.values.resize(arrays.size());
+    for (unsigned i = 0; i < arrays.size(); ++i) {
+      Assignment::bindings_ty::const_iterator it =
+        result->bindings.find(arrays[i]);
+      if (it == result->bindings.end())
+        entry.values[i] = std::vector<unsigned char>(arrays[i]->size, 0);
+      else
+        entry.values[i] = it->second;
+    }
+  }
+
+  totalSize += entry.getSize();
+  evict();
+}
+
+bool PersistentSolverCache::save(const std::string &path) {
+  // Sort all the entries from the most to the least recently used
+  typedef std::pair<Age, entries_ty::const_iterator> SortedEntry;
+  std::vector<SortedEntry> sorted;
+  for (entries_ty::const_iterator it = validityEntries.begin(),
+         ie = validityEntries.end(); it != ie; ++it)
+    sorted.push_back(std::make_pair(Age(it->second.generation,
+                                        it->second.lastUse), it));
+  for (entries_ty::const_iterator it = cexEntries.begin(),
+         ie = cexEntries.end(); it != ie; ++it)
+    sorted.push_back(std::make_pair(Age(it->second.generation,
+                                        it->second.lastUse), it));
+  std::sort(sorted.begin(), sorted.end(), NewerFirst());
+
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f)
+    return false;
+
+  bool success = fwrite(Magic, sizeof(Magic), 1, f) == 1 &&
+                 writeValue(f, generation);
+
+  uint64_t maxSize = (uint64_t) SolverCacheMaxSize << 20;
+  uint64_t size = sizeof(Magic) + sizeof(generation);
+  for (unsigned i = 0; success && i < sorted.size(); ++i) {
+    const Key &key = sorted[i].second->first;
+    const Entry &entry = sorted[i].second->second;
+
+    size += entry.getSize();
+    if (size > maxSize)
+      break;
+
+    uint8_t kind = entry.isCex ? CexEntry : ValidityEntry;
+    success = writeValue(f, kind) &&
+              writeValue(f, key.first) && writeValue(f, key.second) &&
+              writeValue(f, entry.generation);
+    if (!success)
+      break;
+
+    if (!entry.isCex) {
+      int8_t validity = entry.validity;
+      success = writeValue(f, validity);
+      continue;
+    }
+
+    uint8_t hasSolution = entry.hasSolution;
+    uint32_t arrayCount = entry.values.size();
+    success = writeValue(f, hasSolution) && writeValue(f, arrayCount);
+    for (unsigned j = 0; success && j < arrayCount; ++j) {
+      uint32_t valueSize = entry.values[j].size();
+      success = writeValue(f, valueSize) &&
+                (!valueSize ||
+                 fwrite(&entry.values[j][0], valueSize, 1, f) == 1);
+    }
+  }
+
+  if (fclose(f))
+    success = false;
+  return success;
+}
+
+bool klee::saveSolverCache(const std::string &path) {
+  PersistentSolverCache *cache = PersistentSolverCache::get();
+  if (!cache || !SaveSolverCache)
+    return true;
+  return cache->save(path);
+}
@@ -0,0 +1,98 @@
+//===-- PersistentSolverCache.h ---------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __UTIL_PERSISTENTSOLVERCACHE_H__
+#define __UTIL_PERSISTENTSOLVERCACHE_H__
+
+#include "klee/IncompleteSolver.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+namespace klee {
+  class Array;
+  class Assignment;
+
+  /// Results of the caching solvers that are saved at the end of a run and
+  /// loaded at the start of the next one.
+  ///
+  /// Queries are identified by hashExprsUpToRenaming(), so that they match
+  /// even if the arrays of the new run have different names. Validity
+  /// results and unsatisfiable queries are trusted on the key alone, a
+  /// collision would make them wrong.
+  /// Counterexamples are stored for the arrays in the order in which the
+  /// hash numbered them.
+  class PersistentSolverCache {
+  public:
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+  private:
+    struct Entry {
+      /// Run in which the entry was last used, for the eviction
+      uint32_t generation;
+      /// Order of the last use in this run, not saved
+      uint64_t lastUse;
+
+      bool isCex;
+      IncompleteSolver::PartialValidity validity;
+      bool hasSolution;
+      std::vector< std::vector<unsigned char> > values;
+
+      /// Size of the entry in the file
+      uint64_t getSize() const;
+    };
+
+    typedef std::map<Key, Entry> entries_ty;
+
+    entries_ty validityEntries;
+    entries_ty cexEntries;
+    uint32_t generation;
+    uint64_t useCount;
+
+    /// Size of all the entries in the file
+    uint64_t totalSize;
+
+    PersistentSolverCache() : generation(1), useCount(0), totalSize(0) {}
+
+    bool load(const std::string &path);
+
+    /// Prepares entry to be overwritten by an insertion
+    void touch(Entry &entry, bool isNew);
+    /// Drops the least recently used entries when the cache is larger than
+    /// the configured size
+    void evict();
+
+  public:
+    /// Returns the cache, or null if the run neither loads nor saves one
+    static PersistentSolverCache *get();
+
+    bool lookupValidity(const Key &key,
+                        IncompleteSolver::PartialValidity &result);
+    void insertValidity(const Key &key,
+                        IncompleteSolver::PartialValidity result);
+
+    /// Looks up the counterexample of a query whose arrays are, in hash
+    /// order, arrays. On success, result is null for an unsatisfiable query
+    /// and a new assignment owned by the caller otherwise.
+    bool lookupCex(const Key &key, const std::vector<const Array*> &arrays,
+                   Assignment *&result);
+    void insertCex(const Key &key, const std::vector<const Array*> &arrays,
+                   const Assignment *result);
+
+    /// Writes the most recently used entries to path, keeping the file
+    /// under the configured size.
+    bool save(const std::string &path);
+  };
+}
+
+#endif
@@ -0,0 +1,478 @@
+//===-- QueryLog.cpp ------------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/Support/QueryLog.h"
+
+#include "klee/Constraints.h"
+#include "klee/ExprBuilder.h"
+#include "klee/Solver.h"
+
+#include <cstring>
+
+using namespace klee;
+using namespace llvm;
+
+namespace {
+  const char Magic[8] = { 'K', 'Q', 'L', 'O', 'G', '0', '0', '1' };
+
+  enum RecordTag {
+    ArrayRecord = 1,
+    UpdateRecord,
+    ExprRecord,
+    QueryRecord,
+    ResetRecord
+  };
+
+  /// Number of expressions after which the writer starts new tables
+  const unsigned MaxTableSize = 1 << 20;
+}
+
+QueryLogEntry::QueryLogEntry(const QueryLogEntry &b)
+  : exprs(b.exprs),
+    type(b.type),
+    query(b.query),
+    instruction(b.instruction),
+    objects(b.objects) {
+}
+
+QueryLogEntry::QueryLogEntry(const Query &_query,
+                             Type _type,
+                             const std::vector<const Array*> *_objects)
+  : exprs(_query.constraints.begin(), _query.constraints.end()),
+    type(_type),
+    query(_query.expr),
+    instruction(0) {
+  if (_objects)
+    objects = *_objects;
+}
+
+///
+
+QueryLogWriter::QueryLogWriter(const std::string &path)
+  : f(fopen(path.c_str(), "wb")),
+    nextExprId(1), nextUpdateId(1), nextArrayId(1) {
+  if (f)
+    fwrite(Magic, sizeof(Magic), 1, f);
+}
+
+QueryLogWriter::~QueryLogWriter() {
+  if (f)
+    fclose(f);
+}
+
+void QueryLogWriter::writeNumber(uint64_t value) {
+  do {
+    unsigned char byte = value & 0x7f;
+    value >>= 7;
+    buffer.push_back(value ? byte | 0x80 : byte);
+  } while (value);
+}
+
+void QueryLogWriter::writeBytes(const void *data, unsigned size) {
+  const unsigned char *bytes = (const unsigned char*) data;
+  buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+unsigned QueryLogWriter::writeArray(const Array *array) {
+  std::map<const Array*, unsigned>::iterator it = arrayIds.find(array);
+  if (it != arrayIds.end())
+    return it->second;
+
+  buffer.push_back(ArrayRecord);
+  writeNumber(array->name.size());
+  writeBytes(array->name.data(), array->name.size());
+  writeNumber(array->size);
+  writeNumber(array->constantValues.size());
+  for (unsigned i = 0; i < array->constantValues.size(); ++i)
+    writeNumber(array->constantValues[i]->getZExtValue(8));
+
+  unsigned id = nextArrayId++;
+  arrayIds.insert(std::make_pair(array, id));
+  return id;
+}
+
+unsigned QueryLogWriter::writeUpdates(const UpdateList &updates) {
+  // Find the updates that were not written yet, and write them from the
+  // oldest one so that each refers to a known predecessor. This is not
+  // recursive because update lists can be very long.
+  std::vector<const UpdateNode*> pending;
+  unsigned nextId = 0;
+  for (const UpdateNode *un = updates.head; un; un = un->next) {
+    std::map<const UpdateNode*, unsigned>::iterator it = updateIds.find(un);
+    if (it != updateIds.end()) {
+      nextId = it->second;
+      break;
+    }
+    pending.push_back(un);
+  }
+
+  for (unsigned i = pending.size(); i != 0; --i) {
+    const UpdateNode *un = pending[i - 1];
+    unsigned index = writeExpr(un->index);
+    unsigned value = writeExpr(un->value);
+
+    buffer.push_back(UpdateRecord);
+    writeNumber(nextId);
+    writeNumber(index);
+    writeNumber(value);
+
+    nextId = nextUpdateId++;
+    updateIds.insert(std::make_pair(un, nextId));
+    updateLists.push_back(UpdateList(updates.root, un));
+  }
+
+  return nextId;
+}
+
+unsigned QueryLogWriter::writeExpr(const ref<Expr> &e) {
+  ExprHashMap<unsigned>::iterator it = exprIds.find(e);
+  if (it != exprIds.end())
+    return it->second;
+
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(e)) {
+    const APInt &value = CE->getAPValue();
+    buffer.push_back(ExprRecord);
+    writeNumber(Expr::Constant);
+    writeNumber(CE->getWidth());
+    for (unsigned i = 0; i < value.getNumWords(); ++i)
+      writeNumber(value.getRawData()[i]);
+  } else if (ReadExpr *RE = dyn_cast<ReadExpr>(e)) {
+    unsigned array = writeArray(RE->updates.root);
+    unsigned updates = writeUpdates(RE->updates);
+    unsigned index = writeExpr(RE->index);
+    buffer.push_back(ExprRecord);
+    writeNumber(Expr::Read);
+    writeNumber(RE->getWidth());
+    writeNumber(array);
+    writeNumber(updates);
+    writeNumber(index);
+  } else {
+    unsigned kids[3];
+    unsigned numKids = e->getNumKids();
+    assert(numKids <= 3 && "unexpected number of kids");
+    for (unsigned i = 0; i < numKids; ++i)
+      kids[i] = writeExpr(e->getKid(i));
+
+    buffer.push_back(ExprRecord);
+    writeNumber(e->getKind());
+    writeNumber(e->getWidth());
+    writeNumber(numKids);
+    for (unsigned i = 0; i < numKids; ++i)
+      writeNumber(kids[i]);
+    if (ExtractExpr *EE = dyn_cast<ExtractExpr>(e))
+      writeNumber(EE->offset);
+  }
+
+  unsigned id = nextExprId++;
+  exprIds.insert(std::make_pair(e, id));
+  return id;
+}
+
+void QueryLogWriter::reset() {
+  buffer.push_back(ResetRecord);
+  exprIds.clear();
+  updateIds.clear();
+  arrayIds.clear();
+  updateLists.clear();
+  nextExprId = nextUpdateId = nextArrayId = 1;
+}
+
+void QueryLogWriter::write(const QueryLogEntry &entry,
+                           const QueryLogResult &result) {
+  if (!f)
+    return;
+
+  if (exprIds.size() > MaxTableSize)
+    reset();
+
+  std::vector<unsigned> exprs;
+  for (unsigned i = 0; i < entry.exprs.size(); ++i)
+    exprs.push_back(writeExpr(entry.exprs[i]));
+  unsigned query = writeExpr(entry.query);
+  std::vector<unsigned> objects;
+  for (unsigned i = 0; i < entry.objects.size(); ++i)
+    objects.push_back(writeArray(entry.objects[i]));
+
+  buffer.push_back(QueryRecord);
+  writeNumber(entry.type);
+  writeNumber(entry.instruction);
+  writeNumber(exprs.size());
+  for (unsigned i = 0; i < exprs.size(); ++i)
+    writeNumber(exprs[i]);
+  writeNumber(query);
+  writeNumber(objects.size());
+  for (unsigned i = 0; i < objects.size(); ++i)
+    writeNumber(objects[i]);
+  writeNumber(result.result);
+  writeBytes(&result.time, sizeof(result.time));
+
+  fwrite(&buffer[0], buffer.size(), 1, f);
+  fflush(f);
+  buffer.clear();
+}
+
+///
+
+QueryLogReader::QueryLogReader(const char *begin, const char *_end,
+                               ExprBuilder *_builder)
+  : pos((const unsigned char*) begin),
+    end((const unsigned char*) _end),
+    builder(_builder),
+    error(false) {
+  if (end - pos < (long) sizeof(Magic) ||
+      memcmp(pos, Magic, sizeof(Magic))) {
+    error = true;
+    pos = end;
+  } else {
+    pos += sizeof(Magic);
+  }
+}
+
+QueryLogReader::~QueryLogReader() {
+  exprs.clear();
+  updateLists.clear();
+  for (unsigned i = 0; i < ownedArrays.size(); ++i)
+    delete ownedArrays[i];
+}
+
+bool QueryLogReader::readNumber(uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; pos != end && shift < 64; shift += 7) {
+    unsigned char byte = *pos++;
+    value |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool QueryLogReader::readBytes(void *data, unsigned size) {
+  if ((unsigned long) (end - pos) < size)
+    return false;
+  memcpy(data, pos, size);
+  pos += size;
+  return true;
+}
+
+bool QueryLogReader::readExprId(ref<Expr> &e) {
+  uint64_t id;
+  if (!readNumber(id) || id == 0 || id > exprs.size())
+    return false;
+  e = exprs[id - 1];
+  return true;
+}
+
+bool QueryLogReader::readArray() {
+  uint64_t nameSize, size, count;
+  if (!readNumber(nameSize) || (uint64_t) (end - pos) < nameSize)
+    return false;
+  std::string name((const char*) pos, nameSize);
+  pos += nameSize;
+
+  if (!readNumber(size) || !readNumber(count) || (count && count != size))
+    return false;
+
+  std::vector< ref<ConstantExpr> > values;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t value;
+    if (!readNumber(value))
+      return false;
+    values.push_back(ConstantExpr::create(value, Expr::Int8));
+  }
+
+  const Array *array = values.empty() ? new Array(name, size) :
+    new Array(name, size, &values[0], &values[0] + values.size());
+  arrays.push_back(array);
+  ownedArrays.push_back(array);
+  return true;
+}
+
+bool QueryLogReader::readUpdate() {
+  uint64_t next;
+  ref<Expr> index, value;
+  if (!readNumber(next) || next > updateLists.size() ||
+      !readExprId(index) || !readExprId(value))
+    return false;
+
+  // The root is given by the reads that use the updates
+  UpdateList updates(0, next ? updateLists[next - 1].head : 0);
+  updates.extend(index, value);
+  updateLists.push_back(updates);
+  return true;
+}
+
+bool QueryLogReader::readExpr() {
+  uint64_t kind, width;
+  if (!readNumber(kind) || kind > Expr::LastKind ||
+      !readNumber(width) || width == 0)
+    return false;
+
+  if (kind == Expr::Constant) {
+    std::vector<uint64_t> words((width + 63) / 64);
+    for (unsigned i = 0; i < words.size(); ++i) {
+      if (!readNumber(words[i]))
+        return false;
+    }
+    exprs.push_back(builder->Constant(
+      APInt((unsigned) width, (unsigned) words.size(), &words[0])));
+    return true;
+  }
+
+  if (kind == Expr::Read) {
+    uint64_t array, updates;
+    ref<Expr> index;
+    if (!readNumber(array) || array == 0 || array > arrays.size() ||
+        !readNumber(updates) || updates > updateLists.size() ||
+        !readExprId(index))
+      return false;
+
+    UpdateList ul(arrays[array - 1],
+                  updates ? updateLists[updates - 1].head : 0);
+    exprs.push_back(builder->Read(ul, index));
+    return true;
+  }
+
+  uint64_t numKids;
+  ref<Expr> kids[3];
+  if (!readNumber(numKids) || numKids > 3)
+    return false;
+  for (unsigned i = 0; i < numKids; ++i) {
+    if (!readExprId(kids[i]))
+      return false;
+  }
+
+  unsigned expectedKids;
+  switch (kind) {
+  case Expr::Select: expectedKids = 3; break;
+  case Expr::NotOptimized:
+  case Expr::Extract:
+  case Expr::ZExt:
+  case Expr::SExt:
+  case Expr::Not: expectedKids = 1; break;
+  default: expectedKids = 2; break;
+  }
+  if (numKids != expectedKids)
+    return false;
+
+  ref<Expr> e;
+  switch (kind) {
+  case Expr::NotOptimized: e = builder->NotOptimized(kids[0]); break;
+  case Expr::Select: e = builder->Select(kids[0], kids[1], kids[2]); break;
+  case Expr::Concat: e = builder->Concat(kids[0], kids[1]); break;
+  case Expr::Extract: {
+    uint64_t offset;
+    if (!readNumber(offset))
+      return false;
+    e = builder->Extract(kids[0], offset, width);
+    break;
+  }
+  case Expr::ZExt: e = builder->ZExt(kids[0], width); break;
+  case Expr::SExt: e = builder->SExt(kids[0], width); break;
+  case Expr::Not: e = builder->Not(kids[0]); break;
+
+#define BINARY_EXPR_CASE(T) \
+  case Expr::T: e = builder->T(kids[0], kids[1]); break;
+
+  BINARY_EXPR_CASE(Add);
+  BINARY_EXPR_CASE(Sub);
+  BINARY_EXPR_CASE(Mul);
+  BINARY_EXPR_CASE(UDiv);
+  BINARY_EXPR_CASE(SDiv);
+  BINARY_EXPR_CASE(URem);
+  BINARY_EXPR_CASE(SRem);
+  BINARY_EXPR_CASE(And);
+  BINARY_EXPR_CASE(Or);
+  BINARY_EXPR_CASE(Xor);
+  BINARY_EXPR_CASE(Shl);
+  BINARY_EXPR_CASE(LShr);
+  BINARY_EXPR_CASE(AShr);
+  BINARY_EXPR_CASE(Eq);
+  BINARY_EXPR_CASE(Ne);
+  BINARY_EXPR_CASE(Ult);
+  BINARY_EXPR_CASE(Ule);
+  BINARY_EXPR_CASE(Ugt);
+  BINARY_EXPR_CASE(Uge);
+  BINARY_EXPR_CASE(Slt);
+  BINARY_EXPR_CASE(Sle);
+  BINARY_EXPR_CASE(Sgt);
+  BINARY_EXPR_CASE(Sge);
+#undef BINARY_EXPR_CASE
+
+  default:
+    return false;
+  }
+
+  exprs.push_back(e);
+  return true;
+}
+
+bool QueryLogReader::nextQuery(QueryLogEntry &entry, QueryLogResult &result) {
+  while (pos != end) {
+    unsigned char tag = *pos++;
+    switch (tag) {
+    case ArrayRecord:
+      if (!readArray())
+        break;
+      continue;
+
+    case UpdateRecord:
+      if (!readUpdate())
+        break;
+      continue;
+
+    case ExprRecord:
+      if (!readExpr())
+        break;
+      continue;
+
+    case ResetRecord:
+      exprs.clear();
+      updateLists.clear();
+      arrays.clear();
+      continue;
+
+    case QueryRecord: {
+      uint64_t type, instruction, count;
+      if (!readNumber(type) || type > QueryLogEntry::Cex ||
+          !readNumber(instruction) || !readNumber(count))
+        break;
+
+      entry.type = (QueryLogEntry::Type) type;
+      entry.instruction = instruction;
+      entry.exprs.resize(count);
+      bool valid = true;
+      for (uint64_t i = 0; valid && i < count; ++i)
+        valid = readExprId(entry.exprs[i]);
+      if (!valid || !readExprId(entry.query) || !readNumber(count))
+        break;
+
+      entry.objects.clear();
+      for (uint64_t i = 0; valid && i < count; ++i) {
+        uint64_t array;
+        valid = readNumber(array) && array != 0 && array <= arrays.size();
+        if (valid)
+          entry.objects.push_back(arrays[array - 1]);
+      }
+      if (!valid || !readNumber(result.result) ||
+          !readBytes(&result.time, sizeof(result.time)))
+        break;
+
+      return true;
+    }
+
+    default:
+      break;
+    }
+
+    error = true;
+    pos = end;
+  }
+
+  return false;
+}
@@ -0,0 +1,100 @@
+//===-- QueryLoggingSolver.cpp --------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Common.h"
+#include "klee/Expr.h"
+#include "klee/SolverImpl.h"
+#include "klee/Statistics.h"
+#include "klee/Internal/Support/QueryLog.h"
+#include "klee/Internal/System/Time.h"
+
+using namespace klee;
+using namespace klee::util;
+
+///
+
+/// Forwards all queries to the underlying solver and writes them, with
+/// their results and solving times, to a binary query log. Unlike
+/// PCLoggingSolver, this is cheap enough to leave on during long runs.
+class QueryLoggingSolver : public SolverImpl {
+  Solver *solver;
+  QueryLogWriter writer;
+  double startTime;
+
+  void startQuery() {
+    startTime = getWallTime();
+  }
+
+  void finishQuery(QueryLogEntry &entry, bool success, uint64_t result) {
+    double delta = getWallTime() - startTime;
+    Statistic *S = theStatisticManager->getStatisticByName("Instructions");
+    entry.instruction = S ? S->getValue() : 0;
+    writer.write(entry, QueryLogResult(success, result, delta));
+  }
+
+public:
+  QueryLoggingSolver(Solver *_solver, std::string path)
+    : solver(_solver), writer(path) {
+    if (!writer.isOpen())
+      klee_warning("could not open the query log %s", path.c_str());
+  }
+  ~QueryLoggingSolver() {
+    delete solver;
+  }
+
+  bool computeTruth(const Query& query, bool &isValid) {
+    QueryLogEntry entry(query, QueryLogEntry::Truth);
+    startQuery();
+    bool success = solver->impl->computeTruth(query, isValid);
+    finishQuery(entry, success, success && isValid);
+    return success;
+  }
+
+  bool computeValidity(const Query& query, Solver::Validity &result) {
+    QueryLogEntry entry(query, QueryLogEntry::Validity);
+    startQuery();
+    bool success = solver->impl->computeValidity(query, result);
+    finishQuery(entry, success, success ? (int64_t) result : 0);
+    return success;
+  }
+
+  bool computeValue(const Query& query, ref<Expr> &result) {
+    QueryLogEntry entry(query, QueryLogEntry::Value);
+    startQuery();
+    bool success = solver->impl->computeValue(query, result);
+    uint64_t value = 0;
+    if (success) {
+      ConstantExpr *CE = cast<ConstantExpr>(result);
+      if (CE->getWidth() <= 64)
+        value = CE->getZExtValue();
+    }
+    finishQuery(entry, success, value);
+    return success;
+  }
+
+  bool computeInitialValues(const Query& query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    QueryLogEntry entry(query, QueryLogEntry::Cex, &objects);
+    startQuery();
+    bool success = solver->impl->computeInitialValues(query, objects,
+                                                      values, hasSolution);
+    finishQuery(entry, success, success && hasSolution);
+    return success;
+  }
+};
+
+///
+
+Solver *klee::createQueryLoggingSolver(Solver *_solver, std::string path) {
+  return new Solver(new QueryLoggingSolver(_solver, path));
+}
@@ -13,6 +13,7 @@
 
 #include "klee/SolverStats.h"
 #include "STPBuilder.h"
+#include "SolverWorkerPool.h"
 
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
@@ -46,6 +47,18 @@ namespace {
   llvm::cl::opt<bool>
   ReinstantiateSolver("reinstantiate-solver",
                       llvm::cl::init(false));
+
+  llvm::cl::opt<unsigned>
+  STPWorkers("stp-workers",
+             llvm::cl::desc("Number of STP processes to fork at startup and reuse for "
+                            "all queries (default=0)"),
+             llvm::cl::init(0));
+
+  llvm::cl::opt<bool>
+  STPPortfolio("stp-portfolio",
+               llvm::cl::desc("Send each query to all idle STP workers, each using a "
+                              "different SAT solver, and take the first answer"),
+               llvm::cl::init(false));
 }
 
 /***/
@@ -501,6 +514,24 @@ Solver *klee::createDummySolver() {
 
 /***/
 
+class STPSolverImpl;
+
+/// Solves the queries of the worker processes with the copy of the
+/// STPSolverImpl they inherited when they were forked
+class STPWorkerHandler : public SolverWorkerPool::Handler {
+private:
+  STPSolverImpl *impl;
+
+public:
+  STPWorkerHandler(STPSolverImpl *_impl) : impl(_impl) {}
+
+  void initializeWorker(unsigned index);
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution);
+};
+
 class STPSolverImpl : public SolverImpl {
 private:
   /// The solver we are part of, for access to public information.
@@ -510,6 +541,9 @@ private:
   double timeout;
   bool useForkedSTP;
 
+  STPWorkerHandler workerHandler;
+  SolverWorkerPool *workerPool;
+
   void reinstantiate();
 
 public:
@@ -525,6 +559,9 @@ public:
                             const std::vector<const Array*> &objects,
                             std::vector< std::vector<unsigned char> > &values,
                             bool &hasSolution);
+
+  /// Sets up the copy of this solver inherited by a worker process
+  void initializeWorker(unsigned index);
 };
 
 static unsigned char *shared_memory_ptr;
@@ -541,7 +578,9 @@ STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
     vc(vc_createValidityChecker()),
     builder(new STPBuilder(vc)),
     timeout(0.0),
-    useForkedSTP(_useForkedSTP)
+    useForkedSTP(_useForkedSTP),
+    workerHandler(this),
+    workerPool(0)
 {
   assert(vc && "unable to create validity checker");
   assert(builder && "unable to create STPBuilder");
@@ -563,9 +602,15 @@ STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
     shmctl(shared_memory_id, IPC_RMID, NULL);
 #endif
   }
+
+  // Fork the workers while the process is still small
+  if (STPWorkers)
+    workerPool = new SolverWorkerPool(&workerHandler, STPWorkers,
+                                      shared_memory_size * 16);
 }
 
 STPSolverImpl::~STPSolverImpl() {
+  delete workerPool;
   delete builder;
 
   vc_Destroy(vc);
@@ -589,6 +634,30 @@ void STPSolverImpl::reinstantiate()
     }
 }
 
+void STPSolverImpl::initializeWorker(unsigned index) {
+  // The pool belongs to the parent, workers solve their queries in-process
+  workerPool = 0;
+  useForkedSTP = false;
+
+#ifdef HAVE_EXT_STP
+  if (STPPortfolio) {
+    static const ifaceflag_t satSolvers[] = { MS, SMS, CMS2 };
+    vc_setInterfaceFlags(vc, satSolvers[index % 3], 0);
+  }
+#endif
+}
+
+void STPWorkerHandler::initializeWorker(unsigned index) {
+  impl->initializeWorker(index);
+}
+
+bool STPWorkerHandler::computeInitialValues(const Query &query,
+                                            const std::vector<const Array*> &objects,
+                                            std::vector< std::vector<unsigned char> > &values,
+                                            bool &hasSolution) {
+  return impl->computeInitialValues(query, objects, values, hasSolution);
+}
+
 /***/
 
 STPSolver::STPSolver(bool useForkedSTP)
@@ -829,6 +898,24 @@ STPSolverImpl::computeInitialValues(const Query &query,
                                     bool &hasSolution) {
   TimerStatIncrementer t(stats::queryTime);
 
+  if (workerPool) {
+    SolverWorkerPool::Result res =
+      workerPool->computeInitialValues(query, objects, values, hasSolution,
+                                       timeout, STPPortfolio);
+    if (res != SolverWorkerPool::Unavailable) {
+      ++stats::queries;
+      ++stats::queryCounterexamples;
+      if (res == SolverWorkerPool::Failed)
+        return false;
+
+      if (hasSolution)
+        ++stats::queriesInvalid;
+      else
+        ++stats::queriesValid;
+      return true;
+    }
+  }
+
   reinstantiate();
 
   vc_push(vc);
@@ -21,3 +21,5 @@ Statistic stats::queryConstructTime("QueryConstructTime", "QBtime") ;
 Statistic stats::queryConstructs("QueriesConstructs", "QB");
 Statistic stats::queryCounterexamples("QueriesCEX", "Qcex");
 Statistic stats::queryTime("QueryTime", "Qtime");
+Statistic stats::sharedQueryCacheHits("SharedQueryCacheHits", "QSChits");
+Statistic stats::sharedQueryCacheMisses("SharedQueryCacheMisses", "QSCmisses");
@@ -0,0 +1,477 @@
+//===-- SolverWorkerPool.cpp ----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SolverWorkerPool.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/ExprBuilder.h"
+#include "klee/Solver.h"
+#include "klee/Internal/System/Time.h"
+#include "klee/util/ExprPPrinter.h"
+#include "expr/Parser.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifndef __MINGW32__
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace klee;
+
+namespace {
+  /// Start of the shared memory region of a worker. The query text, and
+  /// then the counterexample, follow it.
+  struct SharedHeader {
+    uint32_t querySize;
+    uint32_t success;
+    uint32_t hasSolution;
+  };
+
+  /// Each query creates new arrays in the worker, so its STP instance only
+  /// grows. Workers are replaced after that many jobs to bound this.
+  const unsigned MaxJobsPerWorker = 1000;
+}
+
+SolverWorkerPool::SolverWorkerPool(Handler *_handler, unsigned workerCount,
+                                   unsigned _sharedSize)
+  : handler(_handler), workers(workerCount), sharedSize(_sharedSize),
+    owner(getpid()) {
+#ifdef __MINGW32__
+  assert(false && "Cannot use solver workers on Windows");
+#else
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    Worker &w = workers[i];
+    w.pid = -1;
+    w.fd = -1;
+    w.busy = false;
+    w.startTime = 0;
+    w.jobs = 0;
+
+    w.shared = (char*) mmap(NULL, sharedSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(w.shared != MAP_FAILED && "mmap failed");
+  }
+
+  for (unsigned i = 0; i < workers.size(); ++i)
+    spawn(i);
+#endif
+}
+
+SolverWorkerPool::~SolverWorkerPool() {
+#ifndef __MINGW32__
+  bool owned = isOwner();
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    if (owned)
+      kill(i);
+    else
+      detach(i);
+    munmap(workers[i].shared, sharedSize);
+  }
+#endif
+}
+
+bool SolverWorkerPool::isOwner() const {
+  return getpid() == owner;
+}
+
+#ifndef __MINGW32__
+
+bool SolverWorkerPool::spawn(unsigned index) {
+  Worker &w = workers[index];
+  assert(w.pid == -1 && w.fd == -1);
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    perror("socketpair() for solver worker");
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  sigset_t sig_mask, sig_mask_old;
+  sigfillset(&sig_mask);
+  sigemptyset(&sig_mask_old);
+  sigprocmask(SIG_SETMASK, &sig_mask, &sig_mask_old);
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+    perror("fork() for solver worker");
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+#ifdef __linux__
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+    sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+
+    // Keep only our own channel, so that the other workers see the
+    // parent go away.
+    close(fds[0]);
+    for (unsigned i = 0; i < workers.size(); ++i) {
+      if (workers[i].fd != -1)
+        close(workers[i].fd);
+    }
+
+    runWorker(index, fds[1]);
+  }
+
+  sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+  close(fds[1]);
+
+  w.pid = pid;
+  w.fd = fds[0];
+  w.busy = false;
+  w.jobs = 0;
+  return true;
+}
+
+void SolverWorkerPool::kill(unsigned index) {
+  Worker &w = workers[index];
+
+  if (w.fd != -1)
+    close(w.fd);
+
+  if (w.pid != -1) {
+    ::kill(w.pid, SIGKILL);
+    while (waitpid(w.pid, NULL, 0) < 0 && errno == EINTR)
+      ;
+  }
+
+  w.pid = -1;
+  w.fd = -1;
+  w.busy = false;
+}
+
+void SolverWorkerPool::detach(unsigned index) {
+  Worker &w = workers[index];
+
+  // The owner keeps its own copy of the channel open
+  if (w.fd != -1)
+    close(w.fd);
+
+  w.pid = -1;
+  w.fd = -1;
+  w.busy = false;
+}
+
+void SolverWorkerPool::respawn(unsigned index) {
+  kill(index);
+  spawn(index);
+}
+
+void SolverWorkerPool::runWorker(unsigned index, int fd) {
+  SharedHeader *header = (SharedHeader*) workers[index].shared;
+
+  handler->initializeWorker(index);
+
+  for (;;) {
+    char c;
+    ssize_t res = recv(fd, &c, 1, 0);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res != 1)
+      break;
+
+    header->success = handleQuery(index);
+
+    if (send(fd, &c, 1, MSG_NOSIGNAL) != 1)
+      break;
+  }
+
+  _exit(0);
+}
+
+bool SolverWorkerPool::handleQuery(unsigned index) {
+  SharedHeader *header = (SharedHeader*) workers[index].shared;
+  char *data = (char*) (header + 1);
+
+  llvm::MemoryBuffer *MB = llvm::MemoryBuffer::getMemBuffer(
+      llvm::StringRef(data, header->querySize), "solver-worker-query");
+  ExprBuilder *builder = createDefaultExprBuilder();
+  expr::Parser *P = expr::Parser::Create("solver-worker-query", MB, builder);
+
+  std::vector<expr::Decl*> decls;
+  expr::QueryCommand *QC = 0;
+  while (expr::Decl *D = P->ParseTopLevelDecl()) {
+    decls.push_back(D);
+    if (expr::QueryCommand *qc = dyn_cast<expr::QueryCommand>(D))
+      QC = qc;
+  }
+
+  bool success = false;
+  if (QC && !P->GetNumErrors()) {
+    ConstraintManager constraints(QC->Constraints);
+    std::vector< std::vector<unsigned char> > values;
+    bool hasSolution;
+
+    if (handler->computeInitialValues(Query(constraints, QC->Query),
+                                      QC->Objects, values, hasSolution)) {
+      header->hasSolution = hasSolution;
+      if (hasSolution) {
+        char *pos = data;
+        for (unsigned i = 0; i < values.size(); ++i)
+          pos = std::copy(values[i].begin(), values[i].end(), pos);
+      }
+      success = true;
+    }
+  }
+
+  for (unsigned i = 0; i < decls.size(); ++i)
+    delete decls[i];
+  delete P;
+  delete builder;
+  delete MB;
+
+  return success;
+}
+
+void SolverWorkerPool::reapIdle(double timeout) {
+  double now = util::getWallTime();
+
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    Worker &w = workers[i];
+
+    if (w.pid == -1) {
+      spawn(i);
+      continue;
+    }
+
+    if (w.busy) {
+      struct pollfd pfd = { w.fd, POLLIN, 0 };
+      if (poll(&pfd, 1, 0) > 0) {
+        char c;
+        if (recv(w.fd, &c, 1, 0) == 1) {
+          w.busy = false;
+        } else {
+          respawn(i);
+          continue;
+        }
+      } else if (timeout && now - w.startTime > timeout) {
+        respawn(i);
+        continue;
+      }
+    }
+
+    if (!w.busy && w.jobs >= MaxJobsPerWorker)
+      respawn(i);
+  }
+}
+
+bool SolverWorkerPool::waitForIdle(double timeout) {
+  for (;;) {
+    reapIdle(timeout);
+
+    std::vector<struct pollfd> fds;
+    double earliestStart = 0;
+    for (unsigned i = 0; i < workers.size(); ++i) {
+      const Worker &w = workers[i];
+      if (w.pid == -1)
+        continue;
+      if (!w.busy)
+        return true;
+
+      struct pollfd pfd = { w.fd, POLLIN, 0 };
+      fds.push_back(pfd);
+      if (!earliestStart || w.startTime < earliestStart)
+        earliestStart = w.startTime;
+    }
+
+    if (fds.empty())
+      return false;
+
+    int ms = -1;
+    if (timeout) {
+      double left = earliestStart + timeout - util::getWallTime();
+      ms = std::max(0, (int) (left * 1000) + 1);
+    }
+
+    if (poll(&fds[0], fds.size(), ms) < 0 && errno != EINTR) {
+      perror("poll() for solver workers");
+      return false;
+    }
+  }
+}
+
+SolverWorkerPool::Result
+SolverWorkerPool::computeInitialValues(const Query &query,
+                                       const std::vector<const Array*> &objects,
+                                       std::vector< std::vector<unsigned char> > &values,
+                                       bool &hasSolution,
+                                       double timeout, bool portfolio) {
+  // Another process would race with the owner for the same workers
+  if (!isOwner())
+    return Unavailable;
+
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  const Array * const *objectsBegin = objects.empty() ? 0 : &objects[0];
+  ExprPPrinter::printQuery(os, query.constraints, query.expr, 0, 0,
+                           objectsBegin, objectsBegin + objects.size());
+  os.flush();
+
+  unsigned resultSize = 0;
+  for (unsigned i = 0; i < objects.size(); ++i)
+    resultSize += objects[i]->size;
+
+  // The parser needs the text to be null terminated
+  if (sizeof(SharedHeader) + std::max<size_t>(text.size() + 1, resultSize)
+      > sharedSize)
+    return Unavailable;
+
+  if (!waitForIdle(timeout))
+    return Failed;
+
+  double start = util::getWallTime();
+  std::vector<unsigned> running;
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    Worker &w = workers[i];
+    if (w.pid == -1 || w.busy)
+      continue;
+
+    SharedHeader *header = (SharedHeader*) w.shared;
+    header->querySize = text.size();
+    header->success = 0;
+    std::copy(text.c_str(), text.c_str() + text.size() + 1,
+              (char*) (header + 1));
+
+    char c = 0;
+    if (send(w.fd, &c, 1, MSG_NOSIGNAL) != 1) {
+      respawn(i);
+      continue;
+    }
+
+    w.busy = true;
+    w.startTime = start;
+    ++w.jobs;
+    running.push_back(i);
+
+    if (!portfolio)
+      break;
+  }
+
+  while (!running.empty()) {
+    std::vector<struct pollfd> fds;
+    for (unsigned i = 0; i < running.size(); ++i) {
+      struct pollfd pfd = { workers[running[i]].fd, POLLIN, 0 };
+      fds.push_back(pfd);
+    }
+
+    int ms = -1;
+    if (timeout) {
+      double left = start + timeout - util::getWallTime();
+      ms = std::max(0, (int) (left * 1000));
+    }
+
+    int ready = poll(&fds[0], fds.size(), ms);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll() for solver workers");
+      return Failed;
+    }
+
+    if (ready == 0) {
+      for (unsigned i = 0; i < running.size(); ++i)
+        respawn(running[i]);
+      fprintf(stderr, "error: solver workers timed out\n");
+      return Failed;
+    }
+
+    std::vector<unsigned> stillRunning;
+    for (unsigned i = 0; i < running.size(); ++i) {
+      Worker &w = workers[running[i]];
+      if (!fds[i].revents) {
+        stillRunning.push_back(running[i]);
+        continue;
+      }
+
+      char c;
+      if (recv(w.fd, &c, 1, 0) != 1) {
+        respawn(running[i]);
+        continue;
+      }
+      w.busy = false;
+
+      const SharedHeader *header = (const SharedHeader*) w.shared;
+      if (!header->success)
+        continue;
+
+      // Restart the workers that lost the race, the next query would have
+      // to wait for them otherwise
+      for (unsigned j = 0; j < running.size(); ++j)
+        if (workers[running[j]].busy)
+          respawn(running[j]);
+
+      hasSolution = header->hasSolution;
+      values.clear();
+      if (hasSolution) {
+        const unsigned char *pos = (const unsigned char*) (header + 1);
+        for (unsigned j = 0; j < objects.size(); ++j) {
+          values.push_back(std::vector<unsigned char>(pos, pos + objects[j]->size));
+          pos += objects[j]->size;
+        }
+      }
+      return Solved;
+    }
+    running.swap(stillRunning);
+  }
+
+  return Failed;
+}
+
+#else
+
+bool SolverWorkerPool::spawn(unsigned index) { return false; }
+void SolverWorkerPool::kill(unsigned index) {}
+void SolverWorkerPool::detach(unsigned index) {}
+void SolverWorkerPool::respawn(unsigned index) {}
+void SolverWorkerPool::runWorker(unsigned index, int fd) {}
+bool SolverWorkerPool::handleQuery(unsigned index) { return false; }
+void SolverWorkerPool::reapIdle(double timeout) {}
+bool SolverWorkerPool::waitForIdle(double timeout) { return false; }
+
+SolverWorkerPool::Result
+SolverWorkerPool::computeInitialValues(const Query &query,
+                                       const std::vector<const Array*> &objects,
+                                       std::vector< std::vector<unsigned char> > &values,
+                                       bool &hasSolution,
+                                       double timeout, bool portfolio) {
+  return Unavailable;
+}
+
+#endif
@@ -0,0 +1,105 @@
+//===-- SolverWorkerPool.h --------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __UTIL_SOLVERWORKERPOOL_H__
+#define __UTIL_SOLVERWORKERPOOL_H__
+
+#include <vector>
+
+#include <sys/types.h>
+
+namespace klee {
+  class Array;
+  struct Query;
+
+  /// A set of solver processes that are forked once and then reused for
+  /// all queries. Queries are sent in kquery form through a shared memory
+  /// region per worker, and the counterexamples come back the same way.
+  class SolverWorkerPool {
+  public:
+    /// Code run inside the worker processes
+    class Handler {
+    public:
+      virtual ~Handler() {}
+
+      /// Called once in each new worker process, with the index of the
+      /// worker in the pool.
+      virtual void initializeWorker(unsigned index) = 0;
+
+      virtual bool computeInitialValues(const Query &query,
+                                        const std::vector<const Array*> &objects,
+                                        std::vector< std::vector<unsigned char> > &values,
+                                        bool &hasSolution) = 0;
+    };
+
+    enum Result {
+      Solved,
+      Failed,     ///< The workers failed or timed out
+      Unavailable ///< The query does not fit in the shared memory
+    };
+
+  private:
+    struct Worker {
+      pid_t pid;
+      /// Our end of the socket pair used to start jobs and report results
+      int fd;
+      /// The shared memory region that holds the query and the result
+      char *shared;
+      bool busy;
+      double startTime;
+      unsigned jobs;
+    };
+
+    Handler *handler;
+    std::vector<Worker> workers;
+    unsigned sharedSize;
+
+    /// The process that forked the workers. Processes forked from it later
+    /// (e.g., by S2E load balancing) inherit the pool, but the workers are
+    /// not theirs to use or to kill.
+    pid_t owner;
+
+    bool isOwner() const;
+
+    bool spawn(unsigned index);
+    void kill(unsigned index);
+    /// Releases the resources of a worker inherited from the owner,
+    /// without touching the worker process.
+    void detach(unsigned index);
+    void respawn(unsigned index);
+    void runWorker(unsigned index, int fd);
+    bool handleQuery(unsigned index);
+
+    /// Marks the workers that finished a job nobody waits for as idle
+    void reapIdle(double timeout);
+    bool waitForIdle(double timeout);
+
+  public:
+    /// Forks workerCount workers, each with sharedSize bytes of shared
+    /// memory. The handler must stay valid as long as the pool exists.
+    SolverWorkerPool(Handler *handler, unsigned workerCount,
+                     unsigned sharedSize);
+    /// Kills the workers. In a process forked from the owner, only closes
+    /// the inherited channels and unmaps the shared memory.
+    ~SolverWorkerPool();
+
+    /// Solves the query in a worker. Returns Unavailable outside of the
+    /// owner process. In portfolio mode, the query goes to
+    /// all idle workers and the first answer wins; the other workers are
+    /// killed and forked again right away. A timeout of 0 means no
+    /// timeout.
+    Result computeInitialValues(const Query &query,
+                                const std::vector<const Array*> &objects,
+                                std::vector< std::vector<unsigned char> > &values,
+                                bool &hasSolution,
+                                double timeout, bool portfolio);
+  };
+}
+
+#endif
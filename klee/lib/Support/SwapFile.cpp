@@ -0,0 +1,134 @@
+//===-- SwapFile.cpp ------------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/Support/SwapFile.h"
+
+#include <cassert>
+#include <map>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+  std::string pathPrefix = "klee-swap";
+
+  /// File that receives the buffers written by this process
+  int currentFd = -1;
+  off_t currentFileSize = 0;
+  std::multimap<unsigned, off_t> freeSlots;
+
+  /// Number of slots of this process in use in each open file
+  std::map<int, unsigned> fileUsers;
+
+  void closeIfUnused(int fd) {
+    if (fd < 0 || fd == currentFd || fileUsers.count(fd))
+      return;
+#ifndef _WIN32
+    close(fd);
+#endif
+  }
+
+  bool openFile() {
+#ifdef _WIN32
+    return false;
+#else
+    static unsigned fileCount = 0;
+
+    std::stringstream ss;
+    ss << pathPrefix << "-" << getpid() << "-" << fileCount++ << ".bin";
+    std::string fileName = ss.str();
+
+    currentFd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (currentFd < 0)
+      return false;
+
+    // The file goes away when the last process that uses it closes it
+    unlink(fileName.c_str());
+    currentFileSize = 0;
+    freeSlots.clear();
+    return true;
+#endif
+  }
+}
+
+void SwapFile::setPathPrefix(const std::string &prefix) {
+  pathPrefix = prefix;
+}
+
+bool SwapFile::write(const uint8_t *buf, unsigned size, Slot &slot) {
+#ifdef _WIN32
+  return false;
+#else
+  assert(!slot.isUsed());
+  if (currentFd < 0 && !openFile())
+    return false;
+
+  // Reuse the smallest free slot that fits
+  off_t offset;
+  unsigned slotSize;
+  std::multimap<unsigned, off_t>::iterator it = freeSlots.lower_bound(size);
+  if (it != freeSlots.end()) {
+    slotSize = it->first;
+    offset = it->second;
+    freeSlots.erase(it);
+  } else {
+    slotSize = size;
+    offset = currentFileSize;
+    currentFileSize += slotSize;
+  }
+
+  if (pwrite(currentFd, buf, size, offset) != (ssize_t) size) {
+    freeSlots.insert(std::make_pair(slotSize, offset));
+    return false;
+  }
+
+  slot.fd = currentFd;
+  slot.offset = offset;
+  slot.size = slotSize;
+  ++fileUsers[currentFd];
+  return true;
+#endif
+}
+
+bool SwapFile::read(const Slot &slot, uint8_t *buf, unsigned size) {
+#ifdef _WIN32
+  return false;
+#else
+  assert(slot.isUsed() && size <= slot.size);
+  return pread(slot.fd, buf, size, slot.offset) == (ssize_t) size;
+#endif
+}
+
+void SwapFile::release(Slot &slot) {
+  if (!slot.isUsed())
+    return;
+
+  // Slots of older files may still be used by another process
+  if (slot.fd == currentFd)
+    freeSlots.insert(std::make_pair(slot.size, slot.offset));
+
+  std::map<int, unsigned>::iterator it = fileUsers.find(slot.fd);
+  assert(it != fileUsers.end() && it->second > 0);
+  if (--it->second == 0) {
+    fileUsers.erase(it);
+    closeIfUnused(slot.fd);
+  }
+  slot = Slot();
+}
+
+void SwapFile::reset() {
+  int fd = currentFd;
+  currentFd = -1;
+  currentFileSize = 0;
+  freeSlots.clear();
+  closeIfUnused(fd);
+}
@@ -7,7 +7,11 @@
 #include "klee/Expr.h"
 #include "klee/ExprBuilder.h"
 #include "klee/Solver.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
 #include "klee/Statistics.h"
+#include "klee/Internal/Support/QueryLog.h"
+#include "klee/Internal/System/Time.h"
 #include "klee/util/ExprPPrinter.h"
 #include "klee/util/ExprVisitor.h"
 
@@ -20,6 +24,8 @@
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/system_error.h"
 
+#include <algorithm>
+
 using namespace llvm;
 using namespace klee;
 using namespace klee::expr;
@@ -32,7 +38,8 @@ namespace {
   enum ToolActions {
     PrintTokens,
     PrintAST,
-    Evaluate
+    Evaluate,
+    ReplayLog
   };
 
   static llvm::cl::opt<ToolActions> 
@@ -45,6 +52,9 @@ namespace {
                         "Print parsed AST nodes from the input file."),
              clEnumValN(Evaluate, "evaluate",
                         "Print parsed AST nodes from the input file."),
+             clEnumValN(ReplayLog, "replay-log",
+                        "Run the queries of a binary query log (.qlog) and "
+                        "print solving time statistics."),
              clEnumValEnd));
 
   enum BuilderKinds {
@@ -77,6 +87,21 @@ namespace {
   cl::opt<bool>
   UseSTPQueryPCLog("use-stp-query-pc-log",
                    cl::init(false));
+
+  cl::opt<bool>
+  UseCexCache("use-cex-cache",
+              cl::desc("Use counterexample caching"),
+              cl::init(false));
+
+  cl::opt<bool>
+  UseCache("use-cache",
+           cl::desc("Use validity caching"),
+           cl::init(false));
+
+  cl::opt<bool>
+  UseIndependentSolver("use-independent-solver",
+                       cl::desc("Use constraint independence"),
+                       cl::init(false));
 }
 
 static std::string escapedString(const char *start, unsigned length) {
@@ -143,6 +168,25 @@ static bool PrintInputAST(const char *Filename,
   return success;
 }
 
+static Solver *createSolverChain() {
+  // FIXME: Support choice of solver.
+  Solver *S, *STP = S = 
+    UseDummySolver ? createDummySolver() : new STPSolver(false);
+  if (UseSTPQueryPCLog)
+    S = createPCLoggingSolver(S, "stp-queries.pc");
+  if (UseFastCexSolver)
+    S = createFastCexSolver(S);
+  if (UseCexCache)
+    S = createCexCachingSolver(S);
+  if (UseCache)
+    S = createCachingSolver(S);
+  if (UseIndependentSolver)
+    S = createIndependentSolver(S);
+  if (0)
+    S = createValidatingSolver(S, STP);
+  return S;
+}
+
 static bool EvaluateInputAST(const char *Filename,
                              const MemoryBuffer *MB,
                              ExprBuilder *Builder) {
@@ -163,18 +207,7 @@ static bool EvaluateInputAST(const char *Filename,
   if (!success)
     return false;
 
-  // FIXME: Support choice of solver.
-  Solver *S, *STP = S = 
-    UseDummySolver ? createDummySolver() : new STPSolver(false);
-  if (UseSTPQueryPCLog)
-    S = createPCLoggingSolver(S, "stp-queries.pc");
-  if (UseFastCexSolver)
-    S = createFastCexSolver(S);
-  //S = createCexCachingSolver(S);
-  //S = createCachingSolver(S);
-  //S = createIndependentSolver(S);
-  if (0)
-    S = createValidatingSolver(S, STP);
+  Solver *S = createSolverChain();
 
   unsigned Index = 0;
   for (std::vector<Decl*>::iterator it = Decls.begin(),
@@ -263,6 +296,123 @@ static bool EvaluateInputAST(const char *Filename,
   return success;
 }
 
+static void PrintHitRate(const char *name, uint64_t hits, uint64_t misses) {
+  if (!hits && !misses)
+    return;
+  std::cout << name << " = " << hits << " / " << (hits + misses)
+            << " (" << (100.0 * hits / (hits + misses)) << "%)\n";
+}
+
+static bool ReplayQueryLog(const char *Filename,
+                           const MemoryBuffer *MB,
+                           ExprBuilder *Builder) {
+  QueryLogReader Reader(MB->getBufferStart(), MB->getBufferEnd(), Builder);
+  Solver *S = createSolverChain();
+
+  std::vector<double> Times;
+  double LoggedTime = 0;
+  unsigned Failures = 0, Mismatches = 0;
+  QueryLogEntry Entry;
+  QueryLogResult Logged;
+  while (Reader.nextQuery(Entry, Logged)) {
+    ConstraintManager Constraints(Entry.exprs);
+    Query Q(Constraints, Entry.query);
+    bool Success = false;
+    uint64_t Result = 0;
+
+    double Start = util::getWallTime();
+    switch (Entry.type) {
+    case QueryLogEntry::Truth: {
+      bool IsValid;
+      Success = S->impl->computeTruth(Q, IsValid);
+      Result = IsValid;
+      break;
+    }
+    case QueryLogEntry::Validity: {
+      Solver::Validity Validity;
+      Success = S->impl->computeValidity(Q, Validity);
+      Result = (int64_t) Validity;
+      break;
+    }
+    case QueryLogEntry::Value: {
+      // Values are not compared, the solver may pick any of them
+      ref<Expr> Value;
+      Success = S->impl->computeValue(Q, Value);
+      break;
+    }
+    case QueryLogEntry::Cex: {
+      std::vector< std::vector<unsigned char> > Values;
+      bool HasSolution;
+      Success = S->impl->computeInitialValues(Q, Entry.objects, Values,
+                                              HasSolution);
+      Result = HasSolution;
+      break;
+    }
+    }
+    Times.push_back(util::getWallTime() - Start);
+
+    if (!Success) {
+      ++Failures;
+    } else if (Logged.time >= 0) {
+      LoggedTime += Logged.time;
+      if (Entry.type != QueryLogEntry::Value && Result != Logged.result) {
+        std::cerr << Filename << ": query " << Times.size() - 1
+                  << ": result differs from the log\n";
+        ++Mismatches;
+      }
+    }
+  }
+
+  delete S;
+
+  if (Reader.hasError()) {
+    std::cerr << Filename << ": malformed query log\n";
+    return false;
+  }
+
+  double Total = 0;
+  for (unsigned i = 0; i < Times.size(); ++i)
+    Total += Times[i];
+  std::sort(Times.begin(), Times.end());
+
+  std::cout << "queries = " << Times.size() << "\n"
+            << "failures = " << Failures << "\n"
+            << "mismatches = " << Mismatches << "\n"
+            << "total time = " << Total << "s"
+            << " (logged: " << LoggedTime << "s)\n";
+  if (!Times.empty()) {
+    const double Percentiles[] = { 0, 0.5, 0.9, 0.99, 1 };
+    const char *Names[] = { "min", "p50", "p90", "p99", "max" };
+    std::cout << "latency:";
+    for (unsigned i = 0; i < 5; ++i) {
+      unsigned Index = (unsigned) (Percentiles[i] * (Times.size() - 1));
+      std::cout << " " << Names[i] << "=" << Times[Index] * 1000 << "ms";
+    }
+    std::cout << "\n";
+
+    // Number of queries per power of ten of the latency
+    const char *Buckets[] = { "<10us", "<100us", "<1ms", "<10ms", "<100ms",
+                              "<1s", ">=1s" };
+    unsigned Counts[7] = { 0 };
+    for (unsigned i = 0; i < Times.size(); ++i) {
+      unsigned Bucket = 0;
+      for (double Limit = 1e-5; Bucket < 6 && Times[i] >= Limit; Limit *= 10)
+        ++Bucket;
+      ++Counts[Bucket];
+    }
+    for (unsigned i = 0; i < 7; ++i)
+      std::cout << "  " << Buckets[i] << "\t" << Counts[i] << "\n";
+  }
+
+  PrintHitRate("query cache hits", stats::queryCacheHits,
+               stats::queryCacheMisses);
+  PrintHitRate("shared query cache hits", stats::sharedQueryCacheHits,
+               stats::sharedQueryCacheMisses);
+  std::cout << "stp queries = " << stats::queries << "\n";
+
+  return !Failures && !Mismatches;
+}
+
 int main(int argc, char **argv) {
   bool success = true;
 
@@ -304,6 +454,10 @@ int main(int argc, char **argv) {
     success = EvaluateInputAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
                                MB.get(), Builder);
     break;
+  case ReplayLog:
+    success = ReplayQueryLog(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
+                             MB.get(), Builder);
+    break;
   default:
     std::cerr << argv[0] << ": error: Unknown program action!\n";
   }
@@ -0,0 +1,139 @@
+//===-- BitArrayTest.cpp --------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "gtest/gtest.h"
+
+#include "klee/util/BitArray.h"
+
+using namespace klee;
+
+namespace {
+
+// Fills the array with runs of set and unset bits of random lengths
+void fillRuns(BitArray &ba, unsigned size, unsigned maxRun) {
+  bool value = true;
+  for (unsigned i = 0; i < size; value = !value) {
+    unsigned run = 1 + rand() % maxRun;
+    for (; run && i < size; --run, ++i)
+      ba.set(i, value);
+  }
+}
+
+bool slowAllOnes(const BitArray &ba, unsigned idx, unsigned count) {
+  for (unsigned i = idx; i < idx + count; ++i)
+    if (!ba.get(i))
+      return false;
+  return true;
+}
+
+bool slowAllZeros(const BitArray &ba, unsigned idx, unsigned count) {
+  for (unsigned i = idx; i < idx + count; ++i)
+    if (ba.get(i))
+      return false;
+  return true;
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+TEST(BitArrayTest, WholeArray) {
+  for (unsigned size = 1; size < 300; ++size) {
+    BitArray ones(size, true), zeros(size, false);
+    EXPECT_TRUE(ones.isAllOnes(size));
+    EXPECT_TRUE(zeros.isAllZeros(size));
+    EXPECT_EQ(size, ones.count(size));
+    EXPECT_EQ(0U, zeros.count(size));
+
+    ones.unset(size - 1);
+    zeros.set(size - 1);
+    EXPECT_FALSE(ones.isAllOnes(size));
+    EXPECT_FALSE(zeros.isAllZeros(size));
+    EXPECT_EQ(size, ones.findFirstSet(size - 1, size));
+    EXPECT_EQ(size - 1, zeros.findFirstSet(0, size));
+  }
+}
+
+TEST(BitArrayTest, Ranges) {
+  const unsigned size = 4096;
+  BitArray ba(size);
+  fillRuns(ba, size, 40);
+
+  for (unsigned i = 0; i < 20000; ++i) {
+    unsigned idx = rand() % size;
+    unsigned count = rand() % (std::min(size - idx, 100U) + 1);
+    EXPECT_EQ(slowAllOnes(ba, idx, count), ba.isRangeAllOnes(idx, count));
+    EXPECT_EQ(slowAllZeros(ba, idx, count), ba.isRangeAllZeros(idx, count));
+
+    unsigned first = idx;
+    while (first < idx + count && !ba.get(first))
+      ++first;
+    EXPECT_EQ(first, ba.findFirstSet(idx, idx + count));
+  }
+
+  unsigned expected = 0;
+  for (unsigned i = 0; i < size; ++i)
+    expected += ba.get(i);
+  EXPECT_EQ(expected, ba.count(size));
+
+  BitArray copy(ba, size);
+  copy.setRange(5, 70);
+  copy.unsetRange(100, 33);
+  for (unsigned i = 0; i < size; ++i) {
+    bool value = (i >= 5 && i < 75) || (ba.get(i) && !(i >= 100 && i < 133));
+    EXPECT_EQ(value, copy.get(i));
+  }
+}
+
+
+// Compares the word-at-a-time checks of 1/2/4/8-byte accesses against
+// the byte-by-byte loop on pages with mixed concrete and symbolic bytes.
+// The timings depend on the machine, so this only runs on request
+// (--gtest_also_run_disabled_tests).
+TEST(BitArrayTest, DISABLED_MixedPageBenchmark) {
+  const unsigned pageSize = 4096, pages = 64, rounds = 200;
+  std::vector<BitArray*> masks;
+  for (unsigned i = 0; i < pages; ++i) {
+    masks.push_back(new BitArray(pageSize, true));
+    fillRuns(*masks.back(), pageSize, 1 + i * 8);
+  }
+
+  unsigned slowHits = 0, fastHits = 0;
+
+  double start = now();
+  for (unsigned r = 0; r < rounds; ++r)
+    for (unsigned p = 0; p < pages; ++p)
+      for (unsigned size = 1; size <= 8; size *= 2)
+        for (unsigned offset = 0; offset + size <= pageSize; offset += size)
+          slowHits += slowAllOnes(*masks[p], offset, size);
+  double slow = now() - start;
+
+  start = now();
+  for (unsigned r = 0; r < rounds; ++r)
+    for (unsigned p = 0; p < pages; ++p)
+      for (unsigned size = 1; size <= 8; size *= 2)
+        for (unsigned offset = 0; offset + size <= pageSize; offset += size)
+          fastHits += masks[p]->isRangeAllOnes(offset, size);
+  double fast = now() - start;
+
+  EXPECT_EQ(slowHits, fastHits);
+  std::cout << "byte loop: " << slow << "s, masked compare: " << fast << "s\n";
+
+  for (unsigned i = 0; i < pages; ++i)
+    delete masks[i];
+}
+
+}
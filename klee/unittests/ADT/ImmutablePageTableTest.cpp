@@ -0,0 +1,91 @@
+//===-- ImmutablePageTableTest.cpp ----------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Internal/ADT/ImmutablePageTable.h"
+
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+TEST(ImmutablePageTableTest, LookupSet) {
+  ImmutablePageTable<unsigned, 2> table(10);
+
+  EXPECT_EQ(0U, table.lookup(0));
+  EXPECT_EQ(0U, table.lookup(1023));
+
+  for (unsigned i = 0; i < 1024; i += 3)
+    table.set(i, i + 1);
+
+  for (unsigned i = 0; i < 1024; ++i)
+    EXPECT_EQ(i % 3 ? 0 : i + 1, table.lookup(i));
+}
+
+TEST(ImmutablePageTableTest, CopiesAreIndependent) {
+  ImmutablePageTable<unsigned, 2> a(10);
+  for (unsigned i = 0; i < 1024; ++i)
+    a.set(i, 1);
+
+  ImmutablePageTable<unsigned, 2> b(a);
+  b.set(5, 2);
+  a.set(1000, 3);
+
+  EXPECT_EQ(1U, a.lookup(5));
+  EXPECT_EQ(2U, b.lookup(5));
+  EXPECT_EQ(3U, a.lookup(1000));
+  EXPECT_EQ(1U, b.lookup(1000));
+
+  a = b;
+  EXPECT_EQ(2U, a.lookup(5));
+  EXPECT_EQ(1U, a.lookup(1000));
+}
+
+struct Differences {
+  std::vector<uint64_t> keys;
+
+  void operator()(uint64_t key, unsigned a, unsigned b) {
+    EXPECT_NE(a, b);
+    keys.push_back(key);
+  }
+};
+
+TEST(ImmutablePageTableTest, Compare) {
+  ImmutablePageTable<unsigned, 2> a(10);
+  for (unsigned i = 0; i < 1024; ++i)
+    a.set(i, 1);
+
+  ImmutablePageTable<unsigned, 2> b(a);
+  b.set(5, 2);
+  b.set(700, 1);
+  a.set(1000, 3);
+  b.set(1023, 4);
+
+  Differences d;
+  a.compare(b, d);
+  ASSERT_EQ(3U, d.keys.size());
+  EXPECT_EQ(5U, d.keys[0]);
+  EXPECT_EQ(1000U, d.keys[1]);
+  EXPECT_EQ(1023U, d.keys[2]);
+
+  Differences none;
+  a.compare(a, none);
+  EXPECT_TRUE(none.keys.empty());
+}
+
+TEST(ImmutablePageTableTest, SingleLevel) {
+  ImmutablePageTable<unsigned, 6> table(4);
+  table.set(15, 7);
+  EXPECT_EQ(7U, table.lookup(15));
+  EXPECT_EQ(0U, table.lookup(14));
+}
+
+}
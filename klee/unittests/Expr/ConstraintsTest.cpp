@@ -0,0 +1,104 @@
+//===-- ConstraintsTest.cpp -----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+
+using namespace klee;
+
+namespace {
+
+ref<Expr> readByte(const Array *array, unsigned index) {
+  return ReadExpr::create(UpdateList(array, 0),
+                          ConstantExpr::create(index, Expr::Int32));
+}
+
+ref<Expr> lessThan(ref<Expr> e, unsigned value) {
+  return UltExpr::create(e, ConstantExpr::create(value, Expr::Int8));
+}
+
+std::vector< ref<Expr> > independent(const ConstraintManager &cm,
+                                     ref<Expr> e) {
+  std::vector< ref<Expr> > result;
+  cm.getIndependentConstraints(e, result);
+  return result;
+}
+
+TEST(ConstraintsTest, IndependentConstraints) {
+  Array *a = new Array("ca", 4);
+  Array *b = new Array("cb", 4);
+  Array *c = new Array("cc", 4);
+
+  ref<Expr> c1 = lessThan(readByte(a, 0), 5);
+  ref<Expr> c2 = UltExpr::create(readByte(b, 0), readByte(b, 1));
+  ref<Expr> c3 = lessThan(readByte(c, 0), 7);
+  ref<Expr> c4 = UltExpr::create(readByte(a, 1), readByte(b, 1));
+
+  ConstraintManager cm;
+  cm.addConstraint(c1);
+  cm.addConstraint(c2);
+
+  // The partition is built on the first query and then kept up to date
+  std::vector< ref<Expr> > result = independent(cm, lessThan(readByte(b, 1), 3));
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c2, result[0]);
+
+  cm.addConstraint(c3);
+  cm.addConstraint(c4);
+
+  result = independent(cm, lessThan(readByte(a, 0), 3));
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c1, result[0]);
+
+  result = independent(cm, lessThan(readByte(b, 0), 3));
+  ASSERT_EQ(2U, result.size());
+  EXPECT_EQ(c2, result[0]);
+  EXPECT_EQ(c4, result[1]);
+
+  EXPECT_TRUE(independent(cm, lessThan(readByte(c, 1), 3)).empty());
+
+  // A read at a symbolic offset depends on all the bytes of the array
+  ConstraintManager copy(cm);
+  ref<Expr> c5 = lessThan(ReadExpr::create(UpdateList(a, 0),
+                                           ZExtExpr::create(readByte(c, 1),
+                                                            Expr::Int32)), 9);
+  cm.addConstraint(c5);
+
+  result = independent(cm, lessThan(readByte(a, 0), 3));
+  ASSERT_EQ(4U, result.size());
+  EXPECT_EQ(c1, result[0]);
+  EXPECT_EQ(c2, result[1]);
+  EXPECT_EQ(c4, result[2]);
+  EXPECT_EQ(c5, result[3]);
+
+  result = independent(cm, lessThan(readByte(c, 0), 3));
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c3, result[0]);
+
+  // Copies do not see the constraints added afterwards
+  result = independent(copy, lessThan(readByte(a, 0), 3));
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c1, result[0]);
+
+  // Copies that add different constraints keep their own groups
+  ref<Expr> c6 = UltExpr::create(readByte(a, 2), readByte(c, 0));
+  copy.addConstraint(c6);
+  result = independent(copy, lessThan(readByte(c, 0), 3));
+  ASSERT_EQ(2U, result.size());
+  EXPECT_EQ(c3, result[0]);
+  EXPECT_EQ(c6, result[1]);
+
+  result = independent(cm, lessThan(readByte(c, 0), 3));
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c3, result[0]);
+}
+
+}
@@ -8,9 +8,12 @@
 //===----------------------------------------------------------------------===//
 
 #include <iostream>
+#include <set>
 #include "gtest/gtest.h"
 
 #include "klee/Expr.h"
+#include "klee/util/Assignment.h"
+#include "klee/util/ExprUtil.h"
 
 using namespace klee;
 
@@ -110,4 +113,244 @@ TEST(ExprTest, ExtractConcat) {
   EXPECT_EQ(Expr::Extract, concat2->getKid(1)->getKind());
 }
 
+TEST(ExprTest, Interning) {
+  Array *array = new Array("arr4", 256);
+  ref<Expr> read32 = Expr::createTempRead(array, 32);
+  ref<Expr> c1 = getConstant(1, 32);
+
+  ref<Expr> add1 = AddExpr::create(read32, c1);
+  ref<Expr> add2 = AddExpr::create(Expr::createTempRead(array, 32),
+                                   getConstant(1, 32));
+  EXPECT_EQ(add1.get(), add2.get());
+  EXPECT_EQ(c1.get(), getConstant(1, 32).get());
+  EXPECT_NE(c1.get(), getConstant(1, 64).get());
+
+  ref<Expr> not1 = NotExpr::create(read32);
+  EXPECT_EQ(not1.get(), NotExpr::create(read32).get());
+
+  // Expressions leave the table when they die, so an expression built
+  // later must not hit a stale entry.
+  unsigned count = Expr::count;
+  {
+    ref<Expr> tmp = MulExpr::create(read32, getConstant(3, 32));
+    EXPECT_EQ(Expr::Mul, tmp->getKind());
+  }
+  EXPECT_EQ(count, Expr::count);
+  ref<Expr> mul = MulExpr::create(read32, getConstant(3, 32));
+  EXPECT_EQ(Expr::Mul, mul->getKind());
+  EXPECT_EQ(read32.get(), mul->getKid(1).get());
+}
+
+TEST(ExprTest, HashUpToRenaming) {
+  Array *a1 = new Array("arr5", 256);
+  Array *b1 = new Array("arr6", 256);
+  Array *a2 = new Array("other5", 256);
+  Array *b2 = new Array("other6", 256);
+
+  std::vector< ref<Expr> > exprs1, exprs2, exprs3;
+  exprs1.push_back(UltExpr::create(Expr::createTempRead(a1, 32),
+                                   Expr::createTempRead(b1, 32)));
+  exprs2.push_back(UltExpr::create(Expr::createTempRead(a2, 32),
+                                   Expr::createTempRead(b2, 32)));
+  exprs3.push_back(SltExpr::create(Expr::createTempRead(a1, 32),
+                                   Expr::createTempRead(b1, 32)));
+
+  uint64_t h1, h2, h3, h4, h5, h6;
+  std::vector<const Array*> arrays1, arrays2, arrays3;
+  hashExprsUpToRenaming(exprs1.begin(), exprs1.end(), h1, h2, arrays1);
+  hashExprsUpToRenaming(exprs2.begin(), exprs2.end(), h3, h4, arrays2);
+  hashExprsUpToRenaming(exprs3.begin(), exprs3.end(), h5, h6, arrays3);
+
+  // The same query on renamed arrays has the same hash
+  EXPECT_EQ(h1, h3);
+  EXPECT_EQ(h2, h4);
+  ASSERT_EQ(2U, arrays2.size());
+  EXPECT_EQ(a2, arrays2[0]);
+  EXPECT_EQ(b2, arrays2[1]);
+
+  // A different comparison is a different query
+  EXPECT_FALSE(h1 == h5 && h2 == h6);
+  EXPECT_EQ(2U, arrays3.size());
+}
+
+ref<Expr> lessThan(const Array *array, unsigned value) {
+  return UltExpr::create(ReadExpr::create(UpdateList(array, 0),
+                                          getConstant(0, 32)),
+                         getConstant(value, 8));
+}
+
+TEST(ExprTest, HashUpToRenamingIgnoresOrder) {
+  Array *a1 = new Array("arr", 4);
+  Array *b1 = new Array("data", 4);
+  Array *a2 = new Array("sym", 4);
+  Array *b2 = new Array("len", 4);
+
+  // Sets are ordered by hash values, which depend on the array names
+  std::set< ref<Expr> > exprs1, exprs2;
+  exprs1.insert(lessThan(a1, 5));
+  exprs1.insert(lessThan(b1, 7));
+  exprs2.insert(lessThan(a2, 5));
+  exprs2.insert(lessThan(b2, 7));
+  ASSERT_NE(*exprs1.begin() == lessThan(a1, 5),
+            *exprs2.begin() == lessThan(a2, 5));
+
+  uint64_t h1, h2, h3, h4;
+  std::vector<const Array*> arrays1, arrays2;
+  hashExprsUpToRenaming(exprs1.begin(), exprs1.end(), h1, h2, arrays1);
+  hashExprsUpToRenaming(exprs2.begin(), exprs2.end(), h3, h4, arrays2);
+
+  EXPECT_EQ(h1, h3);
+  EXPECT_EQ(h2, h4);
+
+  // The arrays are numbered consistently, so cached counterexamples map
+  // to the right arrays
+  ASSERT_EQ(2U, arrays1.size());
+  ASSERT_EQ(2U, arrays2.size());
+  EXPECT_EQ(arrays1[0] == a1, arrays2[0] == a2);
+  EXPECT_EQ(arrays1[1] == b1, arrays2[1] == b2);
+}
+
+ref<Expr> readIndex(const Array *index, unsigned offset) {
+  return ZExtExpr::create(ReadExpr::create(UpdateList(index, 0),
+                                           getConstant(offset, 32)),
+                          Expr::Int32);
+}
+
+/// Reads every byte of both lists back for all the assignments of the two
+/// bytes of \a index to 0..3 and expects the same values
+void expectSameReads(const UpdateList &expected, const UpdateList &actual,
+                     const Array *index) {
+  const Array *root = expected.root;
+  for (unsigned a = 0; a < 4; ++a) {
+    for (unsigned b = 0; b < 4; ++b) {
+      Assignment assignment;
+      std::vector<unsigned char> indexValues;
+      indexValues.push_back(a);
+      indexValues.push_back(b);
+      assignment.add(index, indexValues);
+      if (root->isSymbolicArray()) {
+        std::vector<unsigned char> rootValues;
+        for (unsigned i = 0; i < root->size; ++i)
+          rootValues.push_back(100 + i);
+        assignment.add(root, rootValues);
+      }
+
+      for (unsigned i = 0; i < root->size; ++i) {
+        ref<Expr> e1 = assignment.evaluate(
+            ReadExpr::create(expected, getConstant(i, 32)));
+        ref<Expr> e2 = assignment.evaluate(
+            ReadExpr::create(actual, getConstant(i, 32)));
+        ASSERT_TRUE(isa<ConstantExpr>(e1));
+        ASSERT_TRUE(isa<ConstantExpr>(e2));
+        EXPECT_EQ(cast<ConstantExpr>(e1)->getZExtValue(),
+                  cast<ConstantExpr>(e2)->getZExtValue())
+          << "index " << i << ", assignment " << a << " " << b;
+      }
+    }
+  }
+}
+
+TEST(ExprTest, CompactUpdatesShadowed) {
+  Array *array = new Array("mem", 8);
+  Array *index = new Array("idx", 2);
+  ref<Expr> i0 = readIndex(index, 0);
+  ref<Expr> i1 = readIndex(index, 1);
+
+  UpdateList updates(array, 0);
+  updates.extend(getConstant(1, 32), getConstant(10, 8));
+  updates.extend(i0, getConstant(11, 8));
+  updates.extend(getConstant(2, 32), getConstant(12, 8));
+  updates.extend(i1, getConstant(13, 8));
+  updates.extend(getConstant(1, 32), getConstant(14, 8));
+  updates.extend(i0, getConstant(15, 8));
+  updates.extend(getConstant(3, 32),
+                 ReadExpr::create(UpdateList(index, 0), getConstant(1, 32)));
+
+  // The first two updates are overwritten at the same constant and
+  // symbolic indices
+  UpdateList compacted = compactUpdateList(updates);
+  EXPECT_EQ(array, compacted.root);
+  EXPECT_EQ(5U, compacted.getSize());
+  expectSameReads(updates, compacted, index);
+}
+
+TEST(ExprTest, CompactUpdatesRebasesConstantRoot) {
+  std::vector< ref<ConstantExpr> > values;
+  for (unsigned i = 0; i < 8; ++i)
+    values.push_back(ConstantExpr::create(i, Expr::Int8));
+  Array *array = new Array("const", 8, &values[0], &values[0] + values.size());
+  Array *index = new Array("idx", 2);
+
+  UpdateList updates(array, 0);
+  updates.extend(getConstant(0, 32), getConstant(20, 8));
+  updates.extend(getConstant(1, 32), getConstant(21, 8));
+  updates.extend(getConstant(0, 32), getConstant(22, 8));
+  updates.extend(readIndex(index, 0), getConstant(23, 8));
+  updates.extend(getConstant(1, 32), getConstant(24, 8));
+
+  // The three oldest updates go to the new root, the newer constant
+  // update stays above the symbolic one
+  UpdateList compacted = compactUpdateList(updates);
+  ASSERT_NE(array, compacted.root);
+  EXPECT_TRUE(compacted.root->isConstantArray());
+  EXPECT_EQ(8U, compacted.root->size);
+  EXPECT_EQ(2U, compacted.getSize());
+  expectSameReads(updates, compacted, index);
+
+  // Lists that fold to the same contents share the new root
+  UpdateList copy(array, 0);
+  copy.extend(getConstant(1, 32), getConstant(21, 8));
+  copy.extend(getConstant(0, 32), getConstant(22, 8));
+  copy.extend(readIndex(index, 1), getConstant(25, 8));
+  EXPECT_EQ(compacted.root, compactUpdateList(copy).root);
+}
+
+TEST(ExprTest, CompactUpdatesKeepsLargeConstantRoot) {
+  std::vector< ref<ConstantExpr> > values(256,
+                                          ConstantExpr::create(0, Expr::Int8));
+  Array *array = new Array("large", 256, &values[0],
+                           &values[0] + values.size());
+  Array *index = new Array("idx", 2);
+
+  UpdateList updates(array, 0);
+  updates.extend(getConstant(0, 32), getConstant(40, 8));
+  updates.extend(getConstant(0, 32), getConstant(41, 8));
+  updates.extend(readIndex(index, 0), getConstant(42, 8));
+
+  // A copy of the array would take more memory than the two updates
+  UpdateList compacted = compactUpdateList(updates);
+  EXPECT_EQ(array, compacted.root);
+  EXPECT_EQ(2U, compacted.getSize());
+  expectSameReads(updates, compacted, index);
+}
+
+TEST(ExprTest, CompactUpdatesSharesTail) {
+  Array *array = new Array("mem", 8);
+  Array *index = new Array("idx", 2);
+
+  UpdateList updates(array, 0);
+  updates.extend(getConstant(0, 32), getConstant(30, 8));
+  updates.extend(getConstant(1, 32), getConstant(31, 8));
+  const UpdateNode *tail = updates.head;
+  updates.extend(getConstant(3, 32), getConstant(32, 8));
+  updates.extend(readIndex(index, 0), getConstant(33, 8));
+  updates.extend(getConstant(3, 32), getConstant(34, 8));
+  updates.extend(getConstant(5, 32), getConstant(35, 8));
+
+  // Only the updates above the oldest removed one are replayed
+  UpdateList compacted = compactUpdateList(updates);
+  EXPECT_EQ(array, compacted.root);
+  ASSERT_EQ(5U, compacted.getSize());
+  const UpdateNode *un = compacted.head;
+  for (unsigned i = 0; i < 3; ++i)
+    un = un->next;
+  EXPECT_EQ(tail, un);
+  expectSameReads(updates, compacted, index);
+
+  // Nothing left to remove
+  UpdateList again = compactUpdateList(compacted);
+  EXPECT_EQ(compacted.head, again.head);
+  EXPECT_EQ(compacted.root, again.root);
+}
+
 }
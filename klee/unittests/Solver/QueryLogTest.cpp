@@ -0,0 +1,108 @@
+//===-- QueryLogTest.cpp --------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include "gtest/gtest.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/ExprBuilder.h"
+#include "klee/Solver.h"
+#include "klee/Internal/Support/QueryLog.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+
+std::string toString(const ref<Expr> &e) {
+  std::ostringstream os;
+  os << e;
+  return os.str();
+}
+
+TEST(QueryLogTest, RoundTrip) {
+  ref<ConstantExpr> init[4];
+  for (unsigned i = 0; i < 4; ++i)
+    init[i] = ConstantExpr::create(i + 1, Expr::Int8);
+  Array *table = new Array("table", 4, init, init + 4);
+  Array *input = new Array("input", 4);
+
+  ref<Expr> x = Expr::createTempRead(input, 32);
+  UpdateList updates(table, 0);
+  updates.extend(ConstantExpr::create(1, Expr::Int32),
+                 ReadExpr::create(UpdateList(input, 0),
+                                  ConstantExpr::create(0, Expr::Int32)));
+  ref<Expr> lookup = ReadExpr::create(updates, ExtractExpr::create(x, 0, 32));
+
+  std::vector< ref<Expr> > constraints;
+  constraints.push_back(UltExpr::create(x, ConstantExpr::create(4, Expr::Int32)));
+  ConstraintManager cm(constraints);
+  ref<Expr> query = EqExpr::create(lookup, ConstantExpr::create(3, Expr::Int8));
+
+  char path[] = "/tmp/querylogXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  close(fd);
+
+  std::vector<const Array*> objects(1, input);
+  {
+    QueryLogWriter writer(path);
+    ASSERT_TRUE(writer.isOpen());
+    writer.write(QueryLogEntry(Query(cm, query), QueryLogEntry::Truth),
+                 QueryLogResult(true, 1, 0.5));
+    writer.write(QueryLogEntry(Query(cm, query), QueryLogEntry::Cex, &objects),
+                 QueryLogResult(false, 1, 0.5));
+  }
+
+  std::ifstream is(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(is)),
+                   std::istreambuf_iterator<char>());
+  unlink(path);
+
+  ExprBuilder *builder = createDefaultExprBuilder();
+  QueryLogReader reader(data.data(), data.data() + data.size(), builder);
+  QueryLogEntry entry;
+  QueryLogResult result;
+
+  ASSERT_TRUE(reader.nextQuery(entry, result));
+  EXPECT_EQ(QueryLogEntry::Truth, entry.type);
+  ASSERT_EQ(1U, entry.exprs.size());
+  EXPECT_EQ(toString(constraints[0]), toString(entry.exprs[0]));
+  EXPECT_EQ(toString(query), toString(entry.query));
+  EXPECT_EQ(1U, result.result);
+  EXPECT_EQ(0.5, result.time);
+
+  ASSERT_TRUE(reader.nextQuery(entry, result));
+  EXPECT_EQ(QueryLogEntry::Cex, entry.type);
+  ASSERT_EQ(1U, entry.objects.size());
+  EXPECT_EQ("input", entry.objects[0]->name);
+  EXPECT_EQ(4U, entry.objects[0]->size);
+  EXPECT_EQ(-1, result.time);
+
+  EXPECT_FALSE(reader.nextQuery(entry, result));
+  EXPECT_FALSE(reader.hasError());
+
+  delete builder;
+}
+
+TEST(QueryLogTest, Malformed) {
+  const char data[] = "not a query log";
+  QueryLogReader reader(data, data + sizeof(data), 0);
+  QueryLogEntry entry;
+  QueryLogResult result;
+  EXPECT_FALSE(reader.nextQuery(entry, result));
+  EXPECT_TRUE(reader.hasError());
+}
+
+}
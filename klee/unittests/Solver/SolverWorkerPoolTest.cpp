@@ -0,0 +1,145 @@
+//===-- SolverWorkerPoolTest.cpp ------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/Solver.h"
+#include "../../lib/Solver/SolverWorkerPool.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+
+/// Answers every query with all the bytes set to one plus the index of
+/// the worker
+class ConstantHandler : public SolverWorkerPool::Handler {
+  unsigned value;
+
+public:
+  ConstantHandler() : value(0) {}
+
+  void initializeWorker(unsigned index) {
+    value = index + 1;
+  }
+
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    values.clear();
+    for (unsigned i = 0; i < objects.size(); ++i)
+      values.push_back(std::vector<unsigned char>(objects[i]->size, value));
+    hasSolution = true;
+    return true;
+  }
+};
+
+/// Worker 0 answers the queries on the array named "first" right away and
+/// fails the others. The other workers take 30 seconds on "first" and
+/// answer the others right away.
+class RaceHandler : public SolverWorkerPool::Handler {
+  unsigned index;
+
+public:
+  RaceHandler() : index(0) {}
+
+  void initializeWorker(unsigned index) {
+    this->index = index;
+  }
+
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    bool first = objects[0]->name == "first";
+    if (first != (index == 0)) {
+      if (!first)
+        return false;
+      sleep(30);
+    }
+
+    values.clear();
+    for (unsigned i = 0; i < objects.size(); ++i)
+      values.push_back(std::vector<unsigned char>(objects[i]->size, index + 1));
+    hasSolution = true;
+    return true;
+  }
+};
+
+SolverWorkerPool::Result solve(SolverWorkerPool &pool, const Array *array,
+                               std::vector< std::vector<unsigned char> > &values,
+                               bool portfolio = false) {
+  ConstraintManager constraints;
+  ref<Expr> read = ReadExpr::create(UpdateList(array, 0),
+                                    ConstantExpr::create(0, Expr::Int32));
+  ref<Expr> query = EqExpr::create(read, ConstantExpr::create(0, Expr::Int8));
+  std::vector<const Array*> objects(1, array);
+  bool hasSolution = false;
+  SolverWorkerPool::Result res =
+    pool.computeInitialValues(Query(constraints, query), objects, values,
+                              hasSolution, 5, portfolio);
+  if (res == SolverWorkerPool::Solved && !hasSolution)
+    return SolverWorkerPool::Failed;
+  return res;
+}
+
+TEST(SolverWorkerPoolTest, SurvivesForkedProcesses) {
+  ConstantHandler handler;
+  SolverWorkerPool pool(&handler, 1, 1 << 16);
+  Array *array = new Array("pool", 2);
+  std::vector< std::vector<unsigned char> > values;
+
+  ASSERT_EQ(SolverWorkerPool::Solved, solve(pool, array, values));
+  ASSERT_EQ(1U, values.size());
+  EXPECT_EQ(1, values[0][0]);
+
+  // A forked process (e.g., after S2E load balancing) must neither use
+  // nor kill the workers of its parent when it drops the pool.
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    std::vector< std::vector<unsigned char> > childValues;
+    bool unavailable =
+      solve(pool, array, childValues) == SolverWorkerPool::Unavailable;
+    pool.~SolverWorkerPool();
+    _exit(unavailable ? 0 : 1);
+  }
+
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  values.clear();
+  ASSERT_EQ(SolverWorkerPool::Solved, solve(pool, array, values));
+  ASSERT_EQ(1U, values.size());
+  EXPECT_EQ(1, values[0][0]);
+}
+
+TEST(SolverWorkerPoolTest, PortfolioRestartsLosers) {
+  RaceHandler handler;
+  SolverWorkerPool pool(&handler, 2, 1 << 16);
+  Array *first = new Array("first", 2), *second = new Array("second", 2);
+  std::vector< std::vector<unsigned char> > values;
+
+  ASSERT_EQ(SolverWorkerPool::Solved, solve(pool, first, values, true));
+  EXPECT_EQ(1, values[0][0]);
+
+  // Only worker 1 can answer, it must not be stuck in the previous query
+  values.clear();
+  ASSERT_EQ(SolverWorkerPool::Solved, solve(pool, second, values, true));
+  EXPECT_EQ(2, values[0][0]);
+}
+
+}
@@ -0,0 +1,105 @@
+//===-- SwapFileTest.cpp --------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Internal/Support/SwapFile.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+std::vector<uint8_t> makeBuffer(unsigned size, uint8_t seed) {
+  std::vector<uint8_t> buf(size);
+  for (unsigned i = 0; i < size; ++i)
+    buf[i] = seed + i * 7;
+  return buf;
+}
+
+bool isOpen(int fd) {
+  return fcntl(fd, F_GETFD) != -1;
+}
+
+TEST(SwapFileTest, ReadBack) {
+  SwapFile::setPathPrefix("/tmp/klee-swap-test");
+  std::vector<uint8_t> a = makeBuffer(4096, 1), b = makeBuffer(128, 2);
+  SwapFile::Slot sa, sb;
+  ASSERT_TRUE(SwapFile::write(&a[0], a.size(), sa));
+  ASSERT_TRUE(SwapFile::write(&b[0], b.size(), sb));
+  EXPECT_NE(sa.offset, sb.offset);
+
+  std::vector<uint8_t> out(4096);
+  ASSERT_TRUE(SwapFile::read(sa, &out[0], a.size()));
+  EXPECT_EQ(a, out);
+  out.resize(128);
+  ASSERT_TRUE(SwapFile::read(sb, &out[0], b.size()));
+  EXPECT_EQ(b, out);
+
+  // The released slot is reused for a buffer that fits in it
+  off_t offset = sa.offset;
+  SwapFile::release(sa);
+  EXPECT_FALSE(sa.isUsed());
+  std::vector<uint8_t> c = makeBuffer(1000, 3);
+  SwapFile::Slot sc;
+  ASSERT_TRUE(SwapFile::write(&c[0], c.size(), sc));
+  EXPECT_EQ(offset, sc.offset);
+  out.resize(1000);
+  ASSERT_TRUE(SwapFile::read(sc, &out[0], c.size()));
+  EXPECT_EQ(c, out);
+
+  SwapFile::release(sb);
+  SwapFile::release(sc);
+  SwapFile::reset();
+}
+
+TEST(SwapFileTest, ClosesUnusedFiles) {
+  SwapFile::setPathPrefix("/tmp/klee-swap-test");
+  std::vector<uint8_t> a = makeBuffer(256, 4);
+  SwapFile::Slot old;
+  ASSERT_TRUE(SwapFile::write(&a[0], a.size(), old));
+  int fd = old.fd;
+
+  // A forked process stops writing to the file but can still read it
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    SwapFile::reset();
+    std::vector<uint8_t> out(256);
+    bool ok = SwapFile::read(old, &out[0], out.size()) && out == a;
+    SwapFile::release(old);
+    _exit(ok && !isOpen(fd) ? 0 : 1);
+  }
+
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  SwapFile::reset();
+  SwapFile::Slot fresh;
+  ASSERT_TRUE(SwapFile::write(&a[0], a.size(), fresh));
+  EXPECT_NE(fd, fresh.fd);
+  EXPECT_TRUE(isOpen(fd));
+
+  // The old file goes away with its last slot, the current one stays
+  SwapFile::release(old);
+  EXPECT_FALSE(isOpen(fd));
+  int current = fresh.fd;
+  SwapFile::release(fresh);
+  EXPECT_TRUE(isOpen(current));
+  SwapFile::reset();
+  EXPECT_FALSE(isOpen(current));
+}
+
+}
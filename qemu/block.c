@@ -34,6 +34,7 @@
 
 int g_s2e_linked __attribute__((weak));
 void s2e_bdrv_fail(void) __attribute__((weak));
+void s2e_materialize_host_ram(const void *host_address, uint64_t size) __attribute__((weak));
 
 #ifdef CONFIG_BSD
 #include <sys/types.h>
@@ -1713,6 +1714,21 @@ err:
     return ret;
 }
 
+/* Drivers may hand the buffers to the kernel or to worker threads, which
+   cannot fault in guest memory that S2E restores lazily */
+static void bdrv_materialize_qiov(QEMUIOVector *qiov)
+{
+    int i;
+
+    if (!s2e_materialize_host_ram || !qiov) {
+        return;
+    }
+
+    for (i = 0; i < qiov->niov; i++) {
+        s2e_materialize_host_ram(qiov->iov[i].iov_base, qiov->iov[i].iov_len);
+    }
+}
+
 /*
  * Handle a read request in coroutine context
  */
@@ -1731,6 +1747,8 @@ static int coroutine_fn bdrv_co_do_readv(BlockDriverState *bs,
         return -EIO;
     }
 
+    bdrv_materialize_qiov(qiov);
+
     /* throttling disk read I/O */
     if (bs->io_limits_enabled) {
         bdrv_io_limits_intercept(bs, false, nb_sectors);
@@ -1838,6 +1856,8 @@ static int coroutine_fn bdrv_co_do_writev(BlockDriverState *bs,
         return -EIO;
     }
 
+    bdrv_materialize_qiov(qiov);
+
     /* throttling disk write I/O */
     if (bs->io_limits_enabled) {
         bdrv_io_limits_intercept(bs, true, nb_sectors);
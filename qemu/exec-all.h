@@ -97,6 +97,9 @@ void restore_state_to_opc(CPUArchState *env, struct TranslationBlock *tb,
 #ifdef CONFIG_S2E
 #define INSTRUCTION_SET_ARM 0
 #define INSTRUCTION_SET_THUMB 1
+
+/* Number of TCG globals for which TBs record byte-granular access masks */
+#define S2E_TB_REG_BYTES_COUNT 32
 #endif
 
 #ifdef CONFIG_S2E
@@ -227,6 +230,9 @@ struct TranslationBlock {
     uint64_t reg_rmask; /* Registers that TB reads (before overwritting) */
     uint64_t reg_wmask; /* Registers that TB writes */
     uint64_t helper_accesses_mem; /* True if contains helpers that access mem */
+    uint8_t reg_rbytes[S2E_TB_REG_BYTES_COUNT]; /* Bytes of each register that TB reads */
+    uint8_t reg_wbytes[S2E_TB_REG_BYTES_COUNT]; /* Bytes of each register that TB may change */
+    uint8_t reg_kbytes[S2E_TB_REG_BYTES_COUNT]; /* Bytes that TB overwrites before use */
 
     enum ETranslationBlockType s2e_tb_type;
     struct S2ETranslationBlock* s2e_tb;
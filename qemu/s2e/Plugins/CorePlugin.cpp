@@ -43,6 +43,8 @@ extern "C" {
 extern CPUArchState *env;
 }
 
+#include <tcg-llvm.h>
+
 #include "CorePlugin.h"
 #include <s2e/S2E.h>
 #include <s2e/Utils.h>
@@ -171,6 +173,11 @@ static void s2e_tcg_instrument_code(S2E*, ExecutionSignal* signal, uint64_t pc,
     tcg_gen_movi_i32(TCGV_PTR_TO_NAT(t0), (tcg_target_ulong) signal);
 #endif
 
+    //The signal is allocated anew in every run
+    if (tcg_llvm_ctx) {
+        tcg_llvm_add_relocation(tcg_llvm_ctx, (tcg_target_ulong) signal);
+    }
+
     tcg_gen_movi_i64(t1, pc);
 
     tcg_gen_helperN((void*) s2e_tcg_execution_handler,
@@ -109,31 +109,24 @@ void StateManager::suspendCurrentProcess()
 
     StateManagerShared *shared = m_shared.acquire();
     shared->suspendedProcesses[currentProcessId] = true;
-    m_shared.release();
 
     while(true) {
-        shared = m_shared.tryAcquire();
-        if (shared) {
-            //Somebody woke us up
-            if (!shared->suspendedProcesses[currentProcessId]) {
-                m_shared.release();
-                return;
-            }
+        //Somebody woke us up
+        if (!shared->suspendedProcesses[currentProcessId]) {
+            m_shared.release();
+            return;
+        }
 
-            //There are no more active processes in the system,
-            if (getSuspendedProcessCount() == s2e()->getCurrentProcessCount()) {
-                resumeAllProcesses();
-                killAllButOneSuccessful();
-                m_shared.release();
-                return;
-            }
+        //There are no more active processes in the system,
+        if (getSuspendedProcessCount() == s2e()->getCurrentProcessCount()) {
+            resumeAllProcesses();
+            killAllButOneSuccessful();
             m_shared.release();
+            return;
         }
-        #ifdef CONFIG_WIN32
-        Sleep(1000);
-        #else
-        sleep(1);
-        #endif
+
+        //Processes that exit do not notify us, hence the timeout
+        shared = m_shared.wait(1000);
     }
 }
 
@@ -146,6 +139,8 @@ void StateManager::resumeAllProcesses()
     for (unsigned i=0; i<maxProcessCount; ++i) {
         shared->suspendedProcesses[i] = false;
     }
+
+    m_shared.notifyAll();
 }
 
 
@@ -71,6 +71,7 @@ extern CPUArchState *env;
 #include <iostream>
 #include <sstream>
 #include <deque>
+#include <algorithm>
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
@@ -263,10 +264,6 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
 
     /* Load and initialize plugins */
     initPlugins();
-
-    /* Init the custom memory allocator */
-    //void slab_init();
-    //slab_init();
 }
 
 void S2E::writeBitCodeToFile()
@@ -293,6 +290,7 @@ S2E::~S2E()
     assert(shared->processIds[m_currentProcessId] == m_currentProcessIndex);
     shared->processIds[m_currentProcessId] = (unsigned) -1;
     shared->processPids[m_currentProcessId] = (unsigned) -1;
+    shared->processStateCounts[m_currentProcessId] = 0;
     --shared->currentProcessCount;
 
     m_sync.release();
@@ -668,6 +666,7 @@ int S2E::fork()
             if (shared->processIds[i] == (unsigned)-1) {
                 shared->processIds[i] = newProcessIndex;
                 shared->processPids[i] = getpid();
+                shared->processStateCounts[i] = 0;
                 m_currentProcessId = i;
                 break;
             }
@@ -735,6 +734,29 @@ unsigned S2E::getCurrentProcessCount()
     return ret;
 }
 
+unsigned S2E::updateProcessStateCount(unsigned stateCount)
+{
+    //Instances publish their count every 100 ms. Those that did not for
+    //a few periods are busy (e.g., in a long solver query) and would not
+    //fork into a free slot anyway.
+    const uint64_t maxAge = 500;
+    uint64_t now = llvm::sys::TimeValue::now().msec();
+
+    S2EShared *shared = m_sync.acquire();
+    shared->processStateCounts[m_currentProcessId] = stateCount;
+    shared->processStateCountTimes[m_currentProcessId] = now;
+
+    unsigned ret = 0;
+    for (unsigned i=0; i<m_maxProcesses; ++i) {
+        if (shared->processIds[i] != (unsigned)-1 &&
+            shared->processStateCountTimes[i] + maxAge >= now) {
+            ret = std::max(ret, shared->processStateCounts[i]);
+        }
+    }
+    m_sync.release();
+    return ret;
+}
+
 unsigned S2E::getProcessIndexForId(unsigned id)
 {
     assert(id < m_maxProcesses);
@@ -761,6 +783,7 @@ bool S2E::checkDeadProcesses()
             //Process is dead, we have to decrement everything
             shared->processIds[i] = (unsigned) -1;
             shared->processPids[i] = (unsigned) -1;
+            shared->processStateCounts[i] = 0;
             --shared->currentProcessCount;
             ret = true;
         }
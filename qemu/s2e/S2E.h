@@ -83,10 +83,17 @@ struct S2EShared {
     //the instance index.
     unsigned processIds[S2E_MAX_PROCESSES];
     unsigned processPids[S2E_MAX_PROCESSES];
+
+    //Number of states of each running instance, as of its
+    //last load balancing attempt, and the time of that attempt in ms
+    unsigned processStateCounts[S2E_MAX_PROCESSES];
+    uint64_t processStateCountTimes[S2E_MAX_PROCESSES];
     S2EShared() {
         for (unsigned i=0; i<S2E_MAX_PROCESSES; ++i)    {
             processIds[i] = (unsigned)-1;
             processPids[i] = (unsigned)-1;
+            processStateCounts[i] = 0;
+            processStateCountTimes[i] = 0;
         }
     }
 };
@@ -235,6 +242,10 @@ public:
 
     unsigned getCurrentProcessCount();
 
+    /** Publishes the number of states of this instance and returns
+        the largest number of states recently published by any instance */
+    unsigned updateProcessStateCount(unsigned stateCount);
+
     bool checkDeadProcesses();
 
     inline uint64_t getStartTime() const {
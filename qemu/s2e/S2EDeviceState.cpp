@@ -100,10 +100,18 @@ void s2e_init_device_state(S2EExecutionState *s)
 S2EDeviceState::S2EDeviceState(const S2EDeviceState &state):
         m_deviceState(state.m_deviceState)
 {
-    assert(state.m_stateBuffer);
+    assert(state.m_stateBuffer || state.isSwappedOut());
     m_stateBuffer = (uint8_t*) malloc(state.m_stateBufferSize);
     m_stateBufferSize = state.m_stateBufferSize;
-    memcpy(m_stateBuffer, state.m_stateBuffer, m_stateBufferSize);
+    if (state.isSwappedOut()) {
+        if (!klee::SwapFile::read(state.m_swapSlot, m_stateBuffer,
+                                  m_stateBufferSize)) {
+            cerr << "Cannot read device state snapshot from swap file" << endl;
+            exit(-1);
+        }
+    } else {
+        memcpy(m_stateBuffer, state.m_stateBuffer, m_stateBufferSize);
+    }
     s_memFile = state.s_memFile;
 }
 
@@ -119,6 +127,7 @@ S2EDeviceState::~S2EDeviceState()
     if (m_stateBuffer) {
         free(m_stateBuffer);
     }
+    klee::SwapFile::release(m_swapSlot);
 }
 
 void S2EDeviceState::initDeviceState()
@@ -181,6 +190,16 @@ void S2EDeviceState::initDeviceState()
 
 void S2EDeviceState::saveDeviceState()
 {
+    //The snapshot is about to be overwritten, no need to read it back
+    if (isSwappedOut()) {
+        m_stateBuffer = (uint8_t*) malloc(m_stateBufferSize);
+        if (!m_stateBuffer) {
+            cerr << "Cannot allocate memory for device state snapshot" << endl;
+            exit(-1);
+        }
+        klee::SwapFile::release(m_swapSlot);
+    }
+
     qemu_make_readable(s_memFile);
 
     //DPRINTF("Saving device state %p\n", this);
@@ -197,6 +216,7 @@ void S2EDeviceState::saveDeviceState()
 
 void S2EDeviceState::restoreDeviceState()
 {
+    swapIn();
     assert(m_stateBuffer);
 
     qemu_make_readable(s_memFile);
@@ -214,6 +234,37 @@ void S2EDeviceState::restoreDeviceState()
 /*****************************************************************************/
 /*****************************************************************************/
 
+unsigned S2EDeviceState::swapOut()
+{
+    if (!m_stateBuffer || isSwappedOut()) {
+        return 0;
+    }
+
+    if (!klee::SwapFile::write(m_stateBuffer, m_stateBufferSize, m_swapSlot)) {
+        return 0;
+    }
+
+    free(m_stateBuffer);
+    m_stateBuffer = NULL;
+    return m_stateBufferSize;
+}
+
+void S2EDeviceState::swapIn()
+{
+    if (!isSwappedOut()) {
+        return;
+    }
+
+    m_stateBuffer = (uint8_t*) malloc(m_stateBufferSize);
+    if (!m_stateBuffer ||
+        !klee::SwapFile::read(m_swapSlot, m_stateBuffer, m_stateBufferSize)) {
+        cerr << "Cannot read device state snapshot from swap file" << endl;
+        exit(-1);
+    }
+
+    klee::SwapFile::release(m_swapSlot);
+}
+
 void S2EDeviceState::allocateBuffer(unsigned int size)
 {
     if (size < m_stateBufferSize) {
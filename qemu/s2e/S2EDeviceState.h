@@ -48,6 +48,7 @@ extern "C" {
 #include <llvm/ADT/SmallVector.h>
 
 #include <klee/AddressSpace.h>
+#include <klee/Internal/Support/SwapFile.h>
 
 #include "s2e_block.h"
 
@@ -71,6 +72,9 @@ private:
     uint8_t *m_stateBuffer;
     unsigned m_stateBufferSize;
 
+    /* Location of m_stateBuffer while it is swapped out */
+    klee::SwapFile::Slot m_swapSlot;
+
 
     static llvm::SmallVector<struct BlockDriverState*, 5> s_blockDevices;
     klee::AddressSpace m_deviceState;
@@ -102,6 +106,17 @@ public:
 
     int writeSector(struct BlockDriverState *bs, int64_t sector, const uint8_t *buf, int nb_sectors);
     int readSector(struct BlockDriverState *bs, int64_t sector, uint8_t *buf, int nb_sectors);
+
+    /** Moves the device snapshot to the swap file. Returns the number of
+        bytes released, or 0 if nothing was swapped out. */
+    unsigned swapOut();
+
+    /** Loads the device snapshot back from the swap file */
+    void swapIn();
+
+    bool isSwappedOut() const {
+        return m_swapSlot.isUsed();
+    }
 };
 
 }
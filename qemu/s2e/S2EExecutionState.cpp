@@ -105,6 +105,7 @@ S2EExecutionState::S2EExecutionState(klee::KFunction *kf) :
         klee::ExecutionState(kf), m_stateID(g_s2e->fetchAndIncrementStateId()),
         m_symbexEnabled(true), m_startSymbexAtPC((uint64_t) -1),
         m_active(true), m_zombie(false), m_yielded(false), m_runningConcrete(true),
+        m_lastScheduled(0),
         m_cpuRegistersObject(NULL), m_cpuSystemObject(NULL),
         m_deviceState(this),
         m_qemuIcount(0),
@@ -277,12 +278,6 @@ void S2EExecutionState::addressSpaceChange(const klee::MemoryObject *mo,
         m_cpuRegistersObject = newState;
     } else if (mo == m_cpuSystemState) {
         m_cpuSystemObject = newState;
-    } else {
-        ObjectPair op = m_memcache.get(mo->address);
-        if (op.first) {
-            op.second = newState;
-            m_memcache.put(mo->address, op);
-        }
     }
 }
 
@@ -307,6 +302,31 @@ void S2EExecutionState::clearTlbOwnership()
 #endif
 }
 
+uint64_t S2EExecutionState::swapOut()
+{
+    assert(!m_active);
+    uint64_t released = m_deviceState.swapOut();
+
+    foreach2(it, addressSpace.objects.begin(), addressSpace.objects.end()) {
+        ObjectState *os = (*it).second;
+
+        //Objects shared with other states may be in use by the active state
+        if (!addressSpace.isOwnedByUs(os)) {
+            continue;
+        }
+
+        //The CPU state and the S2E TLB point into these stores
+        if (os == m_cpuSystemObject || os == m_cpuRegistersObject ||
+            os == m_dirtyMaskObject || m_tlbMap.count(os)) {
+            continue;
+        }
+
+        released += os->swapOut();
+    }
+
+    return released;
+}
+
 ExecutionState* S2EExecutionState::clone()
 {
     // When cloning, all ObjectState becomes not owned by neither of states
@@ -924,6 +944,84 @@ uint64_t S2EExecutionState::getSymbolicRegistersMask() const
     return mask;
 }
 
+/* Location in CPUArchState of the register that has the given bit in
+   getSymbolicRegistersMask() */
+static bool getRegisterLocation(unsigned index, unsigned *offset, unsigned *size)
+{
+#ifdef TARGET_I386
+    if (index >= 5 && index < 5 + CPU_NB_REGS) {
+        *offset = (index - 5) * sizeof(*env->regs);
+        *size = sizeof(*env->regs);
+    } else if (index == 1) {
+        *offset = offsetof(CPUX86State, cc_op);
+        *size = sizeof(env->cc_op);
+    } else if (index == 2) {
+        *offset = offsetof(CPUX86State, cc_src);
+        *size = sizeof(env->cc_src);
+    } else if (index == 3) {
+        *offset = offsetof(CPUX86State, cc_dst);
+        *size = sizeof(env->cc_dst);
+    } else if (index == 4) {
+        *offset = offsetof(CPUX86State, cc_tmp);
+        *size = sizeof(env->cc_tmp);
+    } else {
+        return false;
+    }
+    return true;
+#else
+    /* XXX: byte-granular masks are only implemented for x86 */
+    return false;
+#endif
+}
+
+uint8_t S2EExecutionState::getSymbolicRegisterBytes(unsigned index) const
+{
+    const ObjectState* os = m_cpuRegistersObject;
+    unsigned offset, size;
+
+    if (!getRegisterLocation(index, &offset, &size)) {
+        return 0xff;
+    }
+
+    uint8_t bytes = 0;
+    for (unsigned i = 0; i < size; ++i) {
+        if (!os->isConcrete(offset + i, 8)) {
+            bytes |= 1 << i;
+        }
+    }
+    return bytes;
+}
+
+uint8_t S2EExecutionState::getRemainingSymbolicRegisterBytes(unsigned index,
+                                                             uint8_t bytes) const
+{
+    unsigned offset, size;
+
+    if (!getRegisterLocation(index, &offset, &size)) {
+        return getSymbolicRegisterBytes(index);
+    }
+
+    return getSymbolicRegisterBytes(index) & ~bytes;
+}
+
+void S2EExecutionState::discardSymbolicRegisterBytes(unsigned index, uint8_t bytes)
+{
+    unsigned offset, size;
+
+    if (!getRegisterLocation(index, &offset, &size)) {
+        return;
+    }
+
+    for (unsigned i = 0; i < size; ++i) {
+        if ((bytes & (1 << i)) && !m_cpuRegistersObject->isConcrete(offset + i, 8)) {
+            m_cpuRegistersObject->write8(offset + i, 0);
+            if (m_runningConcrete) {
+                ((uint8_t*) m_cpuRegistersState->address)[offset + i] = 0;
+            }
+        }
+    }
+}
+
 bool S2EExecutionState::readMemoryConcrete(uint64_t address, void *buf,
                                    uint64_t size, AddressType addressType)
 {
@@ -1045,11 +1143,7 @@ ref<Expr> S2EExecutionState::readMemory(uint64_t address,
         if(hostAddress == (uint64_t) -1)
             return ref<Expr>(0);
 
-        ObjectPair op = m_memcache.get(hostAddress & S2E_RAM_OBJECT_MASK);
-        if (!op.first) {
-            op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
-            m_memcache.put(hostAddress & S2E_RAM_OBJECT_MASK, op);
-        }
+        ObjectPair op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
 
         assert(op.first && op.first->isUserSpecified
                && op.first->size == S2E_RAM_OBJECT_SIZE);
@@ -1254,12 +1348,7 @@ void S2EExecutionState::readRamConcreteCheck(uint64_t hostAddress, uint8_t* buf,
 
         uint64_t page_addr = hostAddress & S2E_RAM_OBJECT_MASK;
 
-        //ObjectPair op = addressSpace.findObject(page_addr);
-        ObjectPair op = m_memcache.get(page_addr);
-        if (!op.first) {
-            op = addressSpace.findObject(page_addr);
-            m_memcache.put(page_addr, op);
-        }
+        ObjectPair op = addressSpace.findObject(page_addr);
 
 
         assert(op.first && op.first->isUserSpecified &&
@@ -1295,12 +1384,7 @@ void S2EExecutionState::readRamConcrete(uint64_t hostAddress, uint8_t* buf, uint
 
         uint64_t page_addr = hostAddress & S2E_RAM_OBJECT_MASK;
 
-        //ObjectPair op = addressSpace.findObject(page_addr);
-        ObjectPair op = m_memcache.get(page_addr);
-        if (!op.first) {
-            op = addressSpace.findObject(page_addr);
-            m_memcache.put(page_addr, op);
-        }
+        ObjectPair op = addressSpace.findObject(page_addr);
 
 
         assert(op.first && op.first->isUserSpecified &&
@@ -1337,12 +1421,7 @@ void S2EExecutionState::writeRamConcrete(uint64_t hostAddress, const uint8_t* bu
         uint64_t page_addr = hostAddress & S2E_RAM_OBJECT_MASK;
 
 
-        //ObjectPair op = addressSpace.findObject(page_addr);
-        ObjectPair op = m_memcache.get(page_addr);
-        if (!op.first) {
-            op = addressSpace.findObject(page_addr);
-            m_memcache.put(page_addr, op);
-        }
+        ObjectPair op = addressSpace.findObject(page_addr);
 
         assert(op.first && op.first->isUserSpecified &&
                op.first->address == page_addr &&
@@ -1929,11 +2008,7 @@ void S2EExecutionState::dmaRead(uint64_t hostAddress, uint8_t *buf, unsigned siz
             length = size;
         }
 
-        ObjectPair op = m_memcache.get(hostPage);
-        if (!op.first) {
-            op = addressSpace.findObject(hostPage);
-            m_memcache.put(hostAddress, op);
-        }
+        ObjectPair op = addressSpace.findObject(hostPage);
         assert(op.first && op.second && op.first->address == hostPage);
         ObjectState *os = const_cast<ObjectState*>(op.second);
         uint8_t *concreteStore;
@@ -1970,11 +2045,7 @@ void S2EExecutionState::dmaWrite(uint64_t hostAddress, uint8_t *buf, unsigned si
         }
 
 
-        ObjectPair op = m_memcache.get(hostPage);
-        if (!op.first) {
-            op = addressSpace.findObject(hostPage);
-            m_memcache.put(hostAddress, op);
-        }
+        ObjectPair op = addressSpace.findObject(hostPage);
 
         assert(op.first && op.second && op.first->address == hostPage);
         ObjectState *os = addressSpace.getWriteable(op.first, op.second);
@@ -2048,21 +2119,12 @@ void S2EExecutionState::updateTlbEntry(CPUArchState* env,
     assert( (hostAddr & ~TARGET_PAGE_MASK) == 0 );
     assert( (virtAddr & ~TARGET_PAGE_MASK) == 0 );
 
-    ObjectPair *ops = m_memcache.getArray(hostAddr);
-
     unsigned int index = (virtAddr >> S2E_RAM_OBJECT_BITS) & (CPU_S2E_TLB_SIZE - 1);
     for(int i = 0; i < CPU_S2E_TLB_SIZE / CPU_TLB_SIZE; ++i) {
         S2ETLBEntry* entry = &env->s2e_tlb_table[mmu_idx][index];
         ObjectState *oldObjectState = static_cast<ObjectState *>(entry->objectState);
 
-        ObjectPair op;
-
-        if (!ops || !(op = ops[i]).first) {
-            op = m_memcache.get(hostAddr);
-            if (!op.first) {
-                op = addressSpace.findObject(hostAddr);
-            }
-        }
+        ObjectPair op = addressSpace.findObject(hostAddr);
         assert(op.first && op.second && op.second->getObject() == op.first && op.first->address == hostAddr);
 
         klee::ObjectState *ros = const_cast<ObjectState*>(op.second);
@@ -2079,13 +2141,6 @@ void S2EExecutionState::updateTlbEntry(CPUArchState* env,
 
         op = ObjectPair(op.first, (const ObjectState*)entry->objectState);
 
-        if (!ops) {
-            m_memcache.put(hostAddr, op);
-            ops = m_memcache.getArray(hostAddr & TARGET_PAGE_MASK);
-        }
-        ops[i] = op;
-
-
         /* Store the new mapping in the cache */
 #ifdef S2E_DEBUG_TLBCACHE
         g_s2e->getDebugStream() << std::dec << "Storing " << op.second << " (" << mmu_idx << ',' << index << ")\n";
@@ -41,7 +41,6 @@
 #include <cpu.h>
 #include "S2EDeviceState.h"
 #include "S2EStatsTracker.h"
-#include "MemoryCache.h"
 #include "s2e_config.h"
 
 /** S2E_TARGET_CONC_LIMIT defines the border between concrete and symbolic area.
@@ -90,11 +89,6 @@ struct S2ETranslationBlock;
 typedef std::map<const Plugin*, PluginState*> PluginStateMap;
 typedef PluginState* (*PluginStateFactory)(Plugin *p, S2EExecutionState *s);
 
-typedef MemoryCachePool<klee::ObjectPair,
-                S2E_RAM_OBJECT_BITS,
-                TARGET_PAGE_BITS,
-                S2E_MEMCACHE_SUPERPAGE_BITS> S2EMemoryCache;
-
 struct S2EPhysCacheEntry
 {
     uint64_t hostPage;
@@ -148,6 +142,10 @@ protected:
     typedef std::set<std::pair<uint64_t,uint64_t> > ToRunSymbolically;
     ToRunSymbolically m_toRunSymbolically;
 
+    /** Value of the executor's state switch counter when
+        this state was last scheduled */
+    uint64_t m_lastScheduled;
+
 
     /* Move the following to S2EExecutor? */
     /* Mostly accessed from S2EExecutionState anyway, extra indirection if moved...*/
@@ -163,8 +161,6 @@ protected:
 
     S2EDeviceState m_deviceState;
 
-    mutable S2EMemoryCache m_memcache;
-
     /* The following structure is used to store QEMU time accounting
        variables while the state is inactive */
     TimersState* m_timersState;
@@ -216,6 +212,16 @@ public:
         return &m_deviceState;
     }
 
+    /** Moves the device snapshot and the concrete contents of the memory
+        objects that only this state uses to the swap file. They are read
+        back when they are accessed again. Returns the number of bytes
+        released. */
+    uint64_t swapOut();
+
+    bool isSwappedOut() const {
+        return m_deviceState.isSwappedOut();
+    }
+
     TranslationBlock *getTb() const;
 
     uint64_t getTotalInstructionCount();
@@ -251,6 +257,18 @@ public:
     /** Returns a mask of registers that contains symbolic values */
     uint64_t getSymbolicRegistersMask() const;
 
+    /** Returns a mask of the symbolic bytes of the register that has
+        the given bit in getSymbolicRegistersMask() */
+    uint8_t getSymbolicRegisterBytes(unsigned index) const;
+
+    /** Returns the symbolic bytes of the register that
+        discardSymbolicRegisterBytes(index, bytes) would leave */
+    uint8_t getRemainingSymbolicRegisterBytes(unsigned index, uint8_t bytes) const;
+
+    /** Replaces the given symbolic bytes of a register by concrete values.
+        Only valid when the old values can no longer be observed. */
+    void discardSymbolicRegisterBytes(unsigned index, uint8_t bytes);
+
     /** Read CPU general purpose register */
     klee::ref<klee::Expr> readCpuRegister(unsigned offset,
                                           klee::Expr::Width width) const;
@@ -85,6 +85,7 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <s2e/S2EDeviceState.h>
 #include <s2e/SelectRemovalPass.h>
 #include <s2e/S2EStatsTracker.h>
+#include <s2e/Slab.h>
 
 //XXX: Remove this from executor
 #include <s2e/Plugins/ModuleExecutionDetector.h>
@@ -103,6 +104,7 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/Process.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include <klee/PTree.h>
 #include <klee/Memory.h>
@@ -112,10 +114,12 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <klee/CoreStats.h>
 #include <klee/TimerStatIncrementer.h>
 #include <klee/Solver.h>
+#include <klee/Internal/Support/SwapFile.h>
 
 #include <llvm/Support/TimeValue.h>
 
 #include <vector>
+#include <algorithm>
 
 #include <sstream>
 
@@ -170,6 +174,94 @@ namespace {
                      " disabling leads to faster but possibly incorrect execution"),
             cl::init(true));
 
+    cl::opt<bool>
+    SelectiveTBFlush("selective-tb-flush",
+            cl::desc("Instead of flushing all translation blocks on state switch,"
+                     " only invalidate those whose guest code differs between"
+                     " the two states. Plugins must not instrument code differently"
+                     " in different states."),
+            cl::init(false));
+
+    cl::opt<bool>
+    IncrementalStateSwitch("incremental-state-switch",
+            cl::desc("Only save/restore shared memory objects that changed"
+                     " since the last state switch"),
+            cl::init(false));
+
+    cl::opt<bool>
+    LazyStateSwitch("lazy-state-switch",
+            cl::desc("Restore the pages of shared-concrete memory regions (e.g.,"
+                     " video RAM) on first access after a state switch instead"
+                     " of copying them eagerly"),
+            cl::init(false));
+
+    cl::opt<std::string>
+    LLVMTranslationCache("llvm-translation-cache",
+            cl::desc("Directory where generated LLVM functions are cached"
+                     " across runs and processes (disabled if empty)"),
+            cl::init(""));
+
+    cl::opt<unsigned>
+    LLVMTranslationCacheMaxSize("llvm-translation-cache-max-size",
+            cl::desc("Size in MB above which the least recently used files of"
+                     " the LLVM translation cache are evicted (0 for no limit)"),
+            cl::init(1024));
+
+    cl::opt<unsigned>
+    HotTBOptimizationThreshold("hot-tb-optimization-threshold",
+            cl::desc("Run additional optimization passes on translation blocks"
+                     " once they ran this many times in KLEE (0 disables this)"),
+            cl::init(0));
+
+    cl::opt<unsigned>
+    SymbolicTBChainLength("symbolic-tb-chain-length",
+            cl::desc("Maximum number of chained translation blocks that KLEE"
+                     " executes before returning to the cpu loop (1 disables chaining)"),
+            cl::init(1));
+
+    cl::opt<bool>
+    UseSlabAllocator("use-slab-allocator",
+            cl::desc("Allocate small objects (e.g., address space tree nodes,"
+                     " object states and their stores) from per-size pools"),
+            cl::init(false));
+
+    cl::opt<bool>
+    DeduplicateRamObjects("deduplicate-ram-objects",
+            cl::desc("Share RAM objects that states saved with identical contents"
+                     " instead of keeping a private copy in each state"),
+            cl::init(false));
+
+    cl::opt<unsigned>
+    StateSwapMemoryLimit("state-swap-memory-limit",
+            cl::desc("Swap the device state and the private memory of the least recently"
+                     " scheduled states to disk while memory usage exceeds this many MB"
+                     " (0 disables)"),
+            cl::init(0));
+
+    cl::opt<unsigned>
+    StateSwapBatch("state-swap-batch",
+            cl::desc("Maximum number of states swapped out each time memory usage"
+                     " is checked"),
+            cl::init(16));
+
+    cl::opt<bool>
+    BalanceFromBusiestProcess("balance-from-busiest-process",
+            cl::desc("When a worker slot is free, let the S2E process with the most"
+                     " states fork instead of the first one that notices"),
+            cl::init(false));
+
+    cl::opt<bool>
+    DiscardDeadSymbolicRegisters("discard-dead-symbolic-registers",
+            cl::desc("Concretize symbolic registers, e.g., condition code operands,"
+                     " that the next translation block overwrites before using them"),
+            cl::init(false));
+
+    cl::opt<bool>
+    ByteGranularRegisterMasks("byte-granular-register-masks",
+            cl::desc("Run translation blocks natively when they do not touch"
+                     " the symbolic bytes of partially symbolic registers"),
+            cl::init(false));
+
     cl::opt<bool>
     KeepLLVMFunctions("keep-llvm-functions",
             cl::desc("Never delete generated LLVM functions"),
@@ -298,8 +390,30 @@ static void s2e_ext_sigsegv_handler(int signal)
 }
 #else
 static void s2e_ext_sigsegv_handler(int signal, siginfo_t *info, void *context) {
+  if (g_s2e && g_s2e->getExecutor()->handleLazyPageFault((uint64_t) info->si_addr)) {
+    return;
+  }
   s2e_longjmp(s2e_escapeCallJmpBuf, 1);
 }
+
+static struct sigaction s2e_lazy_sigsegv_old_action;
+
+static void s2e_lazy_sigsegv_handler(int signal, siginfo_t *info, void *context) {
+  if (g_s2e && g_s2e->getExecutor()->handleLazyPageFault((uint64_t) info->si_addr)) {
+    return;
+  }
+
+  /* Not ours, forward to whoever was there before */
+  if (s2e_lazy_sigsegv_old_action.sa_flags & SA_SIGINFO) {
+    s2e_lazy_sigsegv_old_action.sa_sigaction(signal, info, context);
+  } else if (s2e_lazy_sigsegv_old_action.sa_handler != SIG_DFL &&
+             s2e_lazy_sigsegv_old_action.sa_handler != SIG_IGN) {
+    s2e_lazy_sigsegv_old_action.sa_handler(signal);
+  } else {
+    sigaction(SIGSEGV, &s2e_lazy_sigsegv_old_action, NULL);
+    raise(signal);
+  }
+}
 #endif
 
 }
@@ -620,13 +734,34 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
                             InterpreterHandler *ie)
         : Executor(opts, ie, tcgLLVMContext->getExecutionEngine()),
           m_s2e(s2e), m_tcgLLVMContext(tcgLLVMContext),
+          m_ramObjectContentsLimit(1024), m_dedupBaselineState(NULL),
           m_executeAlwaysKlee(false), m_forkProcTerminateCurrentState(false),
-          m_inLoadBalancing(false), yieldedState(NULL)
+          m_inLoadBalancing(false), m_stateSwitchCount(0),
+          m_swapUsageBefore(0), m_swapStalledUsage(0), yieldedState(NULL)
 {
+    if (UseSlabAllocator) {
+        slab_init();
+    }
+
+#ifdef WIN32
+    m_hostPageSize = 0x1000;
+#else
+    m_hostPageSize = sysconf(_SC_PAGESIZE);
+#endif
+    m_lazyPageFaults = 0;
+    m_protectedPageCount = 0;
+
     delete externalDispatcher;
     externalDispatcher = new S2EExternalDispatcher(
             tcgLLVMContext->getExecutionEngine());
 
+    if (!LLVMTranslationCache.empty()) {
+        m_tcgLLVMContext->setTranslationCacheDir(LLVMTranslationCache,
+                (uint64_t) LLVMTranslationCacheMaxSize << 20);
+    }
+
+    klee::SwapFile::setPathPrefix(m_s2e->getOutputFilename("state-swap"));
+
     LLVMContext& ctx = m_tcgLLVMContext->getLLVMContext();
 
     // XXX: this will not work without creating JIT
@@ -921,6 +1056,10 @@ S2EExecutor::~S2EExecutor()
 {
     if(statsTracker)
         statsTracker->done();
+
+    if (UseSlabAllocator) {
+        slab_print_stats(m_s2e->getDebugStream());
+    }
 }
 
 S2EExecutionState* S2EExecutor::createInitialState()
@@ -1018,6 +1157,26 @@ void S2EExecutor::initializeExecution(S2EExecutionState* state,
 
     initTimers();
     initializeStateSwitchTimer();
+
+    //The initial state is running without having been switched in
+    if (DeduplicateRamObjects) {
+        m_dedupBaseline = state->addressSpace.getPageTables();
+        m_dedupBaselineState = state;
+    }
+
+    if (LazyStateSwitch) {
+#ifdef WIN32
+        m_s2e->getWarningsStream()
+                << "Lazy state switching is not supported on Windows\n";
+        LazyStateSwitch = false;
+#else
+        struct sigaction segvAction;
+        memset(&segvAction, 0, sizeof(segvAction));
+        segvAction.sa_flags = SA_SIGINFO;
+        segvAction.sa_sigaction = s2e_lazy_sigsegv_handler;
+        sigaction(SIGSEGV, &segvAction, &s2e_lazy_sigsegv_old_action);
+#endif
+    }
 }
 
 void S2EExecutor::registerCpu(S2EExecutionState *initialState,
@@ -1086,6 +1245,9 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
     qemu_log("\t host_address: %"PRIx64".\n", hostAddress);
 #endif
 
+    initialState->addressSpace.registerPageTable(hostAddress, size,
+                                                 S2E_RAM_OBJECT_BITS);
+
     for(uint64_t addr = hostAddress; addr < hostAddress+size;
                  addr += S2E_RAM_OBJECT_SIZE) {
         std::stringstream ss;
@@ -1115,6 +1277,34 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
         }
     }
 
+    //Only regions made of whole host pages can be protected. The arrays
+    //used by the fault handler are allocated here, never during a fault.
+    if (isSharedConcrete && (saveOnContextSwitch || !StateSharedMemory)) {
+        unsigned count = m_saveOnContextSwitch.size();
+        bool lazy = (hostAddress & (m_hostPageSize - 1)) == 0 &&
+                    (size & (m_hostPageSize - 1)) == 0;
+
+        m_lazyObjects.resize(count, false);
+        m_staleObjects.resize(count, false);
+        m_lazyStores.resize(count, NULL);
+
+        if (lazy) {
+            LazyRegion region;
+            region.start = hostAddress;
+            region.end = hostAddress + size;
+            region.firstObject = count - size / S2E_RAM_OBJECT_SIZE;
+            region.firstPage = m_protectedPages.size();
+
+            for (unsigned i = region.firstObject; i < count; ++i) {
+                m_lazyObjects[i] = true;
+            }
+            m_protectedPages.resize(region.firstPage + size / m_hostPageSize, 0);
+            m_lazyRegions.insert(std::upper_bound(m_lazyRegions.begin(),
+                                                  m_lazyRegions.end(), region),
+                                 region);
+        }
+    }
+
     if(!isSharedConcrete) {
         /* XXX */
         /* XXX : use qemu_mprotect */
@@ -1129,8 +1319,6 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
         m_unusedMemoryRegions.push_back(make_pair(hostAddress, size));
     }
 
-    initialState->m_memcache.registerPool(hostAddress, size);
-
 }
 
 void S2EExecutor::registerDirtyMask(S2EExecutionState *initial_state, uint64_t host_address, uint64_t size)
@@ -1232,6 +1420,11 @@ bool S2EExecutor::copyInConcretes(klee::ExecutionState &state)
 
 void S2EExecutor::doLoadBalancing()
 {
+    unsigned maxStates = 0;
+    if (BalanceFromBusiestProcess) {
+        maxStates = m_s2e->updateProcessStateCount(states.size());
+    }
+
     if (states.size() < 2) {
         return;
     }
@@ -1241,6 +1434,11 @@ void S2EExecutor::doLoadBalancing()
         return;
     }
 
+    //Leave the free slot to a process that has more work
+    if (states.size() < maxStates) {
+        return;
+    }
+
     std::vector<ExecutionState*> allStates;
 
     foreach2(it, states.begin(), states.end()) {
@@ -1278,6 +1476,10 @@ void S2EExecutor::doLoadBalancing()
 
     m_s2e->getCorePlugin()->onProcessFork.emit(false, child, parentId);
 
+    //Both processes reference the swap file from now on. Each one closes
+    //its descriptor once it has no state left in the file.
+    klee::SwapFile::reset();
+
     g_s2e->getDebugStream() << "LoadBalancing: terminating states\n";
 
     for (unsigned i=lower; i<upper; ++i) {
@@ -1291,11 +1493,76 @@ void S2EExecutor::doLoadBalancing()
     vm_start();
 }
 
+void S2EExecutor::swapIdleStates()
+{
+    if (!StateSwapMemoryLimit) {
+        return;
+    }
+
+    uint64_t mbs = llvm::sys::Process::GetTotalMemoryUsage() >> 20;
+    if (mbs <= StateSwapMemoryLimit) {
+        m_swapUsageBefore = 0;
+        m_swapStalledUsage = 0;
+        return;
+    }
+
+    //The last swap-out did not lower memory usage (e.g., the allocator
+    //keeps the freed buffers). Swapping more would only make state
+    //switches read the swap file, so wait until usage grows again.
+    if (m_swapUsageBefore && mbs >= m_swapUsageBefore) {
+        m_swapStalledUsage = mbs;
+    }
+    m_swapUsageBefore = 0;
+
+    if (m_swapStalledUsage) {
+        if (mbs < m_swapStalledUsage + StateSwapMemoryLimit / 10) {
+            return;
+        }
+        m_swapStalledUsage = 0;
+    }
+
+    //Least recently scheduled states first
+    std::vector<std::pair<uint64_t, S2EExecutionState*> > candidates;
+    foreach2(it, states.begin(), states.end()) {
+        S2EExecutionState *s2estate = static_cast<S2EExecutionState*>(*it);
+        if (!s2estate->m_active && !s2estate->isZombie() &&
+            !s2estate->isSwappedOut()) {
+            candidates.push_back(std::make_pair(s2estate->m_lastScheduled, s2estate));
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+
+    //Protected pages may be restored from objects that idle states own
+    materializeAllPages();
+
+    //Same estimate as KLEE's memory cap: release the excess proportionally
+    uint64_t toRelease = (mbs - StateSwapMemoryLimit) << 20;
+    uint64_t released = 0;
+    unsigned count = 0;
+    for (unsigned i = 0; i < candidates.size() && released < toRelease &&
+                         count < StateSwapBatch; ++i) {
+        uint64_t bytes = candidates[i].second->swapOut();
+        if (bytes) {
+            released += bytes;
+            ++count;
+        }
+    }
+
+    stats::swappedOutStates += count;
+    if (count) {
+        m_swapUsageBefore = mbs;
+        m_s2e->getDebugStream() << "Swapped out the memory of " << count
+                << " states (" << (released >> 10) << " KB)\n";
+    }
+}
+
 void S2EExecutor::stateSwitchTimerCallback(void *opaque)
 {
     S2EExecutor *c = (S2EExecutor*)opaque;
 
     if (g_s2e_state) {
+        c->swapIdleStates();
         c->doLoadBalancing();
         S2EExecutionState *nextState = c->selectNextState(g_s2e_state);
         if (nextState) {
@@ -1315,6 +1582,284 @@ void S2EExecutor::initializeStateSwitchTimer()
     qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(host_clock) + 100);
 }
 
+/** Returns the lazily restored region that contains the given host
+    address and the index of its page in m_protectedPages, or NULL.
+    Called from the fault handler: only reads preallocated arrays. */
+const S2EExecutor::LazyRegion *S2EExecutor::findLazyPage(uint64_t hostAddress,
+                                                         unsigned *page) const
+{
+    unsigned low = 0, high = m_lazyRegions.size();
+    while (low < high) {
+        unsigned mid = low + (high - low) / 2;
+        const LazyRegion &region = m_lazyRegions[mid];
+        if (hostAddress < region.start) {
+            high = mid;
+        } else if (hostAddress >= region.end) {
+            low = mid + 1;
+        } else {
+            *page = region.firstPage + (hostAddress - region.start) / m_hostPageSize;
+            return &region;
+        }
+    }
+    return NULL;
+}
+
+/** Copies the resident objects of a protected page into the
+    shared location and makes the page accessible again.
+    Called from the fault handler: uses no allocation and no lock. */
+void S2EExecutor::materializePage(const LazyRegion *region, unsigned page)
+{
+    assert(m_protectedPages[page]);
+
+    uint64_t hostPage = region->start + (uint64_t) (page - region->firstPage) * m_hostPageSize;
+    unsigned firstObject = region->firstObject +
+                           (hostPage - region->start) / S2E_RAM_OBJECT_SIZE;
+
+#ifndef WIN32
+    mprotect((void*) hostPage, m_hostPageSize, PROT_READ | PROT_WRITE);
+#endif
+
+    unsigned count = m_hostPageSize / S2E_RAM_OBJECT_SIZE;
+    for (unsigned i = 0; i < count; ++i) {
+        if (!m_staleObjects[firstObject + i]) {
+            continue;
+        }
+
+        memcpy((uint8_t*) hostPage + i * S2E_RAM_OBJECT_SIZE,
+               m_lazyStores[firstObject + i], S2E_RAM_OBJECT_SIZE);
+        m_staleObjects[firstObject + i] = false;
+    }
+
+    m_protectedPages[page] = 0;
+    --m_protectedPageCount;
+}
+
+void S2EExecutor::materializeAllPages()
+{
+    for (unsigned r = 0; r < m_lazyRegions.size() && m_protectedPageCount; ++r) {
+        const LazyRegion *region = &m_lazyRegions[r];
+        unsigned pages = (region->end - region->start) / m_hostPageSize;
+        for (unsigned page = region->firstPage; page < region->firstPage + pages; ++page) {
+            if (m_protectedPages[page]) {
+                materializePage(region, page);
+            }
+        }
+    }
+}
+
+void S2EExecutor::materializeHostRange(uint64_t hostAddress, uint64_t size)
+{
+    if (!m_protectedPageCount || !size) {
+        return;
+    }
+
+    uint64_t end = hostAddress + size;
+    for (uint64_t addr = hostAddress & ~(m_hostPageSize - 1); addr < end;
+         addr += m_hostPageSize) {
+        unsigned page;
+        const LazyRegion *region = findLazyPage(addr, &page);
+        if (region && m_protectedPages[page]) {
+            materializePage(region, page);
+        }
+    }
+}
+
+bool S2EExecutor::handleLazyPageFault(uint64_t hostAddress)
+{
+    unsigned page;
+    const LazyRegion *region = findLazyPage(hostAddress, &page);
+    if (!region || !m_protectedPages[page]) {
+        return false;
+    }
+
+    materializePage(region, page);
+    ++m_lazyPageFaults;
+    return true;
+}
+
+/** Returns true if the shared location of the given object was neither
+    restored nor accessed since the last switch, i.e., os is still up to
+    date. Otherwise, makes sure the shared location is valid. */
+bool S2EExecutor::isLazyObjectUntouched(unsigned index, const ObjectState *os)
+{
+    if (!LazyStateSwitch || index >= m_lazyObjects.size() ||
+        !m_lazyObjects[index]) {
+        return false;
+    }
+
+    unsigned page;
+    const LazyRegion *region = findLazyPage(m_saveOnContextSwitch[index]->address, &page);
+    assert(region);
+    if (!m_protectedPages[page]) {
+        return false;
+    }
+
+    if (m_residentObjects[index] == os) {
+        return true;
+    }
+
+    materializePage(region, page);
+    return false;
+}
+
+/** Invalidates the translation blocks that overlap the given object
+    if the contents of newOS differ from what is currently loaded.
+    Returns true if the object may have contained translated code. */
+bool S2EExecutor::invalidateChangedCode(unsigned index, const ObjectState *newOS)
+{
+    const MemoryObject *mo = m_saveOnContextSwitch[index];
+
+    //The resident object is authoritative, the shared location may be stale
+    const uint8_t *current;
+    if (index < m_residentObjects.size() && m_residentObjects[index]) {
+        current = m_residentObjects[index]->getConcreteStore();
+    } else {
+        current = (const uint8_t*) mo->address;
+    }
+
+    if (!memcmp(current, newOS->getConcreteStore(), mo->size)) {
+        return false;
+    }
+
+    //Skip objects that are not guest RAM (e.g., the dirty mask)
+    ram_addr_t ramAddr;
+    if (qemu_ram_addr_from_host((void*) mo->address, &ramAddr)) {
+        return false;
+    }
+
+    tb_invalidate_phys_page_range(ramAddr, ramAddr + mo->size, 0);
+    return true;
+}
+
+/** Invalidates the translation blocks in the guest RAM that is stored in
+    each state (e.g., pc.ram) whose contents differ between the two states.
+    Returns the number of objects invalidated. */
+unsigned S2EExecutor::invalidateChangedPrivateCode(const S2EExecutionState *oldState,
+                                                   const S2EExecutionState *newState)
+{
+    //Objects still shared since the states forked are skipped for free
+    std::vector<const MemoryObject*> changed;
+    newState->addressSpace.findChangedPageTableObjects(oldState->addressSpace,
+                                                       changed);
+
+    unsigned count = 0;
+    for (unsigned i = 0; i < changed.size(); ++i) {
+        const MemoryObject *mo = changed[i];
+
+        //Shared concrete objects are compared by invalidateChangedCode
+        if (mo->isSharedConcrete) {
+            continue;
+        }
+
+        //Private copies of the same contents
+        const ObjectState *oldOS = oldState->addressSpace.findObject(mo);
+        const ObjectState *newOS = newState->addressSpace.findObject(mo);
+        if (oldOS && newOS && oldOS->isAllConcrete() && newOS->isAllConcrete() &&
+                !memcmp(oldOS->getConcreteStore(), newOS->getConcreteStore(),
+                        mo->size)) {
+            continue;
+        }
+
+        ram_addr_t ramAddr;
+        if (qemu_ram_addr_from_host((void*) mo->address, &ramAddr)) {
+            continue;
+        }
+
+        tb_invalidate_phys_page_range(ramAddr, ramAddr + mo->size, 0);
+        ++count;
+    }
+
+    return count;
+}
+
+/* Hash of a RAM object and of the given contents */
+static uint64_t hashRamObject(const MemoryObject *mo, const uint8_t *data)
+{
+    uint64_t hash = 14695981039346656037ULL ^ mo->address;
+    for (unsigned i = 0; i < mo->size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+const ObjectState *S2EExecutor::findIdenticalRamObject(const MemoryObject *mo,
+                                                        const uint8_t *data,
+                                                        uint64_t hash)
+{
+    RamObjectContents::iterator it = m_ramObjectContents.find(hash);
+    if (it == m_ramObjectContents.end()) {
+        return NULL;
+    }
+
+    //The object may have been written since it was registered. Reading
+    //a swapped out object back would defeat swapping.
+    const ObjectState *os = (*it).second;
+    if (os->isSwappedOut()) {
+        m_ramObjectContents.erase(it);
+        return NULL;
+    }
+
+    const uint8_t *store = os->getConcreteStore();
+    if (os->getObject() != mo || !store || memcmp(store, data, mo->size)) {
+        m_ramObjectContents.erase(it);
+        return NULL;
+    }
+
+    return os;
+}
+
+void S2EExecutor::registerRamObjectContents(const MemoryObject *mo, uint64_t hash,
+                                            ObjectState *os)
+{
+    //Drop the objects that no state uses anymore
+    if (m_ramObjectContents.size() >= m_ramObjectContentsLimit) {
+        RamObjectContents::iterator it = m_ramObjectContents.begin();
+        while (it != m_ramObjectContents.end()) {
+            if ((*it).second.isUnique()) {
+                m_ramObjectContents.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        m_ramObjectContentsLimit = std::max<size_t>(1024, 2 * m_ramObjectContents.size());
+    }
+
+    m_ramObjectContents[hash] = os;
+}
+
+/** Shares the guest RAM objects stored in the state (e.g., pc.ram) that
+    it wrote while it was running with identical copies saved by other
+    states. Only fully concrete objects are considered. */
+void S2EExecutor::deduplicatePrivateRam(S2EExecutionState *state)
+{
+    std::vector<const MemoryObject*> changed;
+    state->addressSpace.findChangedPageTableObjects(m_dedupBaseline, changed);
+
+    for (unsigned i = 0; i < changed.size(); ++i) {
+        const MemoryObject *mo = changed[i];
+
+        //Shared concrete objects are deduplicated when they are saved
+        if (mo->isSharedConcrete || mo->size != S2E_RAM_OBJECT_SIZE) {
+            continue;
+        }
+
+        const ObjectState *os = state->addressSpace.findObject(mo);
+        const uint8_t *store = os->getConcreteStore();
+        if (!store) {
+            continue;
+        }
+
+        uint64_t hash = hashRamObject(mo, store);
+        const ObjectState *identical = findIdenticalRamObject(mo, store, hash);
+        if (!identical) {
+            registerRamObjectContents(mo, hash, const_cast<ObjectState*>(os));
+        } else if (identical != os) {
+            state->addressSpace.shareObject(mo, identical);
+            ++stats::deduplicatedRamObjects;
+        }
+    }
+}
+
 void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
                                 S2EExecutionState* newState)
 {
@@ -1340,9 +1885,25 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
             << "Switching from state " << (oldState ? oldState->getID() : -1)
             << " to state " << (newState ? newState->getID() : -1) << '\n';
 
+    if (newState) {
+        newState->m_lastScheduled = ++m_stateSwitchCount;
+    }
+
     const MemoryObject* cpuMo = oldState ? oldState->m_cpuSystemState :
                                             newState->m_cpuSystemState;
 
+    //Lazy switching relies on the same bookkeeping as incremental switching
+    bool incremental = IncrementalStateSwitch || LazyStateSwitch;
+    if (incremental) {
+        unsigned count = m_saveOnContextSwitch.size();
+        m_residentObjects.resize(count);
+        m_staleObjects.resize(count, false);
+        m_lazyObjects.resize(count, false);
+    }
+
+    uint64_t totalSaved = 0;
+    uint64_t objectsSaved = 0;
+
     if(oldState) {
         if(oldState->m_runningConcrete)
             switchToSymbolic(oldState);
@@ -1354,17 +1915,69 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         }
         */
 
-        foreach(MemoryObject* mo, m_saveOnContextSwitch) {
+        for (unsigned i = 0; i < m_saveOnContextSwitch.size(); ++i) {
+            MemoryObject *mo = m_saveOnContextSwitch[i];
             if(mo == cpuMo)
                 continue;
 
             const ObjectState *oldOS = oldState->addressSpace.findObject(mo);
+
+            if (incremental && isLazyObjectUntouched(i, oldOS)) {
+                continue;
+            }
+
+            if (incremental) {
+                //Objects that were not modified while the state was active
+                //do not need to be written back. This also avoids creating
+                //a private copy of objects shared with other states.
+                const uint8_t *oldStore = oldOS->getConcreteStore();
+                assert(oldStore);
+                if (!memcmp(oldStore, (uint8_t*) mo->address, mo->size)) {
+                    m_residentObjects[i] = const_cast<ObjectState*>(oldOS);
+                    continue;
+                }
+            }
+
+            uint64_t hash = 0;
+            if (DeduplicateRamObjects && mo->size == S2E_RAM_OBJECT_SIZE) {
+                //Another state may already have saved the same contents
+                const uint8_t *data = (const uint8_t*) mo->address;
+                hash = hashRamObject(mo, data);
+                const ObjectState *identical = findIdenticalRamObject(mo, data, hash);
+                if (identical) {
+                    if (identical != oldOS) {
+                        oldState->addressSpace.shareObject(mo, identical);
+                        ++stats::deduplicatedRamObjects;
+                    }
+                    if (incremental) {
+                        m_residentObjects[i] = const_cast<ObjectState*>(identical);
+                    }
+                    continue;
+                }
+            }
+
             ObjectState *oldWOS = oldState->addressSpace.getWriteable(mo, oldOS);
             uint8_t *oldStore = oldWOS->getConcreteStore();
             assert(oldStore);
             memcpy(oldStore, (uint8_t*) mo->address, mo->size);
+
+            totalSaved += mo->size;
+            objectsSaved++;
+
+            if (DeduplicateRamObjects && mo->size == S2E_RAM_OBJECT_SIZE) {
+                registerRamObjectContents(mo, hash, oldWOS);
+            }
+
+            if (incremental) {
+                m_residentObjects[i] = oldWOS;
+            }
         }
 
+        if (DeduplicateRamObjects && m_dedupBaselineState == oldState) {
+            deduplicatePrivateRam(oldState);
+        }
+        m_dedupBaselineState = NULL;
+
         //copyInConcretes(*oldState);
         oldState->getDeviceState()->saveDeviceState();
         //oldState->m_qemuIcount = qemu_icount;
@@ -1378,8 +1991,22 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
 
     uint64_t totalCopied = 0;
     uint64_t objectsCopied = 0;
+    uint64_t pagesProtected = 0;
+    uint64_t objectsInvalidated = 0;
+
+    //The translated code may come from a state whose memory is no longer
+    //known (e.g., after a merge), selective invalidation needs both states
+    bool flushAllTBs = FlushTBsOnStateSwitch && !SelectiveTBFlush;
 
     if(newState) {
+        if (SelectiveTBFlush) {
+            if (oldState) {
+                objectsInvalidated += invalidateChangedPrivateCode(oldState, newState);
+            } else {
+                flushAllTBs = FlushTBsOnStateSwitch;
+            }
+        }
+
         timers_state = *newState->m_timersState;
         //qemu_icount = newState->m_qemuIcount;
 
@@ -1391,21 +2018,60 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
 
         memcpy(&env->jmp_env, &jmp_env, sizeof(jmp_buf));
 
-        foreach(MemoryObject* mo, m_saveOnContextSwitch) {
+        for (unsigned i = 0; i < m_saveOnContextSwitch.size(); ++i) {
+            MemoryObject *mo = m_saveOnContextSwitch[i];
             if(mo == cpuMo)
                 continue;
 
             const ObjectState *newOS = newState->addressSpace.findObject(mo);
+
+            //The shared location already holds the contents of newOS
+            if (incremental && m_residentObjects[i] == newOS) {
+                continue;
+            }
+
+            if (SelectiveTBFlush && invalidateChangedCode(i, newOS)) {
+                ++objectsInvalidated;
+            }
+
+            //Defer the copy until the page is accessed. The fault handler
+            //cannot read swapped out objects back, load them now.
+            if (LazyStateSwitch && m_lazyObjects[i]) {
+                m_lazyStores[i] = newOS->getConcreteStore(true);
+                m_residentObjects[i] = const_cast<ObjectState*>(newOS);
+                m_staleObjects[i] = true;
+
+                unsigned page;
+                findLazyPage(mo->address, &page);
+                if (!m_protectedPages[page]) {
+                    m_protectedPages[page] = 1;
+                    ++m_protectedPageCount;
+                    mprotect((void*) (mo->address & ~(m_hostPageSize - 1)),
+                             m_hostPageSize, PROT_NONE);
+                    ++pagesProtected;
+                }
+                continue;
+            }
+
             const uint8_t *newStore = newOS->getConcreteStore();
             assert(newStore);
             memcpy((uint8_t*) mo->address, newStore, mo->size);
 
             totalCopied += mo->size;
             objectsCopied++;
+
+            if (incremental) {
+                m_residentObjects[i] = const_cast<ObjectState*>(newOS);
+            }
         }
 
         newState->m_active = true;
 
+        if (DeduplicateRamObjects) {
+            m_dedupBaseline = newState->addressSpace.getPageTables();
+            m_dedupBaselineState = newState;
+        }
+
         //Devices may need to write to memory, which can be done
         //after the state is activated
         //XXX: assigning g_s2e_state here is ugly but is required for restoreDeviceState...
@@ -1431,10 +2097,25 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     cpu_enable_ticks();
 
     if (VerboseStateSwitching) {
-        s2e_debug_print("Copied %d (count=%d)\n", totalCopied, objectsCopied);
+        s2e_debug_print("Saved %" PRIu64 " bytes (count=%" PRIu64 "), "
+                        "restored %" PRIu64 " bytes (count=%" PRIu64 ")\n",
+                        totalSaved, objectsSaved, totalCopied, objectsCopied);
+
+        if (LazyStateSwitch) {
+            s2e_debug_print("Faulted %u pages since the last switch, "
+                            "protected %" PRIu64 " pages\n",
+                            m_lazyPageFaults, pagesProtected);
+        }
+
+        if (SelectiveTBFlush) {
+            s2e_debug_print("Invalidated translated code in %" PRIu64 " objects\n",
+                            objectsInvalidated);
+        }
     }
 
-    if(FlushTBsOnStateSwitch)
+    m_lazyPageFaults = 0;
+
+    if (flushAllTBs)
         tb_flush(env);
 
     g_s2e_disable_tlb_flush = 0;
@@ -1545,10 +2226,9 @@ S2EExecutionState* S2EExecutor::selectNextState(S2EExecutionState *state)
     return newState;
 }
 
-/** Simulate start of function execution, creating KLEE structs of required */
-void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
-                            llvm::Function *function,
-                            const std::vector<klee::ref<klee::Expr> > &args)
+/** Returns the KLEE function for the given LLVM function, registering
+    it in the module if required */
+KFunction* S2EExecutor::getKFunction(llvm::Function *function)
 {
     KFunction *kf;
     typeof(kmodule->functionMap.begin()) it =
@@ -1592,6 +2272,16 @@ void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
         }
     }
 
+    return kf;
+}
+
+/** Simulate start of function execution, creating KLEE structs of required */
+void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
+                            llvm::Function *function,
+                            const std::vector<klee::ref<klee::Expr> > &args)
+{
+    KFunction *kf = getKFunction(function);
+
     /* Emulate call to a TB function */
     state->prevPC = state->pc;
 
@@ -1744,8 +2434,16 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
 
     /* Generate LLVM code if necessary */
     if(!tb->llvm_function) {
+        uint64_t cacheHits = m_tcgLLVMContext->getTranslationCacheHits();
+        uint64_t cacheMisses = m_tcgLLVMContext->getTranslationCacheMisses();
+
         cpu_gen_llvm(env, tb);
         assert(tb->llvm_function);
+
+        stats::llvmTranslationCacheHits +=
+                m_tcgLLVMContext->getTranslationCacheHits() - cacheHits;
+        stats::llvmTranslationCacheMisses +=
+                m_tcgLLVMContext->getTranslationCacheMisses() - cacheMisses;
     }
 
     if(tb->s2e_tb != state->m_lastS2ETb) {
@@ -1754,6 +2452,12 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
         state->m_lastS2ETb->refCount += 1;
     }
 
+    /* Only hot blocks are worth the more expensive optimizations */
+    if (HotTBOptimizationThreshold && !tb->s2e_tb->unoptimizedFunction &&
+        tb->s2e_tb->executionCount++ >= HotTBOptimizationThreshold) {
+        optimizeHotTranslationBlock(tb);
+    }
+
     /* Prepare function execution */
     prepareFunctionExecution(state,
             tb->llvm_function, std::vector<ref<Expr> >(1,
@@ -1771,6 +2475,40 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
     return cast<klee::ConstantExpr>(resExpr)->getZExtValue();
 }
 
+/** Replaces the function of a block that was executed many times
+    in KLEE by a copy that also went through the TCG-LLVM passes */
+void S2EExecutor::optimizeHotTranslationBlock(TranslationBlock *tb)
+{
+    S2ETranslationBlock *s2e_tb = tb->s2e_tb;
+    Function *function = s2e_tb->llvm_function;
+
+    ValueToValueMapTy vmap;
+    Function *optimized = CloneFunction(function, vmap, false);
+    optimized->setName(function->getName() + "-opt");
+    function->getParent()->getFunctionList().push_back(optimized);
+
+    /* Runs on top of the passes that every block goes through (they run
+       again in getKFunction). Includes the select removal pass when
+       --use-select-cleaner is set. */
+    m_tcgLLVMContext->getFunctionPassManager()->run(*optimized);
+
+    KFunction *kf = getKFunction(optimized);
+
+    typeof(kmodule->functionMap.begin()) it =
+            kmodule->functionMap.find(function);
+    if (it != kmodule->functionMap.end() &&
+        it->second->numInstructions > kf->numInstructions) {
+        stats::hotTranslationBlockStaticInstructionsRemoved +=
+                it->second->numInstructions - kf->numInstructions;
+    }
+    ++stats::hotTranslationBlocks;
+
+    /* The old function is released together with the block */
+    s2e_tb->unoptimizedFunction = function;
+    s2e_tb->llvm_function = optimized;
+    tb->llvm_function = optimized;
+}
+
 uintptr_t S2EExecutor::executeTranslationBlockConcrete(S2EExecutionState *state,
                                                        TranslationBlock *tb)
 {
@@ -1859,6 +2597,171 @@ static void s2e_tb_reset_jump_smask(TranslationBlock* tb, unsigned int n,
     }
 }
 
+/* Returns the symbolic bytes of register i that remain when tb starts
+   running, i.e., after the bytes that tb overwrites before use are
+   discarded (see s2e_tb_discard_dead_symbolic_bytes) */
+static uint8_t s2e_tb_live_symbolic_bytes(S2EExecutionState *state,
+                                          TranslationBlock *tb, unsigned i)
+{
+    if (!DiscardDeadSymbolicRegisters || !((tb->reg_wmask >> i) & 1)) {
+        return state->getSymbolicRegisterBytes(i);
+    }
+    return state->getRemainingSymbolicRegisterBytes(i, tb->reg_kbytes[i]);
+}
+
+/* Returns the symbolic register mask that tb sees when it starts running */
+static uint64_t s2e_tb_live_symbolic_mask(S2EExecutionState *state,
+                                          TranslationBlock *tb, uint64_t smask)
+{
+    if (!DiscardDeadSymbolicRegisters) {
+        return smask;
+    }
+
+    uint64_t mask = smask & tb->reg_wmask;
+    for (unsigned i = 0; mask && i < S2E_TB_REG_BYTES_COUNT; ++i, mask >>= 1) {
+        if ((mask & 1) && tb->reg_kbytes[i] &&
+                !s2e_tb_live_symbolic_bytes(state, tb, i)) {
+            smask &= ~(1ULL << i);
+        }
+    }
+    return smask;
+}
+
+/* Returns true if tb reads or changes symbolic bytes of the registers in
+   smask. This refines the register-granular reg_rmask/reg_wmask test. */
+static bool s2e_tb_touches_symbolic_bytes(S2EExecutionState *state,
+                                          TranslationBlock *tb, uint64_t smask)
+{
+    uint64_t mask = smask & (tb->reg_rmask | tb->reg_wmask);
+    for (unsigned i = 0; mask; ++i, mask >>= 1) {
+        if (!(mask & 1)) {
+            continue;
+        }
+        if (i >= S2E_TB_REG_BYTES_COUNT) {
+            return true;
+        }
+        uint8_t touched = tb->reg_rbytes[i] | tb->reg_wbytes[i];
+        if (s2e_tb_live_symbolic_bytes(state, tb, i) & touched) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Concretizes the symbolic register bytes that tb overwrites before they
+   can be read or observed through an exception. Flag-setting instructions
+   typically overwrite the symbolic cc_src/cc_dst left by earlier blocks. */
+static void s2e_tb_discard_dead_symbolic_bytes(S2EExecutionState *state,
+                                               TranslationBlock *tb, uint64_t smask)
+{
+    uint64_t mask = smask & tb->reg_wmask;
+    for (unsigned i = 0; mask && i < S2E_TB_REG_BYTES_COUNT; ++i, mask >>= 1) {
+        if ((mask & 1) && tb->reg_kbytes[i]) {
+            state->discardSymbolicRegisterBytes(i, tb->reg_kbytes[i]);
+            ++stats::deadSymbolicRegisters;
+        }
+    }
+}
+
+/** Decides whether the block that is about to run must run in KLEE.
+    Does not change the state, so that the caller can still decide not
+    to run the block: prepareTranslationBlock() applies the decision.
+    Sets coarseMask if only the whole-register masks require KLEE. */
+bool S2EExecutor::mustExecuteInKlee(S2EExecutionState *state,
+                                    TranslationBlock *tb, bool &coarseMask)
+{
+    coarseMask = false;
+
+    if (m_executeAlwaysKlee) {
+        return true;
+    }
+
+    if (state->m_startSymbexAtPC != (uint64_t) -1 &&
+            state->getPc() == state->m_startSymbexAtPC) {
+        return true;
+    }
+
+    //XXX: hack to run code symbolically that may be delayed because of interrupts.
+    //Size check is important to avoid expensive calls to getPc/getPid in the common case
+    if (state->m_toRunSymbolically.size() > 0 && state->m_toRunSymbolically.find(std::make_pair(state->getPc(), state->getPid()))
+        != state->m_toRunSymbolically.end()) {
+        return true;
+    }
+
+    //XXX: This should be fixed to make sure that helpers do not read/write corrupted data
+    //because they think that execution is concrete while it should be symbolic (see issue #30).
+    if (m_forceConcretizations) {
+        return false;
+    }
+
+    /* We can not execute TB natively if it reads any symbolic regs */
+    uint64_t smask = s2e_tb_live_symbolic_mask(state, tb,
+                                               state->getSymbolicRegistersMask());
+    if (!(smask & tb->reg_rmask) && !(smask & tb->reg_wmask)
+            && !(tb->helper_accesses_mem & 4)) {
+        return false;
+    }
+
+    /* TB reads symbolic variables */
+    if (!(tb->helper_accesses_mem & 4) &&
+            !s2e_tb_touches_symbolic_bytes(state, tb, smask)) {
+        /* Only whole-register masks require KLEE here */
+        coarseMask = true;
+        return !ByteGranularRegisterMasks;
+    }
+
+    return true;
+}
+
+/** Applies the decision of mustExecuteInKlee() once tb is about to run.
+    Consumes the pending requests to start symbolic execution at the
+    current pc, discards the dead symbolic register bytes of tb and
+    unlinks a native block from the successors that need KLEE. */
+void S2EExecutor::prepareTranslationBlock(S2EExecutionState *state,
+                                          TranslationBlock *tb,
+                                          bool executeKlee, bool coarseMask)
+{
+    state->m_startSymbexAtPC = (uint64_t) -1;
+
+    if (state->m_toRunSymbolically.size() > 0) {
+        state->m_toRunSymbolically.erase(std::make_pair(state->getPc(), state->getPid()));
+    }
+
+    if (coarseMask) {
+        ++stats::coarseMaskTranslationBlocks;
+    }
+
+    if (m_forceConcretizations) {
+        return;
+    }
+
+    uint64_t smask = state->getSymbolicRegistersMask();
+    if (DiscardDeadSymbolicRegisters && (smask & tb->reg_wmask)) {
+        s2e_tb_discard_dead_symbolic_bytes(state, tb, smask);
+        smask = state->getSymbolicRegistersMask();
+    }
+
+    if (!executeKlee && smask) {
+        s2e_tb_reset_jump_smask(tb, 0, smask);
+        s2e_tb_reset_jump_smask(tb, 1, smask);
+
+        /* XXX: check whether we really have to unlink the block */
+        /*
+        tb->jmp_first = (TranslationBlock *)((intptr_t)tb | 2);
+        tb->jmp_next[0] = NULL;
+        tb->jmp_next[1] = NULL;
+        if(tb->tb_next_offset[0] != 0xffff)
+            tb_set_jmp_target(tb, 0,
+                  (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[0]));
+        if(tb->tb_next_offset[1] != 0xffff)
+            tb_set_jmp_target(tb, 1,
+                  (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[1]));
+        tb->s2e_tb_next[0] = NULL;
+        tb->s2e_tb_next[1] = NULL;
+        */
+    }
+}
+
 uintptr_t S2EExecutor::executeTranslationBlock(
         S2EExecutionState* state,
         TranslationBlock* tb)
@@ -1867,62 +2770,9 @@ uintptr_t S2EExecutor::executeTranslationBlock(
     static unsigned doStatsIncrementCount= 0;
     assert(state->isActive());
 
-    bool executeKlee = m_executeAlwaysKlee;
-
-    /* Think how can we optimize if symbex is disabled */
-    if(true/* state->m_symbexEnabled*/) {
-        if(state->m_startSymbexAtPC != (uint64_t) -1) {
-            executeKlee |= (state->getPc() == state->m_startSymbexAtPC);
-            state->m_startSymbexAtPC = (uint64_t) -1;
-        }
-
-        //XXX: hack to run code symbolically that may be delayed because of interrupts.
-        //Size check is important to avoid expensive calls to getPc/getPid in the common case
-        if (state->m_toRunSymbolically.size() > 0 &&  state->m_toRunSymbolically.find(std::make_pair(state->getPc(), state->getPid()))
-            != state->m_toRunSymbolically.end()) {
-            executeKlee = true;
-            state->m_toRunSymbolically.erase(std::make_pair(state->getPc(), state->getPid()));
-        }
-
-        if(!executeKlee) {
-            //XXX: This should be fixed to make sure that helpers do not read/write corrupted data
-            //because they think that execution is concrete while it should be symbolic (see issue #30).
-            if (!m_forceConcretizations) {
-#if 1
-            /* We can not execute TB natively if it reads any symbolic regs */
-            uint64_t smask = state->getSymbolicRegistersMask();
-            if(smask || (tb->helper_accesses_mem & 4)) {
-                if((smask & tb->reg_rmask) || (smask & tb->reg_wmask)
-                         || (tb->helper_accesses_mem & 4)) {
-                    /* TB reads symbolic variables */
-                    executeKlee = true;
-
-                } else {
-                    s2e_tb_reset_jump_smask(tb, 0, smask);
-                    s2e_tb_reset_jump_smask(tb, 1, smask);
-
-                    /* XXX: check whether we really have to unlink the block */
-                    /*
-                    tb->jmp_first = (TranslationBlock *)((intptr_t)tb | 2);
-                    tb->jmp_next[0] = NULL;
-                    tb->jmp_next[1] = NULL;
-                    if(tb->tb_next_offset[0] != 0xffff)
-                        tb_set_jmp_target(tb, 0,
-                              (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[0]));
-                    if(tb->tb_next_offset[1] != 0xffff)
-                        tb_set_jmp_target(tb, 1,
-                              (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[1]));
-                    tb->s2e_tb_next[0] = NULL;
-                    tb->s2e_tb_next[1] = NULL;
-                    */
-                }
-            }
-#else
-            executeKlee |= !state->m_cpuRegistersObject->isAllConcrete();
-#endif
-            } //forced concretizations
-        }
-    }
+    bool coarseMask;
+    bool executeKlee = mustExecuteInKlee(state, tb, coarseMask);
+    prepareTranslationBlock(state, tb, executeKlee, coarseMask);
 
     if(executeKlee) {
         if(state->m_runningConcrete) {
@@ -1936,7 +2786,23 @@ uintptr_t S2EExecutor::executeTranslationBlock(
         int slowdown = UseFastHelpers ? ClockSlowDownFastHelpers : ClockSlowDown;
         cpu_enable_scaling(slowdown);
 
-        return executeTranslationBlockKlee(state, tb);
+        uintptr_t next_tb = executeTranslationBlockKlee(state, tb);
+
+        /* Follow QEMU's links to the next blocks without going back to the
+           cpu loop. Each block still runs as its own LLVM function. */
+        for (unsigned i = 1; i < SymbolicTBChainLength; ++i) {
+            tb = getChainedTranslationBlock(state, next_tb);
+            if (!tb) {
+                break;
+            }
+
+            ++stats::chainedTranslationBlocks;
+            env->current_tb = tb;
+            env->s2e_current_tb = tb;
+            next_tb = executeTranslationBlockKlee(state, tb);
+        }
+
+        return next_tb;
 
     } else {
         //g_s2e_exec_ret_addr = 0;
@@ -1957,6 +2823,44 @@ uintptr_t S2EExecutor::executeTranslationBlock(
     }
 }
 
+/** Returns the block that the cpu loop linked to the exit taken by the
+    block that just ran, if that block must run in KLEE as well. The
+    returned block is prepared to run. */
+TranslationBlock* S2EExecutor::getChainedTranslationBlock(
+        S2EExecutionState *state, uintptr_t next_tb)
+{
+    TranslationBlock *tb = (TranslationBlock *) (next_tb & ~3);
+    unsigned n = next_tb & 3;
+    if (!tb || n > 1) {
+        return NULL;
+    }
+
+    /* Let the cpu loop handle interrupts, exit requests and invalidated code */
+    if (env->interrupt_request || env->exit_request || tb_invalidated_flag) {
+        return NULL;
+    }
+
+    TranslationBlock *next = tb->s2e_tb_next[n];
+    if (!next || !tb->jmp_next[n]) {
+        return NULL;
+    }
+
+    target_ulong pc, cs_base;
+    int flags;
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    if (next->pc != pc || next->cs_base != cs_base || next->flags != flags) {
+        return NULL;
+    }
+
+    bool coarseMask;
+    if (!mustExecuteInKlee(state, next, coarseMask)) {
+        return NULL;
+    }
+
+    prepareTranslationBlock(state, next, true, coarseMask);
+    return next;
+}
+
 void S2EExecutor::cleanupTranslationBlock(S2EExecutionState* state)
 {
     assert(state->m_active);
@@ -2149,8 +3053,13 @@ void S2EExecutor::notifyBranch(ExecutionState &state)
      * These objects must be saved before the cpu state, because
      * getWritable() may modify the TLB.
      */
-    foreach(MemoryObject* mo, m_saveOnContextSwitch) {
+    for (unsigned i = 0; i < m_saveOnContextSwitch.size(); ++i) {
+        MemoryObject *mo = m_saveOnContextSwitch[i];
         const ObjectState *os = s2eState->addressSpace.findObject(mo);
+        if (isLazyObjectUntouched(i, os)) {
+            continue;
+        }
+
         ObjectState *wos = s2eState->addressSpace.getWriteable(mo, os);
         uint8_t *store = wos->getConcreteStore();
         assert(store);
@@ -2213,7 +3122,13 @@ bool S2EExecutor::merge(klee::ExecutionState &_base, klee::ExecutionState &_othe
     else if(other.m_active)
         doStateSwitch(&other, NULL);
 
+    materializeAllPages();
+
     if(base.merge(other)) {
+        //Merging may modify shared objects (e.g., the dirty mask) in place,
+        //forget what is currently stored in the shared locations.
+        m_residentObjects.clear();
+
         m_s2e->getMessagesStream(&base)
                 << "Merged with state " << other.getID() << '\n';
         return true;
@@ -2445,6 +3360,11 @@ void S2EExecutor::unrefS2ETb(S2ETranslationBlock* s2e_tb)
             S2EExternalDispatcher *s2eDispatcher = static_cast<S2EExternalDispatcher*>(externalDispatcher);
             s2eDispatcher->removeFunction(s2e_tb->llvm_function);
             kmodule->removeFunction(s2e_tb->llvm_function);
+
+            if (s2e_tb->unoptimizedFunction) {
+                s2eDispatcher->removeFunction(s2e_tb->unoptimizedFunction);
+                kmodule->removeFunction(s2e_tb->unoptimizedFunction);
+            }
         }
         foreach(void* s, s2e_tb->executionSignals) {
             delete static_cast<ExecutionSignal*>(s);
@@ -2531,6 +3451,13 @@ void s2e_register_ram(S2E* s2e, S2EExecutionState *initial_state,
         save_on_context_switch, name);
 }
 
+void s2e_materialize_host_ram(const void *host_address, uint64_t size)
+{
+    if (g_s2e && g_s2e->getExecutor()) {
+        g_s2e->getExecutor()->materializeHostRange((uint64_t) host_address, size);
+    }
+}
+
 void s2e_register_dirty_mask(S2E *s2e, S2EExecutionState *initial_state,
                             uint64_t host_address, uint64_t size)
 {
@@ -2640,6 +3567,8 @@ void s2e_tb_alloc(S2E*, TranslationBlock *tb)
     tb->s2e_tb = new S2ETranslationBlock;
     tb->s2e_tb->llvm_function = NULL;
     tb->s2e_tb->refCount = 1;
+    tb->s2e_tb->executionCount = 0;
+    tb->s2e_tb->unoptimizedFunction = NULL;
 
     /* Push one copy of a signal to use it as a cache */
     tb->s2e_tb->executionSignals.push_back(new s2e::ExecutionSignal);
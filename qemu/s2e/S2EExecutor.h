@@ -36,10 +36,14 @@
 #ifndef S2E_EXECUTOR_H
 #define S2E_EXECUTOR_H
 
+#include <klee/AddressSpace.h>
 #include <klee/Executor.h>
+#include <klee/ObjectHolder.h>
 #include <llvm/Support/raw_ostream.h>
 #include <cpu.h>
 
+#include <tr1/unordered_map>
+
 class TCGLLVMContext;
 
 struct TranslationBlock;
@@ -100,6 +104,78 @@ protected:
 
     std::vector<klee::MemoryObject*> m_saveOnContextSwitch;
 
+    /** For each entry of m_saveOnContextSwitch, the ObjectState whose
+        contents are currently stored in the shared location.
+        Used by incremental state switching to skip unchanged objects. */
+    std::vector<klee::ObjectHolder> m_residentObjects;
+
+    /** Lazy state switching: host pages of shared-concrete regions
+        (e.g., video RAM and ROMs) are protected on switch-in and only
+        filled from the resident ObjectStates when the first access faults.
+        m_lazyObjects marks the entries of m_saveOnContextSwitch that
+        cover whole host pages and can be restored this way. */
+    std::vector<bool> m_lazyObjects;
+
+    /** Objects whose shared location does not hold the resident object yet */
+    std::vector<bool> m_staleObjects;
+
+    /** Host regions that can be restored lazily, sorted by address.
+        The fault handler only reads the preallocated arrays below. */
+    struct LazyRegion {
+        uint64_t start;
+        uint64_t end;
+        /** Index of the first object of the region in m_saveOnContextSwitch */
+        unsigned firstObject;
+        /** Index of the first page of the region in m_protectedPages */
+        unsigned firstPage;
+
+        bool operator<(const LazyRegion &other) const {
+            return start < other.start;
+        }
+    };
+    std::vector<LazyRegion> m_lazyRegions;
+
+    /** Whether each host page of m_lazyRegions is currently protected */
+    std::vector<uint8_t> m_protectedPages;
+    unsigned m_protectedPageCount;
+
+    /** Concrete stores of the resident objects of protected pages */
+    std::vector<const uint8_t*> m_lazyStores;
+
+    uint64_t m_hostPageSize;
+
+    /** Number of pages materialized since the last state switch */
+    unsigned m_lazyPageFaults;
+
+    /** Fully concrete RAM object states indexed by a hash of their
+        memory object and contents, used to share identical copies */
+    typedef std::tr1::unordered_map<uint64_t, klee::ObjectHolder> RamObjectContents;
+    RamObjectContents m_ramObjectContents;
+
+    /** Size of m_ramObjectContents above which unused entries are dropped */
+    size_t m_ramObjectContentsLimit;
+
+    /** RAM page tables of the running state when it was switched in.
+        The RAM objects it wrote since then are deduplicated on switch-out. */
+    klee::ObjectPageTables m_dedupBaseline;
+    const S2EExecutionState *m_dedupBaselineState;
+
+    const klee::ObjectState *findIdenticalRamObject(const klee::MemoryObject *mo,
+                                                    const uint8_t *data,
+                                                    uint64_t hash);
+    void registerRamObjectContents(const klee::MemoryObject *mo, uint64_t hash,
+                                   klee::ObjectState *os);
+    void deduplicatePrivateRam(S2EExecutionState *state);
+
+    bool isLazyObjectUntouched(unsigned index, const klee::ObjectState *os);
+    const LazyRegion *findLazyPage(uint64_t hostAddress, unsigned *page) const;
+    void materializePage(const LazyRegion *region, unsigned page);
+    void materializeAllPages();
+
+    bool invalidateChangedCode(unsigned index, const klee::ObjectState *newOS);
+    unsigned invalidateChangedPrivateCode(const S2EExecutionState *oldState,
+                                          const S2EExecutionState *newState);
+
     std::vector<S2EExecutionState*> m_deletedStates;
 
     bool m_executeAlwaysKlee;
@@ -110,6 +186,17 @@ protected:
 
     bool m_inLoadBalancing;
 
+    /** Incremented on every state switch, used to find idle states */
+    uint64_t m_stateSwitchCount;
+
+    /** Memory usage in MB before the last check that swapped states out,
+        0 if it did not */
+    uint64_t m_swapUsageBefore;
+
+    /** Memory usage in MB at which swapping stopped lowering it, 0 if it
+        still does */
+    uint64_t m_swapStalledUsage;
+
     struct QEMUTimer *m_stateSwitchTimer;
 
     /** Holds the yielded state, if any */
@@ -223,6 +310,14 @@ public:
         return m_inLoadBalancing;
     }
 
+    /** Called from the SIGSEGV handler. Returns true if the fault was
+        caused by a page protected by lazy state switching. */
+    bool handleLazyPageFault(uint64_t hostAddress);
+
+    /** Restores the protected pages of the given host range, before
+        the host (e.g., a system call) accesses it directly */
+    void materializeHostRange(uint64_t hostAddress, uint64_t size);
+
     /** Kill the state with test case generation */
     virtual void terminateStateEarly(klee::ExecutionState &state, const llvm::Twine &message);
 
@@ -269,14 +364,27 @@ protected:
                                klee::KInstruction* target,
                                std::vector<klee::ref<klee::Expr> > &args);
     
+    klee::KFunction* getKFunction(llvm::Function *function);
+
     void prepareFunctionExecution(S2EExecutionState *state,
                            llvm::Function* function,
                            const std::vector<klee::ref<klee::Expr> >& args);
+
+    void optimizeHotTranslationBlock(TranslationBlock *tb);
     bool executeInstructions(S2EExecutionState *state, unsigned callerStackSize = 1);
 
+    bool mustExecuteInKlee(S2EExecutionState *state, TranslationBlock *tb,
+                           bool &coarseMask);
+
+    void prepareTranslationBlock(S2EExecutionState *state, TranslationBlock *tb,
+                                 bool executeKlee, bool coarseMask);
+
     uintptr_t executeTranslationBlockKlee(S2EExecutionState *state,
                                           TranslationBlock *tb);
 
+    TranslationBlock* getChainedTranslationBlock(S2EExecutionState *state,
+                                                 uintptr_t next_tb);
+
     uintptr_t executeTranslationBlockConcrete(S2EExecutionState *state,
                                               TranslationBlock *tb);
 
@@ -291,6 +399,10 @@ protected:
 
     void doLoadBalancing();
 
+    /** Swaps the device state of the least recently scheduled
+        states to disk when memory usage is over the limit */
+    void swapIdleStates();
+
     /** Copy concrete values to their proper location, concretizing
         if necessary (most importantly it will concretize CPU registers.
         Note: this is required only to execute generated code,
@@ -438,6 +550,13 @@ struct S2ETranslationBlock
         even after TranslationBlock is destroyed */
     llvm::Function* llvm_function;
 
+    /** Number of times the block was executed in KLEE */
+    unsigned executionCount;
+
+    /** The function that was replaced by the more optimized llvm_function
+        when the block became hot. States may still be executing it. */
+    llvm::Function* unoptimizedFunction;
+
     /** A list of all instruction execution signals associated with
         this basic block. All signals in the list will be deleted
         when this translation block will be flushed.
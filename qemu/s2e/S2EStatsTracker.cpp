@@ -37,6 +37,7 @@
 
 #include <s2e/S2EExecutor.h>
 #include <s2e/S2EExecutionState.h>
+#include <s2e/s2e_config.h>
 
 #include <klee/CoreStats.h>
 #include <klee/SolverStats.h>
@@ -74,6 +75,21 @@ namespace stats {
 
     Statistic concreteModeTime("ConcreteModeTime", "ConcModeTime");
     Statistic symbolicModeTime("SymbolicModeTime", "SymbModeTime");
+
+    Statistic llvmTranslationCacheHits("LLVMTranslationCacheHits", "LLVMCacheHits");
+    Statistic llvmTranslationCacheMisses("LLVMTranslationCacheMisses", "LLVMCacheMisses");
+
+    Statistic hotTranslationBlocks("HotTranslationBlocks", "HotTBs");
+    Statistic hotTranslationBlockStaticInstructionsRemoved("HotTranslationBlockStaticInstructionsRemoved", "HotTBSIRem");
+
+    Statistic chainedTranslationBlocks("ChainedTranslationBlocks", "ChTBs");
+
+    Statistic coarseMaskTranslationBlocks("CoarseMaskTranslationBlocks", "CMTBs");
+    Statistic deadSymbolicRegisters("DeadSymbolicRegisters", "DeadSymRegs");
+
+    Statistic swappedOutStates("SwappedOutStates", "SwpStates");
+
+    Statistic deduplicatedRamObjects("DeduplicatedRamObjects", "DedupRamObjs");
 } // namespace stats
 } // namespace klee
 
@@ -146,6 +162,9 @@ void S2EStatsTracker::writeStatsHeader() {
              << "('NumStates',"
              << "'NumQueries',"
              << "'NumQueryConstructs',"
+             << "'SharedQueryCacheHits',"
+             << "'SharedQueryCacheMisses',"
+             << "'ConcolicQueries',"
              << "'NumObjects',"
              //<< "'CoveredInstructions',"
              //<< "'UncoveredInstructions',"
@@ -157,6 +176,15 @@ void S2EStatsTracker::writeStatsHeader() {
              << "'CpuInstructionsKlee',"
              << "'ConcreteModeTime',"
              << "'SymbolicModeTime',"
+             << "'LLVMTranslationCacheHits',"
+             << "'LLVMTranslationCacheMisses',"
+             << "'HotTranslationBlocks',"
+             << "'HotTranslationBlockStaticInstructionsRemoved',"
+             << "'ChainedTranslationBlocks',"
+             << "'CoarseMaskTranslationBlocks',"
+             << "'DeadSymbolicRegisters',"
+             << "'SwappedOutStates',"
+             << "'DeduplicatedRamBytes',"
              << "'UserTime',"
              << "'WallTime',"
              << "'QueryTime',"
@@ -177,6 +205,9 @@ void S2EStatsTracker::writeStatsLine() {
              << "(" << executor.getStatesCount()
              << "," << stats::queries
              << "," << stats::queryConstructs
+             << "," << stats::sharedQueryCacheHits
+             << "," << stats::sharedQueryCacheMisses
+             << "," << stats::concolicQueries
              << "," << 0 // was numObjects
              //<< "," << stats::coveredInstructions
              //<< "," << stats::uncoveredInstructions
@@ -188,6 +219,15 @@ void S2EStatsTracker::writeStatsLine() {
              << "," << stats::cpuInstructionsKlee
              << "," << stats::concreteModeTime / 1000000.
              << "," << stats::symbolicModeTime / 1000000.
+             << "," << stats::llvmTranslationCacheHits
+             << "," << stats::llvmTranslationCacheMisses
+             << "," << stats::hotTranslationBlocks
+             << "," << stats::hotTranslationBlockStaticInstructionsRemoved
+             << "," << stats::chainedTranslationBlocks
+             << "," << stats::coarseMaskTranslationBlocks
+             << "," << stats::deadSymbolicRegisters
+             << "," << stats::swappedOutStates
+             << "," << stats::deduplicatedRamObjects * S2E_RAM_OBJECT_SIZE
              << "," << util::getUserTime()
              << "," << elapsed()
              << "," << stats::queryTime / 1000000.
@@ -51,6 +51,21 @@ namespace stats {
 
     extern klee::Statistic concreteModeTime;
     extern klee::Statistic symbolicModeTime;
+
+    extern klee::Statistic llvmTranslationCacheHits;
+    extern klee::Statistic llvmTranslationCacheMisses;
+
+    extern klee::Statistic hotTranslationBlocks;
+    extern klee::Statistic hotTranslationBlockStaticInstructionsRemoved;
+
+    extern klee::Statistic chainedTranslationBlocks;
+
+    extern klee::Statistic coarseMaskTranslationBlocks;
+    extern klee::Statistic deadSymbolicRegisters;
+
+    extern klee::Statistic swappedOutStates;
+
+    extern klee::Statistic deduplicatedRamObjects;
 } // namespace stats
 } // namespace klee
 
@@ -132,27 +132,34 @@ uintptr_t PageAllocator::allocPage()
     }
 
     uintptr_t ret = reg + index * getPageSize();
+#ifdef DEBUG_ALLOC
     memset((void*)ret, 0xAA, getPageSize());
+#endif
     return ret;
 }
 
 void PageAllocator::freePage(uintptr_t page)
 {
+#ifdef DEBUG_ALLOC
     memset((void*)page, 0xBB, getPageSize());
+#endif
 
-    RegionMap::iterator it = m_regions.find(page);
+    RegionMap::iterator it =
+            findRegion<RegionMap, RegionMap::iterator>(m_regions, page);
     if (it == m_regions.end()) {
 #ifdef DEBUG_ALLOC
         std::cout << "busy size " << std::dec << m_busyRegions.size() << std::endl;
         std::cout << "freeing " << std::hex << page << std::dec << std::endl;
 #endif
 
-        RegionSet::iterator itr = m_busyRegions.find(page);
+        RegionSet::iterator itr =
+                findRegion<RegionSet, RegionSet::iterator>(m_busyRegions, page);
         assert(itr != m_busyRegions.end());
-        uint64_t index = (page - (*itr)) / getPageSize();
+        uintptr_t region = *itr;
+        uint64_t index = (page - region) / getPageSize();
 
-        m_busyRegions.erase(*itr);
-        m_regions[*itr] = (1LL << index);
+        m_busyRegions.erase(itr);
+        m_regions[region] = (1LL << index);
         return;
     }
 
@@ -173,30 +180,12 @@ void PageAllocator::freePage(uintptr_t page)
     return;
 }
 
-//XXX: this needs to be seriously optimized
 bool PageAllocator::belongsToUs(uintptr_t addr) const
 {
-    RegionMap::const_iterator it;
-    RegionSet::const_iterator sit;
-    bool inreg = false;
-
-    for(it = m_regions.begin(); it != m_regions.end(); ++it) {
-        uintptr_t a = (*it).first;
-        if (addr >= a && addr < a + REGION_SIZE) {
-            inreg = true;
-            break;
-        }
-    }
-
-    for(sit = m_busyRegions.begin(); sit != m_busyRegions.end(); ++sit) {
-        uintptr_t a = (*sit);
-        if (addr >= a && addr < a + REGION_SIZE) {
-            inreg = true;
-            break;
-        }
-    }
-
-    return inreg;
+    return findRegion<const RegionMap, RegionMap::const_iterator>(m_regions, addr)
+                != m_regions.end() ||
+           findRegion<const RegionSet, RegionSet::const_iterator>(m_busyRegions, addr)
+                != m_busyRegions.end();
 }
 
 
@@ -211,6 +200,7 @@ BlockAllocator::BlockAllocator(PageAllocator *pa, unsigned blockSizePo2, uint8_t
     m_freePagesCount = 0;
     m_busyPagesCount = 0;
     m_freeBlocksCount = 0;
+    m_emptyPagesCount = 0;
 
     m_allocatedBlocksCount = 0;
 
@@ -239,6 +229,7 @@ uintptr_t BlockAllocator::expand()
     list_insert_tail(&m_totallyFreeList, &hdr->link);
 
     m_freePagesCount++;
+    m_emptyPagesCount++;
     m_freeBlocksCount += m_blocksPerPage;
     return newPage;
 }
@@ -256,6 +247,7 @@ void BlockAllocator::shrink()
     page = containing_record(entry, BlockAllocatorHdr, link);
     m_pa->freePage((uintptr_t)page);
     m_freePagesCount--;
+    m_emptyPagesCount--;
     m_freeBlocksCount -= m_blocksPerPage;
 }
 
@@ -291,6 +283,7 @@ uintptr_t BlockAllocator::alloc()
     if (page->freeCount == m_blocksPerPage - 1) {
         list_remove_entry(&page->link);
         list_insert_head(&m_freeList, &page->link);
+        m_emptyPagesCount--;
     }
 
     if (!page->freeCount) {
@@ -303,7 +296,9 @@ uintptr_t BlockAllocator::alloc()
     m_allocatedBlocksCount++;
 
     uintptr_t ret = ((uintptr_t)page) + sizeof(BlockAllocatorHdr) + fb * m_blockSize;
+#ifdef DEBUG_ALLOC
     memset((void*)ret, 0xEB, m_blockSize);
+#endif
     return ret;
 }
 
@@ -316,7 +311,9 @@ void BlockAllocator::free(uintptr_t b)
     assert(hdr->signature == (BLOCK_HDR_SIGNATURE | m_magic));
 
 
+#ifdef DEBUG_ALLOC
     memset((void*)b, 0xDB, m_blockSize);
+#endif
 
     unsigned index = ((b & (m_pageSize-1)) - sizeof(BlockAllocatorHdr)) / m_blockSize;
 
@@ -334,6 +331,12 @@ void BlockAllocator::free(uintptr_t b)
     if (hdr->freeCount == m_blocksPerPage) {
       list_remove_entry(&hdr->link);
       list_insert_head(&m_totallyFreeList, &hdr->link);
+      m_emptyPagesCount++;
+
+      //Keep a few empty pages around to absorb allocation bursts
+      if (m_emptyPagesCount > MAX_EMPTY_PAGES) {
+          shrink();
+      }
     }
 
 
@@ -348,7 +351,7 @@ SlabAllocator::SlabAllocator(unsigned minPo2, unsigned maxPo2)
 
     m_pa = new PageAllocator();
 
-    m_bas = new BlockAllocator*[m_maxPo2 - m_minPo2];
+    m_bas = new BlockAllocator*[m_maxPo2 - m_minPo2 + 1];
 
     for (unsigned i=0; i<=(m_maxPo2 - m_minPo2); ++i) {
         m_bas[i] = new BlockAllocator(m_pa, i + m_minPo2, i + m_minPo2);
@@ -357,6 +360,9 @@ SlabAllocator::SlabAllocator(unsigned minPo2, unsigned maxPo2)
 
 SlabAllocator::~SlabAllocator()
 {
+    for (unsigned i=0; i<=(m_maxPo2 - m_minPo2); ++i) {
+        delete m_bas[i];
+    }
     delete [] m_bas;
     delete m_pa;
 }
@@ -413,12 +419,13 @@ uintptr_t SlabAllocator::alloc(size_t size)
 
 bool SlabAllocator::free(uintptr_t addr)
 {
-    BlockAllocator *b = getSlab(addr);
-    if (!b) {
-        //std::cerr << "Invalid addr " << std::hex << addr << std::dec << std::endl;
+    //The page header of foreign blocks must not be trusted
+    if (!m_pa->belongsToUs(addr)) {
         return false;
     }
-    assert(m_pa->belongsToUs(addr));
+
+    BlockAllocator *b = getSlab(addr);
+    assert(b);
 
     b->free(addr);
     return true;
@@ -429,22 +436,27 @@ bool SlabAllocator::isValid(uintptr_t addr) const
     return getSlab(addr) != NULL;
 }
 
-void SlabAllocator::printStats(std::ostream &os) const
+void SlabAllocator::printStats(llvm::raw_ostream &os) const
 {
     uint64_t totalSize = 0;
+    uint64_t totalPages = 0;
 
-    os << std::dec << "Allocator statistics" << std::endl;
+    os << "Allocator statistics\n";
     for (unsigned i=m_minPo2; i<= m_maxPo2; ++i) {
-        totalSize += (1<<i) * m_bas[i-m_minPo2]->getAllocatedBlocksCount();
-        os << "[" << (1<<i) <<  "] allocatedBlocks:" << m_bas[i-m_minPo2]->getAllocatedBlocksCount() << std::endl;
+        const BlockAllocator *ba = m_bas[i-m_minPo2];
+        totalSize += (1<<i) * ba->getAllocatedBlocksCount();
+        totalPages += ba->getPagesCount();
+        os << "[" << (1<<i) <<  "] allocatedBlocks:" << ba->getAllocatedBlocksCount()
+           << " pages:" << ba->getPagesCount() << '\n';
     }
-    os << "Total size:" << totalSize << std::endl;
+    os << "Total size:" << totalSize
+       << " Total pages:" << totalPages << '\n';
 }
 
 static SlabAllocator *s_slab = NULL;
 
 
-void slab_print_stats(std::ostream &os)
+void slab_print_stats(llvm::raw_ostream &os)
 {
     if (!s_slab) {
         return;
@@ -473,7 +485,7 @@ void* operator new (size_t size)
     if (!s2e::s_slab || s_inalloc) {
         void *p = malloc(size);
         if (!p) {
-            throw new std::bad_alloc();
+            throw std::bad_alloc();
         }
         return p;
     }
@@ -487,7 +499,7 @@ void* operator new (size_t size)
 
     void *p = malloc(size);
     if (!p) {
-        throw new std::bad_alloc();
+        throw std::bad_alloc();
     }
 
     s_inalloc = false;
@@ -502,14 +514,16 @@ void operator delete (void *p)
         return;
     }
 
+    //Freeing a block may release pages and update the region maps,
+    //which must not recurse into the slab allocator
+    bool inalloc = s_inalloc;
     s_inalloc = true;
 
     if (!s2e::s_slab->free((uintptr_t)p)) {
-        assert(!s2e::s_slab->getPageAllocator()->belongsToUs((uintptr_t)p));
         free(p);
     }
 
-    s_inalloc = false;
+    s_inalloc = inalloc;
 }
 
 
@@ -46,6 +46,8 @@
 #include <vector>
 #include <set>
 
+#include <llvm/Support/raw_ostream.h>
+
 #include "machine.h"
 
 namespace s2e
@@ -120,18 +122,31 @@ static inline list_t* list_remove_tail(list_t* list_head)
 class PageAllocator
 {
 private:
-    struct RegCmp {
-        bool operator() (uintptr_t r1, uintptr_t r2) const {
-            return r1 + REGION_SIZE <= r2;
-        }
-    };
-
     //region offset to bitmap
-    typedef std::map<uintptr_t, uintptr_t, RegCmp> RegionMap;
-    typedef std::set<uintptr_t, RegCmp> RegionSet;
+    typedef std::map<uintptr_t, uintptr_t> RegionMap;
+    typedef std::set<uintptr_t> RegionSet;
     RegionMap m_regions;
     RegionSet m_busyRegions;
 
+    //Return the region that contains addr, or end()
+    template <typename C, typename I>
+    static I findRegion(C &regions, uintptr_t addr) {
+        I it = regions.upper_bound(addr);
+        if (it == regions.begin()) {
+            return regions.end();
+        }
+        --it;
+        return addr - getRegionStart(*it) < REGION_SIZE ? it : regions.end();
+    }
+
+    static uintptr_t getRegionStart(uintptr_t region) {
+        return region;
+    }
+
+    static uintptr_t getRegionStart(const RegionMap::value_type &region) {
+        return region.first;
+    }
+
 private:
     inline uintptr_t getRegionSize() const {
         return REGION_SIZE;
@@ -239,6 +254,11 @@ private:
     uint64_t m_busyPagesCount;
     uint64_t m_freeBlocksCount;
 
+    //Pages without allocated blocks, returned to the page
+    //allocator beyond MAX_EMPTY_PAGES
+    uint64_t m_emptyPagesCount;
+    static const unsigned MAX_EMPTY_PAGES = 16;
+
     uint64_t m_allocatedBlocksCount;
     uint8_t m_magic;
 
@@ -259,6 +279,10 @@ public:
     uint64_t getAllocatedBlocksCount() const {
         return m_allocatedBlocksCount;
     }
+
+    uint64_t getPagesCount() const {
+        return m_freePagesCount + m_busyPagesCount;
+    }
 };
 
 
@@ -280,13 +304,20 @@ public:
     bool free(uintptr_t addr);
     bool isValid(uintptr_t addr) const;
 
-    void printStats(std::ostream &os) const;
+    void printStats(llvm::raw_ostream &os) const;
 
     const PageAllocator *getPageAllocator() const {
         return m_pa;
     }
 };
 
+void slab_print_stats(llvm::raw_ostream &os);
+
+}
+
+extern "C" {
+/** Routes small C++ allocations through the slab allocator */
+void slab_init();
 }
 
 
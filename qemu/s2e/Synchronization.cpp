@@ -46,6 +46,16 @@
 #include <iostream>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sched.h>
+#else
+#include <windows.h>
+#endif
+
+#ifdef CONFIG_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
 #endif
 
 #ifdef CONFIG_DARWIN
@@ -92,6 +102,19 @@ void S2ESynchronizedObjectInternal::release()
 
 }
 
+void *S2ESynchronizedObjectInternal::wait(unsigned timeoutMs)
+{
+    //Do not sleep with the lock held, like on the other hosts
+    release();
+    Sleep(timeoutMs);
+    return acquire();
+}
+
+void S2ESynchronizedObjectInternal::notifyAll()
+{
+
+}
+
 uint64_t AtomicFunctions::read(uint64_t *address)
 {
    return __sync_fetch_and_add(address, 0);
@@ -123,8 +146,15 @@ struct SyncHeader{
 #else
     sem_t lock;
 #endif
+
+    //Incremented by notifyAll(), waited on by wait()
+    int generation;
 };
 
+//How many times to retry a contended lock before sleeping.
+//Most critical sections only update a couple of counters.
+static const unsigned SYNC_SPIN_COUNT = 100;
+
 
 S2ESynchronizedObjectInternal::S2ESynchronizedObjectInternal(unsigned size) {
     m_size = size;
@@ -140,6 +170,8 @@ S2ESynchronizedObjectInternal::S2ESynchronizedObjectInternal(unsigned size) {
 
     SyncHeader *hdr = static_cast<SyncHeader*>((void*)m_sharedBuffer);
 
+    hdr->generation = 0;
+
 #ifdef CONFIG_DARWIN
     hdr->lock = 1;
 #else
@@ -164,10 +196,22 @@ S2ESynchronizedObjectInternal::~S2ESynchronizedObjectInternal()
 void *S2ESynchronizedObjectInternal::acquire() {
     SyncHeader *hdr = (SyncHeader*)m_sharedBuffer;
 #ifdef CONFIG_DARWIN
-    while (__sync_lock_test_and_set(&hdr->lock, 0) != 0);
+    unsigned spins = 0;
+    while (__sync_lock_test_and_set(&hdr->lock, 0) != 0) {
+        if (++spins > SYNC_SPIN_COUNT) {
+            sched_yield();
+        }
+    }
 #else
     int ret;
 
+    //Spin briefly before blocking in the kernel
+    for (unsigned i = 0; i < SYNC_SPIN_COUNT; ++i) {
+        if (sem_trywait(&hdr->lock) == 0) {
+            return ((uint8_t*)m_sharedBuffer + m_headerSize);
+        }
+    }
+
      do {
         ret = sem_wait(&hdr->lock);
         if (ret < 0) {
@@ -213,6 +257,42 @@ void S2ESynchronizedObjectInternal::release()
 #endif
 }
 
+void *S2ESynchronizedObjectInternal::wait(unsigned timeoutMs)
+{
+    SyncHeader *hdr = (SyncHeader*)m_sharedBuffer;
+    int generation = hdr->generation;
+
+    release();
+
+#ifdef CONFIG_LINUX
+    //Returns immediately if notifyAll() was called after we released the lock
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+    syscall(SYS_futex, &hdr->generation, FUTEX_WAIT, generation, &timeout, NULL, 0);
+#else
+    //No portable way to block on shared memory, poll the generation
+    for (unsigned i = 0; i < timeoutMs / 10; ++i) {
+        if (__sync_fetch_and_add(&hdr->generation, 0) != generation) {
+            break;
+        }
+        usleep(10000);
+    }
+#endif
+
+    return acquire();
+}
+
+void S2ESynchronizedObjectInternal::notifyAll()
+{
+    SyncHeader *hdr = (SyncHeader*)m_sharedBuffer;
+    __sync_fetch_and_add(&hdr->generation, 1);
+
+#ifdef CONFIG_LINUX
+    syscall(SYS_futex, &hdr->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
 uint64_t AtomicFunctions::read(uint64_t *address)
 {
     return __sync_fetch_and_add(address, 0);
@@ -60,6 +60,11 @@ public:
     void *acquire();
     void *tryAquire();
 
+    //Must be called with the lock held. Releases the lock, sleeps until
+    //notifyAll() is called or the timeout expires, and reacquires the lock.
+    void *wait(unsigned timeoutMs);
+    void notifyAll();
+
     //Unsynchronized function to get the buffer
     void *get() const {
         return ((uint8_t*)m_sharedBuffer)+m_headerSize;
@@ -100,6 +105,17 @@ public:
         sync.release();
     }
 
+    //Sleeps until another process calls notifyAll(), or until
+    //the timeout expires. The object must be acquired.
+    T *wait(unsigned timeoutMs) {
+        return (T*)sync.wait(timeoutMs);
+    }
+
+    //Wakes up all the processes blocked in wait()
+    void notifyAll() {
+        sync.notifyAll();
+    }
+
     T* get() const {
         return (T*)sync.get();
     }
@@ -58,8 +58,6 @@
 #define S2E_RAM_OBJECT_SIZE (1 << S2E_RAM_OBJECT_BITS)
 #define S2E_RAM_OBJECT_MASK (~(S2E_RAM_OBJECT_SIZE - 1))
 
-#define S2E_MEMCACHE_SUPERPAGE_BITS 20
-
 /** Enables simple memory debugging support */
 //#define S2E_DEBUG_MEMORY
 //#define S2E_DEBUG_TLBCACHE
@@ -203,6 +203,11 @@ void s2e_register_ram(struct S2E* s2e,
 
 uintptr_t s2e_get_host_address(target_phys_addr_t paddr);
 
+/** Restores the lazily switched pages of the given host range. Code that
+    passes guest memory to the host (e.g., to a system call or to another
+    thread) must call this first. */
+void s2e_materialize_host_ram(const void *host_address, uint64_t size);
+
 int s2e_is_ram_registered(struct S2E* s2e,
                           struct S2EExecutionState *state,
                           uint64_t host_address);
@@ -86,10 +86,24 @@ static void *qemu_st_helpers[5] = {
 
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/ADT/OwningPtr.h>
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <set>
 #include <sstream>
 
+#include <dirent.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
 
 //#undef NDEBUG
 
@@ -141,6 +155,29 @@ struct TCGLLVMContextPrivate {
     /* Count of generated translation blocks */
     int m_tbCount;
 
+    /* Persistent translation cache (disabled if the directory is empty) */
+    std::string m_cacheDir;
+    uint64_t m_cacheHits;
+    uint64_t m_cacheMisses;
+
+    /* Size limit of the cache directory in bytes (0 for no limit) and
+       estimate of its current size */
+    uint64_t m_cacheMaxSize;
+    uint64_t m_cacheSize;
+
+    /* Identifies the QEMU binary whose code the cached functions call */
+    uint64_t m_binaryId;
+
+    /* Host pointers embedded in the block being translated and the
+       position of the last one in gen_opparam_buf */
+    std::set<uint64_t> m_pendingRelocations;
+    unsigned m_lastRelocationIndex;
+
+    /* Host pointers of the current block in a run-independent order,
+       computed with the cache key. They are patched on load. */
+    std::vector<uint64_t> m_relocations;
+    bool m_cacheable;
+
     /* XXX: The following members are "local" to generateCode method */
 
     /* TCGContext for current translation block */
@@ -261,7 +298,19 @@ public:
     void generateTraceCall(uintptr_t pc);
     int generateOperation(int opc, const TCGArg *args);
 
+    void generateFunction(TCGContext *s, TranslationBlock *tb,
+                          const std::string &name);
     void generateCode(TCGContext *s, TranslationBlock *tb);
+
+    /* Persistent translation cache */
+    void setCacheDir(const std::string &dir, uint64_t maxSize);
+    void addRelocation(uint64_t value);
+    uint64_t computeCacheKey(TCGContext *s, TranslationBlock *tb);
+    void trimCache();
+    std::string getCacheFileName(uint64_t key);
+    bool loadCachedFunction(uint64_t key, TranslationBlock *tb,
+                            const std::string &name);
+    void saveCachedFunction(uint64_t key, TranslationBlock *tb);
 };
 
 /* Custom JITMemoryManager in order to capture the size of
@@ -353,6 +402,8 @@ public:
 
 TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     : m_context(getGlobalContext()), m_builder(m_context), m_tbCount(0),
+      m_cacheHits(0), m_cacheMisses(0), m_cacheMaxSize(0), m_cacheSize(0),
+      m_binaryId(0), m_lastRelocationIndex(0), m_cacheable(false),
       m_tcgContext(NULL), m_tbFunction(NULL)
 {
     std::memset(m_values, 0, sizeof(m_values));
@@ -1323,13 +1374,10 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
     return nb_args;
 }
 
-void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+void TCGLLVMContextPrivate::generateFunction(TCGContext *s,
+                                             TranslationBlock *tb,
+                                             const std::string &name)
 {
-    /* Create new function for current translation block */
-    /* TODO: compute the checksum of the tb to see if we can reuse some code */
-    std::ostringstream fName;
-    fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
-
     /*
     if(m_tbFunction)
         m_tbFunction->eraseFromParent();
@@ -1339,7 +1387,7 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
             wordType(),
             std::vector<llvm::Type*>(1, intPtrType(64)), false);
     m_tbFunction = Function::Create(tbFunctionType,
-            Function::PrivateLinkage, fName.str(), m_module);
+            Function::PrivateLinkage, name, m_module);
     BasicBlock *basicBlock = BasicBlock::Create(m_context,
             "entry", m_tbFunction);
     m_builder.SetInsertPoint(basicBlock);
@@ -1402,6 +1450,30 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
 
     //KLEE will optimize the function later
     //m_functionPassManager->run(*m_tbFunction);
+}
+
+void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+{
+    /* Create new function for current translation block */
+    std::ostringstream fName;
+    fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
+
+    if (m_cacheDir.empty()) {
+        generateFunction(s, tb, fName.str());
+    } else {
+        uint64_t key = computeCacheKey(s, tb);
+        if (m_cacheable && loadCachedFunction(key, tb, fName.str())) {
+            ++m_cacheHits;
+        } else {
+            ++m_cacheMisses;
+            generateFunction(s, tb, fName.str());
+            if (m_cacheable) {
+                saveCachedFunction(key, tb);
+            }
+        }
+        m_pendingRelocations.clear();
+        m_lastRelocationIndex = 0;
+    }
 
     tb->llvm_function = m_tbFunction;
 
@@ -1434,6 +1506,473 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
     }
 }
 
+/***********************************/
+/* Persistent translation cache    */
+
+/* The cache stores one bitcode file per translation block. The file name
+ * is a hash of the TCG ops of the block, which depend on the guest code,
+ * the cpu flags and the TB flags, as well as on any instrumentation
+ * inserted during translation. Host pointers are excluded from the hash,
+ * because they change from run to run:
+ * - the address of the TB itself, returned by exit_tb;
+ * - the fields of tcg_llvm_runtime that the generated code writes;
+ * - helper addresses, replaced by the helper names;
+ * - the pointers that the translator marked with tcg_llvm_add_relocation()
+ *   (e.g., the ExecutionSignal of S2E's instrumentation).
+ * The file records their values, which are patched when it is loaded. */
+
+static const char *TB_CACHE_FUNCTION = "tcg-llvm-cached-tb";
+static const char *TB_CACHE_METADATA = "tcg-llvm-cache";
+static const char *TB_CACHE_RELOCATIONS = "tcg-llvm-cache-relocations";
+
+static inline uint64_t hashCombine(uint64_t hash, uint64_t value)
+{
+    /* FNV-1a */
+    for (unsigned i = 0; i < sizeof(value); ++i) {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static inline uint64_t hashString(uint64_t hash, const char *str)
+{
+    for (; *str; ++str) {
+        hash ^= (uint8_t) *str;
+        hash *= 0x100000001b3ULL;
+    }
+    return hashCombine(hash, 0);
+}
+
+/* Replaces the relocated host pointers in c, which may be
+   wrapped in an inttoptr */
+static Constant *relocateConstant(Constant *c,
+                                  const std::map<uint64_t, uint64_t> &relocations)
+{
+    if (ConstantInt *ci = dyn_cast<ConstantInt>(c)) {
+        if (ci->getBitWidth() > 64) {
+            return c;
+        }
+        std::map<uint64_t, uint64_t>::const_iterator it =
+                relocations.find(ci->getZExtValue());
+        return it == relocations.end() ? c :
+                ConstantInt::get(ci->getType(), it->second);
+    }
+
+    ConstantExpr *ce = dyn_cast<ConstantExpr>(c);
+    if (ce && ce->getOpcode() == Instruction::IntToPtr) {
+        Constant *op = relocateConstant(ce->getOperand(0), relocations);
+        if (op != ce->getOperand(0)) {
+            return ConstantExpr::getIntToPtr(op, ce->getType());
+        }
+    }
+    return c;
+}
+
+static bool referencesGlobalValue(Constant *c)
+{
+    if (isa<GlobalValue>(c)) {
+        return true;
+    }
+
+    for (unsigned i = 0; i < c->getNumOperands(); ++i) {
+        if (referencesGlobalValue(cast<Constant>(c->getOperand(i)))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TCGLLVMContextPrivate::setCacheDir(const std::string &dir,
+                                        uint64_t maxSize)
+{
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        std::cerr << "Could not create LLVM translation cache directory "
+                  << dir << std::endl;
+        return;
+    }
+    m_cacheDir = dir;
+    m_cacheMaxSize = maxSize;
+
+    /* Generated code calls QEMU's helpers by name and the generator
+       may change, make sure the cache is not reused by another binary */
+    struct stat st;
+    if (stat("/proc/self/exe", &st) == 0) {
+        m_binaryId = hashCombine(hashCombine(0xcbf29ce484222325ULL,
+                                             st.st_size), st.st_mtime);
+    }
+
+    if (m_cacheMaxSize) {
+        trimCache();
+    }
+}
+
+/* Evicts the least recently used files once the cache directory
+   exceeds its size limit. Several processes may share the directory,
+   so its size is measured again every time. */
+void TCGLLVMContextPrivate::trimCache()
+{
+    DIR *dir = opendir(m_cacheDir.c_str());
+    if (!dir) {
+        return;
+    }
+
+    std::vector<std::pair<time_t, std::pair<std::string, uint64_t> > > files;
+    uint64_t totalSize = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        std::string name = entry->d_name;
+        if (name.size() < 3 || name.compare(name.size() - 3, 3, ".bc")) {
+            continue;
+        }
+
+        std::string path = m_cacheDir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) {
+            continue;
+        }
+
+        files.push_back(std::make_pair(st.st_mtime,
+                                       std::make_pair(path, (uint64_t) st.st_size)));
+        totalSize += st.st_size;
+    }
+    closedir(dir);
+
+    /* Go down to 3/4 of the limit, so that this does not run on every save */
+    if (totalSize > m_cacheMaxSize) {
+        std::sort(files.begin(), files.end());
+        for (unsigned i = 0; i < files.size() &&
+                             totalSize > m_cacheMaxSize / 4 * 3; ++i) {
+            if (unlink(files[i].second.first.c_str()) == 0) {
+                totalSize -= files[i].second.second;
+            }
+        }
+    }
+
+    m_cacheSize = totalSize;
+}
+
+/* The movi that puts value in a temp must be the last op emitted. The
+   optimizer may move or copy it, so relocations are matched by value. */
+void TCGLLVMContextPrivate::addRelocation(uint64_t value)
+{
+    assert(gen_opparam_ptr > gen_opparam_buf &&
+           gen_opparam_ptr[-1] == (TCGArg) value);
+
+    /* Drop the entries of a translation that did not generate LLVM code */
+    unsigned index = gen_opparam_ptr - gen_opparam_buf;
+    if (index <= m_lastRelocationIndex) {
+        m_pendingRelocations.clear();
+    }
+    m_lastRelocationIndex = index;
+    m_pendingRelocations.insert(value);
+}
+
+uint64_t TCGLLVMContextPrivate::computeCacheKey(TCGContext *s,
+                                                TranslationBlock *tb)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    std::vector<uint64_t> constants;
+
+    hash = hashCombine(hash, m_binaryId);
+    hash = hashCombine(hash, execute_llvm);
+
+    hash = hashCombine(hash, tb->pc);
+    hash = hashCombine(hash, tb->cs_base);
+    hash = hashCombine(hash, tb->flags);
+    hash = hashCombine(hash, tb->size);
+
+    m_relocations.clear();
+#ifdef CONFIG_S2E
+    m_relocations.push_back((uintptr_t) &tcg_llvm_runtime.goto_tb);
+#else
+    m_relocations.push_back((uintptr_t) &tcg_llvm_runtime.last_opc_index);
+    m_relocations.push_back((uintptr_t) &tcg_llvm_runtime.last_pc);
+#endif
+
+    const TCGArg *args = gen_opparam_buf;
+    for (int opc_index = 0; ; ++opc_index) {
+        int opc = gen_opc_buf[opc_index];
+        hash = hashCombine(hash, opc);
+
+        if (opc == INDEX_op_end)
+            break;
+
+        int nb_args = tcg_op_defs[opc].nb_args;
+        if (opc == INDEX_op_call) {
+            nb_args = (args[0] >> 16) + (args[0] & 0xffff) +
+                      tcg_op_defs[opc].nb_cargs + 1;
+        } else if (opc == INDEX_op_nopn) {
+            nb_args = args[0];
+        }
+
+        bool isMovi = opc == INDEX_op_movi_i32;
+#if TCG_TARGET_REG_BITS == 64
+        isMovi |= opc == INDEX_op_movi_i64;
+#endif
+
+        for (int i = 0; i < nb_args; ++i) {
+            uint64_t arg = args[i];
+            if (opc == INDEX_op_exit_tb && (arg & ~3) == (uintptr_t) tb) {
+                arg = (arg & 3) | 0x7b;
+            } else if (isMovi && i == 1) {
+                const char *helperName = tcg_helper_get_name(s, (void*) args[i]);
+
+                if (m_pendingRelocations.count(arg)) {
+                    m_relocations.push_back(arg);
+                    arg = 0x7c;
+                } else if (helperName) {
+                    m_relocations.push_back(arg);
+                    hash = hashString(hash, helperName);
+                    arg = 0x7d;
+                } else {
+                    constants.push_back(arg);
+                }
+            }
+            hash = hashCombine(hash, arg);
+        }
+
+        args += nb_args;
+    }
+
+    /* Patching could not tell a guest constant from a pointer of
+       the same value, do not cache such blocks */
+    m_cacheable = true;
+    std::sort(constants.begin(), constants.end());
+    for (unsigned i = 0; i < m_relocations.size(); ++i) {
+        if (std::binary_search(constants.begin(), constants.end(),
+                               m_relocations[i])) {
+            m_cacheable = false;
+            break;
+        }
+    }
+
+    return hash;
+}
+
+std::string TCGLLVMContextPrivate::getCacheFileName(uint64_t key)
+{
+    std::ostringstream ss;
+    ss << m_cacheDir << "/" << std::hex << key << ".bc";
+    return ss.str();
+}
+
+bool TCGLLVMContextPrivate::loadCachedFunction(uint64_t key,
+                                               TranslationBlock *tb,
+                                               const std::string &name)
+{
+    OwningPtr<MemoryBuffer> buffer;
+    if (MemoryBuffer::getFile(getCacheFileName(key), buffer)) {
+        return false;
+    }
+
+    std::string error;
+    OwningPtr<Module> cacheModule(
+            ParseBitcodeFile(buffer.get(), m_context, &error));
+    if (!cacheModule) {
+        return false;
+    }
+
+    Function *cachedFunction = cacheModule->getFunction(TB_CACHE_FUNCTION);
+    NamedMDNode *md = cacheModule->getNamedMetadata(TB_CACHE_METADATA);
+    if (!cachedFunction || !md || md->getNumOperands() != 1) {
+        return false;
+    }
+
+    /* Guard against hash collisions */
+    MDNode *info = md->getOperand(0);
+    uint64_t values[5];
+    for (unsigned i = 0; i < 5; ++i) {
+        ConstantInt *ci = dyn_cast_or_null<ConstantInt>(info->getOperand(i));
+        if (!ci) {
+            return false;
+        }
+        values[i] = ci->getZExtValue();
+    }
+
+    uint64_t cachedTb = values[1];
+    if (values[0] != key || values[2] != tb->pc ||
+        values[3] != tb->cs_base || values[4] != tb->flags) {
+        return false;
+    }
+
+    /* Map the host pointers of the run that saved the block to ours */
+    NamedMDNode *relocMd = cacheModule->getNamedMetadata(TB_CACHE_RELOCATIONS);
+    if (!relocMd || relocMd->getNumOperands() != 1) {
+        return false;
+    }
+
+    MDNode *relocInfo = relocMd->getOperand(0);
+    if (relocInfo->getNumOperands() != m_relocations.size()) {
+        return false;
+    }
+
+    std::map<uint64_t, uint64_t> relocations;
+    for (unsigned i = 0; i < m_relocations.size(); ++i) {
+        ConstantInt *ci = dyn_cast_or_null<ConstantInt>(relocInfo->getOperand(i));
+        if (!ci) {
+            return false;
+        }
+
+        std::pair<std::map<uint64_t, uint64_t>::iterator, bool> res =
+            relocations.insert(std::make_pair(ci->getZExtValue(), m_relocations[i]));
+        if (!res.second && res.first->second != m_relocations[i]) {
+            return false;
+        }
+    }
+
+    /* All the functions called by the block must already exist */
+    ValueToValueMapTy vmap;
+    for (Module::iterator it = cacheModule->begin();
+         it != cacheModule->end(); ++it) {
+        Function *f = &*it;
+        if (f == cachedFunction) {
+            continue;
+        }
+
+        Function *target = m_module->getFunction(f->getName());
+        if (!target || target->getFunctionType() != f->getFunctionType()) {
+            return false;
+        }
+        vmap[f] = target;
+    }
+
+    m_tbFunction = Function::Create(cachedFunction->getFunctionType(),
+            Function::PrivateLinkage, name, m_module);
+
+    Function::arg_iterator newArg = m_tbFunction->arg_begin();
+    for (Function::const_arg_iterator arg = cachedFunction->arg_begin();
+         arg != cachedFunction->arg_end(); ++arg, ++newArg) {
+        vmap[arg] = newArg;
+    }
+
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(m_tbFunction, cachedFunction, vmap, true, returns);
+    m_tbFunction->setLinkage(Function::PrivateLinkage);
+
+    /* Patch the TB pointers returned by exit_tb */
+    for (unsigned i = 0; i < returns.size(); ++i) {
+        ConstantInt *ret = dyn_cast_or_null<ConstantInt>(
+                returns[i]->getReturnValue());
+        if (ret && cachedTb && (ret->getZExtValue() & ~3) == cachedTb) {
+            returns[i]->setOperand(0, ConstantInt::get(wordType(),
+                    (uintptr_t) tb | (ret->getZExtValue() & 3)));
+        }
+    }
+
+    /* Patch the other host pointers */
+    for (Function::iterator bb = m_tbFunction->begin();
+         bb != m_tbFunction->end(); ++bb) {
+        for (BasicBlock::iterator inst = bb->begin(); inst != bb->end(); ++inst) {
+            if (isa<ReturnInst>(inst)) {
+                continue;
+            }
+            for (unsigned i = 0; i < inst->getNumOperands(); ++i) {
+                Constant *c = dyn_cast<Constant>(inst->getOperand(i));
+                if (c && !isa<GlobalValue>(c)) {
+                    Constant *relocated = relocateConstant(c, relocations);
+                    if (relocated != c) {
+                        inst->setOperand(i, relocated);
+                    }
+                }
+            }
+        }
+    }
+
+    /* Keep recently used files when trimming the cache */
+    if (m_cacheMaxSize) {
+        utimes(getCacheFileName(key).c_str(), NULL);
+    }
+
+    return true;
+}
+
+void TCGLLVMContextPrivate::saveCachedFunction(uint64_t key,
+                                               TranslationBlock *tb)
+{
+    OwningPtr<Module> cacheModule(new Module("tcg-llvm-cache", m_context));
+    Function *cachedFunction = Function::Create(
+            m_tbFunction->getFunctionType(), Function::ExternalLinkage,
+            TB_CACHE_FUNCTION, cacheModule.get());
+
+    /* Declare called functions, they are resolved by name on load.
+       Blocks that refer to other global values are not cached. */
+    ValueToValueMapTy vmap;
+    for (Function::iterator bb = m_tbFunction->begin();
+         bb != m_tbFunction->end(); ++bb) {
+        for (BasicBlock::iterator inst = bb->begin(); inst != bb->end(); ++inst) {
+            for (unsigned i = 0; i < inst->getNumOperands(); ++i) {
+                Value *op = inst->getOperand(i);
+                if (Function *f = dyn_cast<Function>(op)) {
+                    if (!vmap.count(f)) {
+                        vmap[f] = Function::Create(f->getFunctionType(),
+                                Function::ExternalLinkage, f->getName(),
+                                cacheModule.get());
+                    }
+                } else if (isa<Constant>(op) &&
+                           referencesGlobalValue(cast<Constant>(op))) {
+                    return;
+                }
+            }
+        }
+    }
+
+    Function::arg_iterator newArg = cachedFunction->arg_begin();
+    for (Function::const_arg_iterator arg = m_tbFunction->arg_begin();
+         arg != m_tbFunction->arg_end(); ++arg, ++newArg) {
+        vmap[arg] = newArg;
+    }
+
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(cachedFunction, m_tbFunction, vmap, true, returns);
+    cachedFunction->setLinkage(Function::ExternalLinkage);
+
+    Value *info[] = {
+        ConstantInt::get(intType(64), key),
+        ConstantInt::get(intType(64), (uintptr_t) tb),
+        ConstantInt::get(intType(64), tb->pc),
+        ConstantInt::get(intType(64), tb->cs_base),
+        ConstantInt::get(intType(64), tb->flags)
+    };
+    cacheModule->getOrInsertNamedMetadata(TB_CACHE_METADATA)->addOperand(
+            MDNode::get(m_context, info));
+
+    std::vector<Value*> relocInfo;
+    for (unsigned i = 0; i < m_relocations.size(); ++i) {
+        relocInfo.push_back(ConstantInt::get(intType(64), m_relocations[i]));
+    }
+    cacheModule->getOrInsertNamedMetadata(TB_CACHE_RELOCATIONS)->addOperand(
+            MDNode::get(m_context, relocInfo));
+
+    /* Several S2E processes may share the cache, write the file atomically */
+    std::string fileName = getCacheFileName(key);
+    std::ostringstream tmpFileName;
+    tmpFileName << fileName << ".tmp" << getpid();
+
+    std::string error;
+    uint64_t fileSize;
+    {
+        raw_fd_ostream os(tmpFileName.str().c_str(), error,
+                          raw_fd_ostream::F_Binary);
+        if (!error.empty()) {
+            return;
+        }
+        WriteBitcodeToFile(cacheModule.get(), os);
+        fileSize = os.tell();
+    }
+
+    if (rename(tmpFileName.str().c_str(), fileName.c_str()) < 0) {
+        unlink(tmpFileName.str().c_str());
+        return;
+    }
+
+    m_cacheSize += fileSize;
+    if (m_cacheMaxSize && m_cacheSize > m_cacheMaxSize) {
+        trimCache();
+    }
+}
+
 /***********************************/
 /* External interface for C++ code */
 
@@ -1479,6 +2018,27 @@ void TCGLLVMContext::initializeHelpers()
 }
 #endif
 
+void TCGLLVMContext::setTranslationCacheDir(const std::string &dir,
+                                            uint64_t maxSize)
+{
+    m_private->setCacheDir(dir, maxSize);
+}
+
+void TCGLLVMContext::addRelocation(uint64_t value)
+{
+    m_private->addRelocation(value);
+}
+
+uint64_t TCGLLVMContext::getTranslationCacheHits() const
+{
+    return m_private->m_cacheHits;
+}
+
+uint64_t TCGLLVMContext::getTranslationCacheMisses() const
+{
+    return m_private->m_cacheMisses;
+}
+
 void TCGLLVMContext::generateCode(TCGContext *s, TranslationBlock *tb)
 {
     assert(tb->tcg_llvm_context == NULL);
@@ -1510,6 +2070,11 @@ void tcg_llvm_gen_code(TCGLLVMContext *l, TCGContext *s, TranslationBlock *tb)
     l->generateCode(s, tb);
 }
 
+void tcg_llvm_add_relocation(TCGLLVMContext *l, uint64_t value)
+{
+    l->addRelocation(value);
+}
+
 void tcg_llvm_tb_alloc(TranslationBlock *tb)
 {
     tb->tcg_llvm_context = NULL;
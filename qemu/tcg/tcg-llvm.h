@@ -81,6 +81,10 @@ void tcg_llvm_tb_free(struct TranslationBlock *tb);
 
 void tcg_llvm_gen_code(struct TCGLLVMContext *l, struct TCGContext *s,
                        struct TranslationBlock *tb);
+
+/* Marks the value of the movi that was just emitted as a host pointer,
+   which the persistent translation cache must patch when reusing code */
+void tcg_llvm_add_relocation(struct TCGLLVMContext *l, uint64_t value);
 const char* tcg_llvm_get_func_name(struct TranslationBlock *tb);
 
 uintptr_t tcg_llvm_qemu_tb_exec(void *env, TranslationBlock *tb);
@@ -98,6 +102,8 @@ int tcg_llvm_search_last_pc(struct TranslationBlock *tb, uintptr_t searched_pc);
 /***********************************/
 /* External interface for C++ code */
 
+#include <string>
+
 namespace llvm {
     class Function;
     class LLVMContext;
@@ -132,6 +138,15 @@ public:
     void initializeHelpers();
 #endif
 
+    /** Stores generated functions in the given directory and reuses
+        them across runs and processes. The least recently used files
+        are evicted once the directory exceeds maxSize bytes (0 for
+        no limit). */
+    void setTranslationCacheDir(const std::string &dir, uint64_t maxSize = 0);
+    void addRelocation(uint64_t value);
+    uint64_t getTranslationCacheHits() const;
+    uint64_t getTranslationCacheMisses() const;
+
     void generateCode(struct TCGContext *s,
                       struct TranslationBlock *tb);
 };
@@ -1156,6 +1156,398 @@ void tcg_calc_regmask_ex(TCGContext *s, uint64_t *rmask, uint64_t *wmask,
         args += nb_iargs + nb_oargs + nb_cargs;
     }
 }
+
+/* Size of a temp in bytes, as a byte mask */
+static inline uint8_t tcg_temp_bytes(TCGContext *s, TCGArg idx)
+{
+    return s->temps[idx].type == TCG_TYPE_I32 ? 0x0f : 0xff;
+}
+
+/* Returns the bytes replaced by a byte-aligned deposit, 0 otherwise */
+static inline uint8_t tcg_deposit_bytes(const TCGArg *args, int *shift)
+{
+    TCGArg ofs = args[3], len = args[4];
+    if ((ofs | len) & 7) {
+        return 0;
+    }
+    *shift = ofs / 8;
+    return ((1 << (len / 8)) - 1) << *shift;
+}
+
+typedef struct TCGByteOrigin {
+    int16_t global[TCG_MAX_TEMPS]; /* Global whose entry value a temp holds */
+    uint8_t ident[TCG_MAX_TEMPS];  /* Bytes still equal to that entry value */
+} TCGByteOrigin;
+
+static void tcg_byte_origin_meet(TCGContext *s, TCGByteOrigin *dst,
+                                 const TCGByteOrigin *src)
+{
+    int i;
+    for (i = 0; i < s->nb_globals + s->nb_temps; i++) {
+        if (dst->global[i] == src->global[i]) {
+            dst->ident[i] &= src->ident[i];
+        } else {
+            dst->global[i] = -1;
+            dst->ident[i] = 0;
+        }
+    }
+}
+
+/* Byte-granular version of tcg_calc_regmask for the first nb_regs globals.
+   rbytes gets the bytes of each global whose value at TB entry may affect
+   the execution of the TB, wbytes the bytes that may hold a different value
+   when the TB exits, either normally or through an exception, and kbytes
+   the bytes whose entry value is overwritten before anything can observe it.
+
+   A forward pass tracks which bytes of each temp are unchanged copies of a
+   global's entry value (e.g., the upper bytes of EAX after a write to AL).
+   A backward pass then propagates the bytes that are actually demanded,
+   through movs, byte-aligned deposits and zero/sign extensions. Anything
+   else demands all bytes of its inputs. Bytes that only flow back unchanged
+   into the same global are not demanded.
+   If the TB cannot be analyzed, all bytes are reported. */
+void tcg_calc_regmask_bytes(TCGContext *s, uint8_t *rbytes, uint8_t *wbytes,
+                            uint8_t *kbytes, int nb_regs)
+{
+    const TCGArg *args, **op_args;
+    const TCGOpDef *def;
+    uint64_t *op_rmask;
+    uint8_t **op_exit, **label_demand, *e;
+    TCGByteOrigin cur, **label_origin;
+    uint64_t temps[TCG_MAX_TEMPS];
+    uint8_t demand[TCG_MAX_TEMPS];
+    uint8_t killed[TCG_MAX_TEMPS];
+    uint8_t *label_defined;
+    int c, i, k, nb_ops, nb_temps, nb_globals;
+    int nb_oargs, nb_iargs, nb_cargs, label, reachable, shift;
+
+    nb_globals = s->nb_globals;
+    nb_temps = s->nb_globals + s->nb_temps;
+    nb_ops = gen_opc_ptr - gen_opc_buf;
+
+    op_args = tcg_malloc(nb_ops * sizeof(op_args[0]));
+    op_rmask = tcg_malloc(nb_ops * sizeof(op_rmask[0]));
+    op_exit = tcg_malloc(nb_ops * sizeof(op_exit[0]));
+    label_origin = tcg_malloc((s->nb_labels + 1) * sizeof(label_origin[0]));
+    label_demand = tcg_malloc((s->nb_labels + 1) * sizeof(label_demand[0]));
+    label_defined = tcg_malloc(s->nb_labels + 1);
+    memset(label_origin, 0, (s->nb_labels + 1) * sizeof(label_origin[0]));
+    memset(label_defined, 0, s->nb_labels + 1);
+
+    memset(temps, 0, sizeof(temps[0]) * nb_temps);
+    memset(wbytes, 0, nb_regs);
+    memset(killed, 0xff, nb_globals);
+
+    for (i = 0; i < nb_temps; i++) {
+        cur.global[i] = i < nb_globals ? i : -1;
+        cur.ident[i] = i < nb_globals ? tcg_temp_bytes(s, i) : 0;
+    }
+
+    /* Forward pass: locate op arguments, resolve helpers and compute
+       which bytes of the globals are unchanged at each exit point */
+    args = gen_opparam_buf;
+    reachable = 1;
+    for (k = 0; k < nb_ops; k++) {
+        c = gen_opc_buf[k];
+        def = &tcg_op_defs[c];
+        op_rmask[k] = 0;
+        op_exit[k] = NULL;
+
+        if (c == INDEX_op_call) {
+            TCGArg arg_count = *args++;
+            uint64_t func_rmask, func_wmask, func_accesses_mem;
+
+            nb_oargs = arg_count >> 16;
+            nb_iargs = arg_count & 0xffff;
+            nb_cargs = def->nb_cargs;
+
+            tcg_helper_get_reg_mask(s, (void*) temps[args[nb_oargs + nb_iargs - 1]],
+                                    &func_rmask, &func_wmask,
+                                    &func_accesses_mem);
+            op_rmask[k] = func_rmask;
+
+            for (i = 0; i < nb_globals && i < 64; i++) {
+                if (func_wmask & (1ULL << i)) {
+                    cur.global[i] = -1;
+                    cur.ident[i] = 0;
+                }
+            }
+        } else if (c == INDEX_op_nopn) {
+            nb_cargs = *args;
+            nb_oargs = 0;
+            nb_iargs = 0;
+        } else {
+            nb_oargs = def->nb_oargs;
+            nb_iargs = def->nb_iargs;
+            nb_cargs = def->nb_cargs;
+        }
+        op_args[k] = args;
+
+        label = -1;
+        switch (c) {
+        case INDEX_op_br:
+            label = args[0];
+            break;
+        case INDEX_op_brcond_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_brcond_i64:
+#endif
+            label = args[3];
+            break;
+#if TCG_TARGET_REG_BITS == 32
+        case INDEX_op_brcond2_i32:
+            label = args[5];
+            break;
+#endif
+        case INDEX_op_set_label:
+            label = args[0];
+            if (!reachable && !label_origin[label]) {
+                /* Dead code, nothing is known */
+                for (i = 0; i < nb_temps; i++) {
+                    cur.global[i] = -1;
+                    cur.ident[i] = 0;
+                }
+            } else if (!reachable) {
+                cur = *label_origin[label];
+            } else if (label_origin[label]) {
+                tcg_byte_origin_meet(s, &cur, label_origin[label]);
+            }
+            label_defined[label] = 1;
+            reachable = 1;
+            break;
+        default:
+            break;
+        }
+
+        if (label >= 0 && c != INDEX_op_set_label) {
+            if (label_defined[label]) {
+                /* Backward branch, give up */
+                goto conservative;
+            }
+            if (!label_origin[label]) {
+                label_origin[label] = tcg_malloc(sizeof(TCGByteOrigin));
+                *label_origin[label] = cur;
+            } else {
+                tcg_byte_origin_meet(s, label_origin[label], &cur);
+            }
+            if (c == INDEX_op_br) {
+                reachable = 0;
+            }
+        } else if ((def->flags & TCG_OPF_BB_END) && c != INDEX_op_exit_tb &&
+                   c != INDEX_op_goto_tb) {
+            /* Indirect jump */
+            goto conservative;
+        }
+
+        if (c == INDEX_op_exit_tb || c == INDEX_op_goto_tb ||
+            c == INDEX_op_call || (def->flags & TCG_OPF_CALL_CLOBBER)) {
+            /* Register state is visible to the outside at this point */
+            e = tcg_malloc(nb_globals);
+            for (i = 0; i < nb_globals; i++) {
+                e[i] = tcg_temp_bytes(s, i);
+                if (cur.global[i] == i) {
+                    e[i] &= ~cur.ident[i];
+                }
+                if (i < nb_regs) {
+                    wbytes[i] |= e[i];
+                }
+                killed[i] &= e[i];
+            }
+            op_exit[k] = e;
+            if (c == INDEX_op_exit_tb) {
+                reachable = 0;
+            }
+        }
+
+        switch (c) {
+        case INDEX_op_movi_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_movi_i64:
+#endif
+            temps[args[0]] = args[1];
+            cur.global[args[0]] = -1;
+            cur.ident[args[0]] = 0;
+            break;
+        case INDEX_op_mov_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_mov_i64:
+#endif
+            temps[args[0]] = 0;
+            cur.global[args[0]] = cur.global[args[1]];
+            cur.ident[args[0]] = cur.ident[args[1]];
+            break;
+        case INDEX_op_deposit_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_deposit_i64:
+#endif
+        {
+            uint8_t m = tcg_deposit_bytes(args, &shift);
+            temps[args[0]] = 0;
+            if (m) {
+                cur.global[args[0]] = cur.global[args[1]];
+                cur.ident[args[0]] = cur.ident[args[1]] & ~m;
+            } else {
+                cur.global[args[0]] = -1;
+                cur.ident[args[0]] = 0;
+            }
+            break;
+        }
+        default:
+            for (i = 0; i < nb_oargs; i++) {
+                temps[args[i]] = 0;
+                cur.global[args[i]] = -1;
+                cur.ident[args[i]] = 0;
+            }
+            break;
+        }
+
+        args += nb_iargs + nb_oargs + nb_cargs;
+    }
+
+    /* Backward pass: propagate demanded bytes */
+    for (i = 0; i < nb_temps; i++) {
+        demand[i] = i < nb_globals ? tcg_temp_bytes(s, i) : 0;
+    }
+
+    for (k = nb_ops - 1; k >= 0; k--) {
+        uint8_t out = 0;
+
+        c = gen_opc_buf[k];
+        def = &tcg_op_defs[c];
+        args = op_args[k];
+
+        if (c == INDEX_op_call) {
+            nb_oargs = args[-1] >> 16;
+            nb_iargs = args[-1] & 0xffff;
+        } else if (c == INDEX_op_nopn) {
+            continue;
+        } else {
+            nb_oargs = def->nb_oargs;
+            nb_iargs = def->nb_iargs;
+        }
+
+        switch (c) {
+        case INDEX_op_set_label:
+            label_demand[args[0]] = tcg_malloc(nb_temps);
+            memcpy(label_demand[args[0]], demand, nb_temps);
+            continue;
+        case INDEX_op_br:
+            e = label_demand[args[0]];
+            for (i = 0; i < nb_temps; i++) {
+                demand[i] = e ? e[i] : tcg_temp_bytes(s, i);
+            }
+            continue;
+        case INDEX_op_brcond_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_brcond_i64:
+#endif
+#if TCG_TARGET_REG_BITS == 32
+        case INDEX_op_brcond2_i32:
+#endif
+            e = label_demand[c == INDEX_op_brcond2_i32 ? args[5] : args[3]];
+            for (i = 0; i < nb_temps; i++) {
+                demand[i] |= e ? e[i] : tcg_temp_bytes(s, i);
+            }
+            break;
+        case INDEX_op_exit_tb:
+        case INDEX_op_goto_tb:
+            memset(demand, 0, nb_temps);
+            memcpy(demand, op_exit[k], nb_globals);
+            continue;
+        default:
+            break;
+        }
+
+        for (i = 0; i < nb_oargs; i++) {
+            out |= demand[args[i]];
+            demand[args[i]] = 0;
+        }
+
+        if (op_exit[k]) {
+            for (i = 0; i < nb_globals; i++) {
+                demand[i] |= op_exit[k][i];
+            }
+        }
+
+        switch (c) {
+        case INDEX_op_call:
+            for (i = 0; i < nb_globals && i < 64; i++) {
+                if (op_rmask[k] & (1ULL << i)) {
+                    demand[i] = tcg_temp_bytes(s, i);
+                }
+            }
+            for (i = 0; i < nb_iargs; i++) {
+                TCGArg idx = args[nb_oargs + i];
+                if (idx < nb_temps) {
+                    demand[idx] = tcg_temp_bytes(s, idx);
+                }
+            }
+            break;
+        case INDEX_op_mov_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_mov_i64:
+#endif
+            demand[args[1]] |= out;
+            break;
+        case INDEX_op_ext8s_i32:
+        case INDEX_op_ext8u_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_ext8s_i64:
+        case INDEX_op_ext8u_i64:
+#endif
+            demand[args[1]] |= out ? 0x01 : 0;
+            break;
+        case INDEX_op_ext16s_i32:
+        case INDEX_op_ext16u_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_ext16s_i64:
+        case INDEX_op_ext16u_i64:
+#endif
+            demand[args[1]] |= out ? 0x03 : 0;
+            break;
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_ext32s_i64:
+        case INDEX_op_ext32u_i64:
+            demand[args[1]] |= out ? 0x0f : 0;
+            break;
+#endif
+        case INDEX_op_deposit_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_deposit_i64:
+#endif
+        {
+            uint8_t m = tcg_deposit_bytes(args, &shift);
+            if (m) {
+                demand[args[1]] |= out & ~m;
+                demand[args[2]] |= (out & m) >> shift;
+            } else if (out) {
+                demand[args[1]] = tcg_temp_bytes(s, args[1]);
+                demand[args[2]] = tcg_temp_bytes(s, args[2]);
+            }
+            break;
+        }
+        default:
+            if (out || nb_oargs == 0 || (def->flags & TCG_OPF_SIDE_EFFECTS)) {
+                for (i = 0; i < nb_iargs; i++) {
+                    TCGArg idx = args[nb_oargs + i];
+                    demand[idx] = tcg_temp_bytes(s, idx);
+                }
+            }
+            break;
+        }
+    }
+
+    for (i = 0; i < nb_regs; i++) {
+        rbytes[i] = i < nb_globals ? demand[i] : 0;
+        kbytes[i] = i < nb_globals ? killed[i] & ~demand[i] : 0;
+    }
+    return;
+
+conservative:
+    memset(rbytes, 0xff, nb_regs);
+    memset(wbytes, 0xff, nb_regs);
+    memset(kbytes, 0, nb_regs);
+}
 #endif
 
 
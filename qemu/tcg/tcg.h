@@ -615,6 +615,9 @@ void tcg_calc_regmask_ex(TCGContext *s, uint64_t *rmask, uint64_t *wmask,
 
 void tcg_calc_regmask(TCGContext *s, uint64_t *rmask, uint64_t *wmask,
                       uint64_t *accesses_mem);
+
+void tcg_calc_regmask_bytes(TCGContext *s, uint8_t *rbytes, uint8_t *wbytes,
+                            uint8_t *kbytes, int nb_regs);
 #endif
 
 void tcg_register_jit(void *buf, size_t buf_size);
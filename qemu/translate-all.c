@@ -115,6 +115,8 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #ifdef CONFIG_S2E
     tcg_calc_regmask(s, &tb->reg_rmask, &tb->reg_wmask,
                      &tb->helper_accesses_mem);
+    tcg_calc_regmask_bytes(s, tb->reg_rbytes, tb->reg_wbytes,
+                           tb->reg_kbytes, S2E_TB_REG_BYTES_COUNT);
 #endif
 
 #if defined(CONFIG_LLVM)